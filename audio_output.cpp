@@ -2,19 +2,10 @@
 #include <atomic>
 #include <thread>
 #include <mutex>
-#include <portaudio.h>
+#include <cstring>
 #include "log.hpp"
 #include "buffers/ring_buffer.hpp"
-
-#ifdef _WIN32
-typedef unsigned long u_long;
-#endif
-
-template <typename SampleT>
-struct data_type_table;
-
-template <> struct data_type_table<short> { enum { value = paInt16 }; };
-template <> struct data_type_table<float> { enum { value = paFloat32 }; };
+#include "backends/portaudio_backend.hpp"
 
 template <typename SampleT>
 struct audio_context {
@@ -30,7 +21,23 @@ struct audio_context {
     std::atomic<bool> shutdown;
     std::atomic<bool> paused;
 
-    audio_context() : stream_ptr(nullptr) { }
+    // Written only by the callback, read by any thread through audio_output::get_stats()
+    std::atomic<size_t> callbacks;
+    std::atomic<size_t> xruns;
+    std::atomic<size_t> underflows;
+    std::atomic<size_t> silent_samples;
+
+    // Accumulates across play() calls, unlike the counters above
+    stage_metrics metrics;
+
+    audio_context() : stream_ptr(nullptr), shutdown(false), paused(false), metrics("audio_output") { reset_stats(); }
+
+    void reset_stats() {
+        callbacks = 0;
+        xruns = 0;
+        underflows = 0;
+        silent_samples = 0;
+    }
 };
 
 
@@ -38,197 +45,108 @@ template <typename SampleT>
 struct audio_output<SampleT>::state_t {
     std::unique_ptr<std::thread> audio_thread_ptr;
     audio_context<SampleT> context;
+    output_backend* backend;
+    std::unique_ptr<output_backend> owned_backend;
 };
 
-typedef int callback(const void* input, void* output, u_long frame_count,
-                     const PaStreamCallbackTimeInfo* time_info, PaStreamCallbackFlags status_flags,
-                     void* userdata);
-
-int audio_output_callback_s16(const void* input, void* output, u_long frame_count,
-                              const PaStreamCallbackTimeInfo* time_info, PaStreamCallbackFlags status_flags,
-                              void* userdata) {
-    short* out = static_cast<short*>(output);
-    using context = audio_context<short>;
-    context* context_ptr = static_cast<context*>(userdata);
-
-    if(!context_ptr) {
-        SM_LOG("Null context passed. Aborting");
-        return paAbort;
-    }
-
-    static typename context::buffer_t buffer(context_ptr->buffer_size);
-
-    size_t len = 0;
-    if(context_ptr->paused.load(std::memory_order::memory_order_relaxed)) {
-        memset(buffer.data(), 0x00, sizeof(short)*context_ptr->buffer_size);
-        len = context_ptr->buffer_size;
-    } else
-        len = context_ptr->stream_ptr->read(buffer, context_ptr->buffer_size);
-
-    if(len == 0 || context_ptr->shutdown) {
-        SM_LOG("Complete");
-        return paComplete;
-    }
-
-    for(size_t i = 0; i != len; ++i) *out++ = buffer[i];
-    return paContinue;
-}
-
-int audio_output_callback_f32(const void* input, void* output, u_long frame_count,
-                              const PaStreamCallbackTimeInfo* time_info, PaStreamCallbackFlags status_flags,
-                              void* userdata) {
-    float* out = static_cast<float*>(output);
-    using context = audio_context<float>;
+// Runs on the device's real-time thread: no allocation, locks or logging here.  Only the stream's read() is called
+// and the graph is expected to honour the same rules.
+template <typename SampleT>
+render_result audio_output_callback(void* output, size_t frame_count, unsigned status, void* userdata) {
+    SampleT* out = static_cast<SampleT*>(output);
+    using context = audio_context<SampleT>;
     context* context_ptr = static_cast<context*>(userdata);
 
-    if(!context_ptr) {
-        SM_LOG("Null context passed. Aborting");
-        return paAbort;
-    }
-
-    static typename context::buffer_t buffer(context_ptr->buffer_size);
-
-    size_t len = 0;
-    if(context_ptr->paused.load(std::memory_order::memory_order_relaxed)) {
-        memset(buffer.data(), 0x00, sizeof(float)*context_ptr->buffer_size);
-        len = context_ptr->buffer_size;
-    } else
-        len = context_ptr->stream_ptr->read(buffer, context_ptr->buffer_size);
-
-    if(len == 0 || context_ptr->shutdown) {
-        SM_LOG("Complete");
-        return paComplete;
-    }
-
-    for(size_t i = 0; i != len; ++i) *out++ = buffer[i];
-    return paContinue;
+    if(!context_ptr) return render_result::RR_ABORT;
+
+    const auto start = metrics_clock::now();
+    const auto relaxed = std::memory_order_relaxed;
+    context_ptr->callbacks.store(context_ptr->callbacks.load(relaxed) + 1, relaxed);
+    if(status & (OS_UNDERFLOW | OS_OVERFLOW)) context_ptr->xruns.store(context_ptr->xruns.load(relaxed) + 1, relaxed);
+
+    // Decode straight into the device buffer, the backend decides the frame count
+    const size_t buffer_size = frame_count * context_ptr->channels;
+    const bool paused = context_ptr->paused.load(relaxed);
+    const size_t len = paused ? 0 : context_ptr->stream_ptr->read(out, buffer_size);
+    if(!paused) context_ptr->metrics.record_read(buffer_size, len);
+
+    // A completing buffer is still played, so it must be silent too
+    if(len < buffer_size) {
+        memset(out + len, 0x00, sizeof(SampleT)*(buffer_size - len));
+        if(!paused) {
+            context_ptr->underflows.store(context_ptr->underflows.load(relaxed) + 1, relaxed);
+            context_ptr->silent_samples.store(context_ptr->silent_samples.load(relaxed) + buffer_size - len, relaxed);
+            context_ptr->metrics.underflows.add();
+        }
+    }
+
+    // The backend may vary the frame count, so the budget follows each callback's buffer period
+    context_ptr->metrics.budget_ns.set(uint64_t(frame_count)*1000000000ull/context_ptr->sample_rate);
+    context_ptr->metrics.record_work(elapsed_ns(start));
+
+    // An empty read only ends playback if the stream has finished, otherwise it is an underrun played as silence
+    const bool finished = len == 0 && !paused && context_ptr->stream_ptr->is_finished();
+    if(finished || context_ptr->shutdown.load(relaxed)) return render_result::RR_COMPLETE;
+    return render_result::RR_CONTINUE;
 }
 
-template <>
-void audio_output<short>::audio_thread_fnc(audio_output* parent_ptr) {
+template <typename SampleT>
+void audio_output<SampleT>::audio_thread_fnc(audio_output* parent_ptr) {
     SM_LOG("Starting", parent_ptr->channels(), parent_ptr->sample_rate(), parent_ptr->frame_size());
 
     auto context_ptr = &parent_ptr->s.context;
+    auto backend = parent_ptr->s.backend;
 
     context_ptr->channels = parent_ptr->channels();
     context_ptr->sample_rate = parent_ptr->sample_rate();
     context_ptr->channel_frame_size = parent_ptr->frame_size()/parent_ptr->channels();
     context_ptr->buffer_size = parent_ptr->frame_size();
 
-    if(Pa_Initialize() != paNoError) {
-        SM_LOG("Error initialising portaudio");
-        return;
-    }
-
-    PaStreamParameters output_parms;
-    output_parms.device = Pa_GetDefaultOutputDevice();
-    if(output_parms.device == paNoDevice) {
-        SM_LOG("Portaudio could not find a default playback device");
-        return;
-    }
-
-    PaStream* pa_stream;
-    PaError err = Pa_OpenDefaultStream(
-            &pa_stream,
-            0,
-            int(parent_ptr->channels()),
-            data_type_table<short>::value,
-            parent_ptr->sample_rate(),
+    output_format format = {
+            context_ptr->channels,
+            context_ptr->sample_rate,
             context_ptr->channel_frame_size,
-            &audio_output_callback_s16,
-            context_ptr
-    );
-
-    if(err != paNoError) {
-        SM_LOG("Pa_OpenStream failed:", err, Pa_GetErrorText(err));
-        if(pa_stream) Pa_CloseStream(pa_stream);
-        return;
-    }
-
-    if(Pa_StartStream(pa_stream) != paNoError) {
-        SM_LOG("Pa_StartStream failed:", err, Pa_GetErrorText(err));
-        if(pa_stream) Pa_CloseStream(pa_stream);
-        return;
-    }
-
-    while(Pa_IsStreamActive(pa_stream) > 0) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-    }
-
-    // Should lock this (atomic type?)
-    parent_ptr->audio_state_ = audio_state::AS_COMPLETED;
-
-    if(Pa_Terminate() != paNoError) {
-        SM_LOG("Pa_Terminate error:", err, Pa_GetErrorText(err));
-        return;
-    }
-}
-
-template <>
-void audio_output<float>::audio_thread_fnc(audio_output* parent_ptr) {
-    SM_LOG("Starting", parent_ptr->channels(), parent_ptr->sample_rate(), parent_ptr->frame_size());
-
-    auto context_ptr = &parent_ptr->s.context;
-
-    context_ptr->channels = parent_ptr->channels();
-    context_ptr->sample_rate = parent_ptr->sample_rate();
-    context_ptr->channel_frame_size = parent_ptr->frame_size()/parent_ptr->channels();
-    context_ptr->buffer_size = parent_ptr->frame_size();
-
-    if(Pa_Initialize() != paNoError) {
-        SM_LOG("Error initialising portaudio");
-        return;
-    }
+            sample_format_of<SampleT>::value
+    };
 
-    PaStreamParameters output_parms;
-    output_parms.device = Pa_GetDefaultOutputDevice();
-    if(output_parms.device == paNoDevice) {
-        SM_LOG("Portaudio could not find a default playback device");
+    if(!backend->open(format, &audio_output_callback<SampleT>, context_ptr)) {
+        SM_LOG("Failed to open the output backend");
+        parent_ptr->audio_state_ = audio_state::AS_COMPLETED;
         return;
     }
 
-    PaStream* pa_stream;
-    PaError err = Pa_OpenDefaultStream(
-            &pa_stream,
-            0,
-            int(parent_ptr->channels()),
-            data_type_table<float>::value,
-            parent_ptr->sample_rate(),
-            context_ptr->channel_frame_size,
-            &audio_output_callback_f32,
-            context_ptr
-    );
-
-    if(err != paNoError) {
-        SM_LOG("Pa_OpenStream failed:", err, Pa_GetErrorText(err));
-        if(pa_stream) Pa_CloseStream(pa_stream);
+    if(!backend->start()) {
+        SM_LOG("Failed to start the output backend");
+        backend->close();
+        parent_ptr->audio_state_ = audio_state::AS_COMPLETED;
         return;
     }
 
-    if(Pa_StartStream(pa_stream) != paNoError) {
-        SM_LOG("Pa_StartStream failed:", err, Pa_GetErrorText(err));
-        if(pa_stream) Pa_CloseStream(pa_stream);
-        return;
+    // Headless backends may render much faster than realtime, so poll finely enough not to hold them up
+    while(backend->is_active()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
 
-    while(Pa_IsStreamActive(pa_stream) > 0) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-    }
+    SM_LOG("Complete");
 
     // Should lock this (atomic type?)
     parent_ptr->audio_state_ = audio_state::AS_COMPLETED;
 
-    if(Pa_Terminate() != paNoError) {
-        SM_LOG("Pa_Terminate error:", err, Pa_GetErrorText(err));
-        return;
-    }
+    backend->close();
 }
 
 template <typename SampleT>
-audio_output<SampleT>::audio_output(stream_t* stream_ptr, size_t channels, size_t sample_rate, size_t frame_size)
+audio_output<SampleT>::audio_output(stream_t* stream_ptr, size_t channels, size_t sample_rate, size_t frame_size,
+                                    output_backend* backend)
         : audio_state_(audio_state::AS_STOPPED), channels_(channels), sample_rate_(sample_rate),
           frame_size_(frame_size), state_(new state_t()), s(*state_) {
     state_->context.stream_ptr = stream_ptr;
+
+    if(backend == nullptr) {
+        state_->owned_backend = std::make_unique<portaudio_backend>();
+        backend = state_->owned_backend.get();
+    }
+    state_->backend = backend;
 }
 
 template <typename SampleT>
@@ -253,6 +171,27 @@ typename audio_output<SampleT>::stream_t* audio_output<SampleT>::get_stream() co
     return s.context.stream_ptr;
 }
 
+template <typename SampleT>
+output_stats audio_output<SampleT>::get_stats() const {
+    const auto relaxed = std::memory_order_relaxed;
+    output_stats stats;
+    stats.callbacks = s.context.callbacks.load(relaxed);
+    stats.xruns = s.context.xruns.load(relaxed);
+    stats.underflows = s.context.underflows.load(relaxed);
+    stats.silent_samples = s.context.silent_samples.load(relaxed);
+    return stats;
+}
+
+template <typename SampleT>
+const stage_metrics& audio_output<SampleT>::get_metrics() const {
+    return s.context.metrics;
+}
+
+template <typename SampleT>
+output_backend* audio_output<SampleT>::get_backend() const {
+    return s.backend;
+}
+
 template <typename SampleT>
 void audio_output<SampleT>::play() {
     if(!is_stopped()) return;
@@ -264,8 +203,11 @@ void audio_output<SampleT>::play() {
         return;
     }
 
-    s.audio_thread_ptr = std::make_unique<std::thread>(audio_output<SampleT>::audio_thread_fnc, this);
+    s.context.reset_stats();
+
+    // Set before the thread starts, a headless backend can complete before make_unique returns
     audio_state_ = audio_state::AS_PLAYING;
+    s.audio_thread_ptr = std::make_unique<std::thread>(audio_output<SampleT>::audio_thread_fnc, this);
 }
 
 template <typename SampleT>
@@ -3,11 +3,23 @@
 
 #include <memory>
 #include "streams/audio_stream.hpp"
+#include "metrics.hpp"
 
 /*
- * audio_output is the output device and interface to portaudio.
+ * audio_output drives a stream into an output backend.  Without an explicit backend it plays through portaudio; a
+ * null_backend or file_backend runs the same graph headless.  The backend is not owned and must outlive playback.
  */
 
+class output_backend;
+
+// Counters maintained by the real-time callback, reset by play()
+struct output_stats {
+    size_t callbacks;
+    size_t xruns;               // Callbacks the backend flagged with a device underflow or overflow
+    size_t underflows;          // Callbacks where the stream returned fewer samples than requested
+    size_t silent_samples;      // Samples zero-filled because of those short reads
+};
+
 template <typename SampleT>
 class ZAPAUDIO_EXPORT audio_output {
 public:
@@ -22,11 +34,18 @@ public:
     using buffer_t = std::vector<SampleT>;
     using stream_t = audio_stream<SampleT>;
 
-    audio_output(stream_t* stream_ptr, size_t channels=2, size_t sample_rate=44100, size_t frame_size=1024);
+    audio_output(stream_t* stream_ptr, size_t channels=2, size_t sample_rate=44100, size_t frame_size=1024,
+                 output_backend* backend=nullptr);
     ~audio_output();
 
     void set_stream(stream_t* stream_ptr);
     stream_t* get_stream() const;
+    output_backend* get_backend() const;
+
+    // Safe to call from any thread while playing
+    output_stats get_stats() const;
+    // Callback execution time against the buffer period, plus read counters for the stream feeding the device
+    const stage_metrics& get_metrics() const;
 
     void play();
     void pause();
@@ -0,0 +1,17 @@
+#include "file_backend.hpp"
+
+bool file_backend::open(const output_format& format, render_fnc fnc, void* userdata) {
+    if(!null_backend::open(format, fnc, userdata)) return false;
+
+    if(!writer_.open(filename_, format.channels, format.sample_rate, format.format, type_)) {
+        null_backend::close();
+        return false;
+    }
+    return true;
+}
+
+void file_backend::close() {
+    // Stops the device thread before the header is finalised
+    null_backend::close();
+    writer_.close();
+}
@@ -0,0 +1,32 @@
+#ifndef ZAPAUDIO_FILE_BACKEND_HPP
+#define ZAPAUDIO_FILE_BACKEND_HPP
+
+#include <string>
+#include "null_backend.hpp"
+#include "tools/wave_writer.hpp"
+
+/*
+ * Renders to a WAV or raw PCM file instead of a device, by default as fast as the graph can produce audio.
+ */
+
+class ZAPAUDIO_EXPORT file_backend : public null_backend {
+public:
+    file_backend(const std::string& filename, file_format type=file_format::wav, double speed=0.)
+            : null_backend(speed), filename_(filename), type_(type) { }
+    virtual ~file_backend() { close(); }
+
+    virtual bool open(const output_format& format, render_fnc fnc, void* userdata) override;
+    virtual void close() override;
+
+    uint64_t bytes_written() const { return writer_.data_bytes(); }
+
+protected:
+    virtual void consume(const void* data, size_t bytes) override { writer_.write(data, bytes); }
+
+private:
+    std::string filename_;
+    file_format type_;
+    wave_writer writer_;
+};
+
+#endif //ZAPAUDIO_FILE_BACKEND_HPP
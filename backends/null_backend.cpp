@@ -0,0 +1,109 @@
+#include "null_backend.hpp"
+#include <cstring>
+#include "log.hpp"
+
+null_backend::null_backend(double speed) : speed_(speed > 0. ? speed : 0.), format_{0, 0, 0, sample_format::s16},
+        active_(false), shutdown_(false), callbacks_(0), underflows_(0), frames_(0), stalled_us_(0) {
+}
+
+null_backend::~null_backend() {
+    close();
+}
+
+bool null_backend::open(const output_format& format, render_fnc fnc, void* userdata) {
+    close();
+
+    if(format.channels == 0 || format.sample_rate == 0 || format.frames == 0 || !fnc) {
+        SM_LOG("Invalid output format for null_backend");
+        return false;
+    }
+
+    format_ = format;
+    target_ = render_target(fnc, userdata);
+    buffer_.resize(format_.buffer_bytes());
+    return true;
+}
+
+bool null_backend::start() {
+    if(buffer_.empty() || thread_) return false;
+
+    callbacks_ = 0;
+    underflows_ = 0;
+    frames_ = 0;
+    stalled_us_ = 0;
+    shutdown_ = false;
+    active_.store(true, std::memory_order_release);
+    thread_ = std::make_unique<std::thread>(&null_backend::run, this);
+    return true;
+}
+
+void null_backend::stop() {
+    if(!thread_) return;
+
+    shutdown_ = true;
+    thread_->join();
+    thread_.reset(nullptr);
+}
+
+void null_backend::close() {
+    stop();
+    buffer_.clear();
+}
+
+void null_backend::inject_stall(size_t callback, std::chrono::microseconds duration) {
+    std::lock_guard<std::mutex> lock(stall_mtx_);
+    stalls_[callback] = duration;
+}
+
+double null_backend::clock() const {
+    if(format_.sample_rate == 0) return 0.;
+    return double(frames()) / format_.sample_rate + stalled_us_.load(std::memory_order_relaxed) * 1e-6;
+}
+
+std::chrono::microseconds null_backend::take_stall(size_t callback) {
+    std::lock_guard<std::mutex> lock(stall_mtx_);
+    auto it = stalls_.find(callback);
+    if(it == stalls_.end()) return std::chrono::microseconds(0);
+    auto duration = it->second;
+    stalls_.erase(it);
+    return duration;
+}
+
+void null_backend::run() {
+    using clock_t = std::chrono::steady_clock;
+    const auto origin = clock_t::now();
+    // One period of wall time, the deadline a stall has to miss to starve the device
+    const double period = speed_ > 0. ? format_.period() / speed_ : format_.period();
+
+    while(!shutdown_.load(std::memory_order_relaxed)) {
+        const size_t callback = callbacks_.load(std::memory_order_relaxed);
+
+        unsigned status = OS_NONE;
+        auto stall = take_stall(callback);
+        if(stall.count() > 0) {
+            std::this_thread::sleep_for(stall);
+            if(stall.count() * 1e-6 > period) {
+                status |= OS_UNDERFLOW;
+                underflows_.fetch_add(1, std::memory_order_relaxed);
+            }
+            if(speed_ > 0.) stalled_us_.fetch_add(uint64_t(stall.count() * speed_), std::memory_order_relaxed);
+        }
+
+        auto result = target_(buffer_.data(), format_.frames, status);
+        if(result == render_result::RR_ABORT) break;
+        // As with a device, the buffer returned with RR_COMPLETE is still played
+        consume(buffer_.data(), buffer_.size());
+
+        callbacks_.fetch_add(1, std::memory_order_relaxed);
+        frames_.fetch_add(format_.frames, std::memory_order_relaxed);
+        if(result != render_result::RR_CONTINUE) break;
+
+        if(speed_ > 0.) {
+            auto deadline = origin + std::chrono::duration_cast<clock_t::duration>(
+                    std::chrono::duration<double>(clock() / speed_));
+            std::this_thread::sleep_until(deadline);
+        }
+    }
+
+    active_.store(false, std::memory_order_release);
+}
@@ -0,0 +1,72 @@
+#ifndef ZAPAUDIO_NULL_BACKEND_HPP
+#define ZAPAUDIO_NULL_BACKEND_HPP
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "output_backend.hpp"
+
+/*
+ * A headless device.  A thread pulls buffers from the render function and discards them, either as fast as the graph
+ * can produce them or paced against a virtual clock.  The clock advances one period per render call, so rendered
+ * time and the call schedule are deterministic however fast the host is.  Stalls can be injected before any call to
+ * exercise underflow handling in the graph.
+ */
+
+class ZAPAUDIO_EXPORT null_backend : public output_backend {
+public:
+    // speed scales the virtual clock against wall time: 0 runs free, 1 is realtime, 4 is four times realtime
+    explicit null_backend(double speed=0.);
+    virtual ~null_backend();
+
+    virtual bool open(const output_format& format, render_fnc fnc, void* userdata) override;
+    virtual bool start() override;
+    virtual bool is_active() override { return active_.load(std::memory_order_acquire); }
+    virtual void stop() override;
+    virtual void close() override;
+
+    // Blocks the device thread for duration before render call number callback.  A stall longer than one period
+    // means a real device would have run dry, so that call is flagged OS_UNDERFLOW.  When paced, the virtual clock
+    // keeps running through the stall.
+    void inject_stall(size_t callback, std::chrono::microseconds duration);
+
+    double speed() const { return speed_; }
+    const output_format& format() const { return format_; }
+
+    size_t callbacks() const { return callbacks_.load(std::memory_order_relaxed); }
+    size_t underflows() const { return underflows_.load(std::memory_order_relaxed); }
+    uint64_t frames() const { return frames_.load(std::memory_order_relaxed); }
+    // Virtual seconds since start()
+    double clock() const;
+
+protected:
+    // Called on the device thread with each rendered buffer
+    virtual void consume(const void* data, size_t bytes) { }
+
+    void run();
+    std::chrono::microseconds take_stall(size_t callback);
+
+private:
+    double speed_;
+    output_format format_;
+    render_target target_;
+    std::vector<unsigned char> buffer_;
+
+    std::unique_ptr<std::thread> thread_;
+    std::atomic<bool> active_;
+    std::atomic<bool> shutdown_;
+
+    std::atomic<size_t> callbacks_;
+    std::atomic<size_t> underflows_;
+    std::atomic<uint64_t> frames_;
+    std::atomic<uint64_t> stalled_us_;      // Virtual time spent in stalls
+
+    std::mutex stall_mtx_;
+    std::map<size_t, std::chrono::microseconds> stalls_;
+};
+
+#endif //ZAPAUDIO_NULL_BACKEND_HPP
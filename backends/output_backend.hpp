@@ -0,0 +1,74 @@
+#ifndef ZAPAUDIO_OUTPUT_BACKEND_HPP
+#define ZAPAUDIO_OUTPUT_BACKEND_HPP
+
+#include <cstddef>
+#include "streams/audio_stream.hpp"
+
+/*
+ * output_backend is the device side of audio_output.  A backend owns the thread (or driver) that pulls audio and
+ * calls the render function once per buffer, so the same stream graph can play on a sound card, run headless as fast
+ * as possible, or render to a file.
+ */
+
+enum class sample_format {
+    s16,
+    f32
+};
+
+template <typename SampleT> struct sample_format_of;
+template <> struct sample_format_of<short> { static constexpr sample_format value = sample_format::s16; };
+template <> struct sample_format_of<float> { static constexpr sample_format value = sample_format::f32; };
+
+inline size_t bytes_per_sample(sample_format format) { return format == sample_format::s16 ? 2 : 4; }
+
+// Status bits passed to the render function, describing what happened since the previous call
+enum output_status : unsigned {
+    OS_NONE = 0,
+    OS_UNDERFLOW = 1 << 0,      // The device ran out of data (the previous callback was late)
+    OS_OVERFLOW = 1 << 1
+};
+
+enum class render_result {
+    RR_CONTINUE,
+    RR_COMPLETE,
+    RR_ABORT
+};
+
+// Fill frames * channels interleaved samples at output
+using render_fnc = render_result (*)(void* output, size_t frames, unsigned status, void* userdata);
+
+// A render function bound to its userdata
+struct render_target {
+    render_fnc fnc;
+    void* userdata;
+
+    render_target() : fnc(nullptr), userdata(nullptr) { }
+    render_target(render_fnc f, void* u) : fnc(f), userdata(u) { }
+    render_result operator()(void* output, size_t frames, unsigned status) const {
+        return fnc(output, frames, status, userdata);
+    }
+};
+
+struct output_format {
+    size_t channels;
+    size_t sample_rate;
+    size_t frames;          // Frames per render call
+    sample_format format;
+
+    size_t buffer_bytes() const { return frames * channels * bytes_per_sample(format); }
+    double period() const { return double(frames) / sample_rate; }
+};
+
+class ZAPAUDIO_EXPORT output_backend {
+public:
+    virtual ~output_backend() = default;
+
+    virtual bool open(const output_format& format, render_fnc fnc, void* userdata) = 0;
+    virtual bool start() = 0;
+    // False once the render function returned complete or abort, or the backend was stopped
+    virtual bool is_active() = 0;
+    virtual void stop() = 0;
+    virtual void close() = 0;
+};
+
+#endif //ZAPAUDIO_OUTPUT_BACKEND_HPP
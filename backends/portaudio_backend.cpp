@@ -0,0 +1,98 @@
+#include "portaudio_backend.hpp"
+#include <portaudio.h>
+#include "log.hpp"
+
+namespace {
+
+int stream_callback(const void* input, void* output, unsigned long frame_count,
+                    const PaStreamCallbackTimeInfo* time_info, PaStreamCallbackFlags status_flags, void* userdata) {
+    const render_target& target = *static_cast<render_target*>(userdata);
+
+    unsigned status = OS_NONE;
+    if(status_flags & paOutputUnderflow) status |= OS_UNDERFLOW;
+    if(status_flags & paOutputOverflow) status |= OS_OVERFLOW;
+
+    switch(target(output, size_t(frame_count), status)) {
+        case render_result::RR_CONTINUE: return paContinue;
+        case render_result::RR_COMPLETE: return paComplete;
+        default: return paAbort;
+    }
+}
+
+}
+
+portaudio_backend::~portaudio_backend() {
+    close();
+}
+
+bool portaudio_backend::open(const output_format& format, render_fnc fnc, void* userdata) {
+    close();
+
+    if(Pa_Initialize() != paNoError) {
+        SM_LOG("Error initialising portaudio");
+        return false;
+    }
+    initialised_ = true;
+
+    if(Pa_GetDefaultOutputDevice() == paNoDevice) {
+        SM_LOG("Portaudio could not find a default playback device");
+        close();
+        return false;
+    }
+
+    target_ = render_target(fnc, userdata);
+
+    PaStream* pa_stream = nullptr;
+    PaError err = Pa_OpenDefaultStream(
+            &pa_stream,
+            0,
+            int(format.channels),
+            format.format == sample_format::s16 ? paInt16 : paFloat32,
+            double(format.sample_rate),
+            (unsigned long)format.frames,
+            &stream_callback,
+            &target_
+    );
+
+    if(err != paNoError) {
+        SM_LOG("Pa_OpenStream failed:", err, Pa_GetErrorText(err));
+        if(pa_stream) Pa_CloseStream(pa_stream);
+        close();
+        return false;
+    }
+
+    stream_ = pa_stream;
+    return true;
+}
+
+bool portaudio_backend::start() {
+    if(!stream_) return false;
+
+    PaError err = Pa_StartStream(static_cast<PaStream*>(stream_));
+    if(err != paNoError) {
+        SM_LOG("Pa_StartStream failed:", err, Pa_GetErrorText(err));
+        return false;
+    }
+    return true;
+}
+
+bool portaudio_backend::is_active() {
+    return stream_ && Pa_IsStreamActive(static_cast<PaStream*>(stream_)) > 0;
+}
+
+void portaudio_backend::stop() {
+    if(stream_) Pa_StopStream(static_cast<PaStream*>(stream_));
+}
+
+void portaudio_backend::close() {
+    if(stream_) {
+        Pa_CloseStream(static_cast<PaStream*>(stream_));
+        stream_ = nullptr;
+    }
+
+    if(initialised_) {
+        PaError err = Pa_Terminate();
+        if(err != paNoError) SM_LOG("Pa_Terminate error:", err, Pa_GetErrorText(err));
+        initialised_ = false;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef ZAPAUDIO_PORTAUDIO_BACKEND_HPP
+#define ZAPAUDIO_PORTAUDIO_BACKEND_HPP
+
+#include "output_backend.hpp"
+
+/*
+ * Plays through PortAudio's default output device.
+ */
+
+class ZAPAUDIO_EXPORT portaudio_backend : public output_backend {
+public:
+    portaudio_backend() : stream_(nullptr), initialised_(false) { }
+    virtual ~portaudio_backend();
+
+    virtual bool open(const output_format& format, render_fnc fnc, void* userdata) override;
+    virtual bool start() override;
+    virtual bool is_active() override;
+    virtual void stop() override;
+    virtual void close() override;
+
+private:
+    void* stream_;                  // PaStream
+    render_target target_;
+    bool initialised_;
+};
+
+#endif //ZAPAUDIO_PORTAUDIO_BACKEND_HPP
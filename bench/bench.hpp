@@ -0,0 +1,87 @@
+#ifndef ZAPAUDIO_BENCH_HPP
+#define ZAPAUDIO_BENCH_HPP
+
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <algorithm>
+
+/*
+ * Minimal harness for zapaudio_bench.  Each benchmark adds named results to a report that is written out as JSON, so
+ * runs can be stored and compared by scripts.
+ */
+
+struct bench_result {
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+class bench_report {
+public:
+    void add(const std::string& name, double value, const std::string& unit) {
+        results_.push_back({name, value, unit});
+    }
+
+    const std::vector<bench_result>& results() const { return results_; }
+
+    void write_json(std::ostream& out, const std::vector<std::pair<std::string, std::string>>& info) const {
+        out << "{\n";
+        for(const auto& field : info) out << "  \"" << field.first << "\": \"" << field.second << "\",\n";
+        out << "  \"results\": [\n";
+        for(size_t i = 0; i != results_.size(); ++i) {
+            const auto& r = results_[i];
+            out << "    {\"name\": \"" << r.name << "\", \"value\": ";
+            if(std::isfinite(r.value)) out << r.value; else out << "null";      // JSON has no inf or nan
+            out << ", \"unit\": \"" << r.unit << "\"}" << (i + 1 != results_.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+
+private:
+    std::vector<bench_result> results_;
+};
+
+struct bench_context {
+    std::string wav_path;           // Synthetic 16 bit stereo 44.1kHz fixture
+    std::string mp3_path;           // The same signal encoded as MP3
+    double fixture_seconds;
+    size_t repeats;                 // Timed benchmarks report the best of this many runs
+    bench_report report;
+};
+
+class bench_timer {
+public:
+    using clock_t = std::chrono::steady_clock;
+
+    bench_timer() : start_(clock_t::now()) { }
+    void reset() { start_ = clock_t::now(); }
+    double seconds() const { return std::chrono::duration<double>(clock_t::now() - start_).count(); }
+
+private:
+    clock_t::time_point start_;
+};
+
+// Runs fnc repeats times and returns the shortest duration in seconds
+template <typename Fnc>
+double best_of(size_t repeats, Fnc fnc) {
+    double best = 0.;
+    for(size_t i = 0; i != std::max<size_t>(repeats, 1); ++i) {
+        bench_timer timer;
+        fnc();
+        const double t = timer.seconds();
+        if(i == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+// Keeps the optimiser from discarding a computed value
+template <typename T>
+inline void do_not_optimise(const T& value) {
+    volatile T sink = value;
+    (void)sink;
+}
+
+#endif //ZAPAUDIO_BENCH_HPP
@@ -0,0 +1,84 @@
+#include "fixtures.hpp"
+#include <cmath>
+#include <random>
+#include <fstream>
+#include <algorithm>
+#include "tools/wave_writer.hpp"
+#include "streams/mp3_encoder_stream.hpp"
+
+std::vector<short> make_signal(double seconds, size_t sample_rate, size_t channels) {
+    const double pi = 3.14159265358979323846;
+    const double partials[] = { 220., 277.18, 329.63, 440.5, 1318.5, 5274. };
+    const size_t frames = size_t(seconds * sample_rate);
+
+    std::vector<short> samples(frames * channels);
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> noise(-0.01f, 0.01f);
+
+    for(size_t i = 0; i != frames; ++i) {
+        const double t = double(i) / sample_rate;
+        const double env = 0.6 + 0.4 * std::sin(2. * pi * 0.25 * t);
+        for(size_t c = 0; c != channels; ++c) {
+            double v = 0.;
+            for(size_t p = 0; p != sizeof(partials)/sizeof(partials[0]); ++p) {
+                v += std::sin(2. * pi * partials[p] * (1. + 0.001 * c) * t + p) / (p + 2);
+            }
+            v = 0.5 * env * v + noise(rng);
+            samples[i*channels + c] = short(std::max(-1., std::min(1., v)) * 32767.);
+        }
+    }
+    return samples;
+}
+
+bool write_wav_fixture(const std::string& filename, const std::vector<short>& samples, size_t sample_rate,
+                       size_t channels) {
+    wave_writer writer;
+    if(!writer.open(filename, channels, sample_rate, sample_format::s16)) return false;
+    return writer.write(samples.data(), samples.size() * sizeof(short));
+}
+
+bool write_mp3_fixture(const std::string& filename, const std::vector<short>& samples, size_t sample_rate,
+                       size_t channels, int kbps) {
+    mp3_encoder_settings settings;
+    settings.sample_rate = sample_rate;
+    settings.channels = channels;
+    settings.bitrate = kbps;
+    settings.quality = 5;
+
+    mp3_encoder_stream encoder(settings);
+    if(!encoder.open(filename)) return false;
+    encoder.write(samples.data(), samples.size());
+    return encoder.close();
+}
+
+bool write_tagged_mp3_fixture(const std::string& filename, const std::vector<unsigned char>& source, size_t audio_bytes,
+                              size_t art_bytes, size_t number) {
+    auto be32 = [](std::string& out, size_t value) {
+        for(int shift = 24; shift >= 0; shift -= 8) out += char((value >> shift) & 0xFF);
+    };
+    auto frame = [&be32](std::string& out, const char* id, const std::string& payload) {
+        out.append(id, 4);
+        be32(out, payload.size());
+        out.append(2, '\0');
+        out += payload;
+    };
+
+    const std::string n = std::to_string(number);
+    std::string frames;
+    frame(frames, "TIT2", std::string(1, '\0') + "Track " + n);
+    frame(frames, "TPE1", std::string(1, '\0') + "Artist " + std::to_string(number % 16));
+    frame(frames, "TALB", std::string(1, '\0') + "Album " + std::to_string(number % 64));
+    frame(frames, "TRCK", std::string(1, '\0') + std::to_string(number % 12 + 1));
+    frame(frames, "APIC", std::string("\0image/jpeg\0\3\0", 14) + std::string(art_bytes, char(0x55)));
+
+    // The tag size is 28 bits stored 7 bits per byte
+    const size_t size = frames.size();
+    const char header[10] = { 'I', 'D', '3', 3, 0, 0, char((size >> 21) & 0x7F), char((size >> 14) & 0x7F),
+                              char((size >> 7) & 0x7F), char(size & 0x7F) };
+
+    std::ofstream file(filename, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    file.write(header, sizeof(header));
+    file.write(frames.data(), frames.size());
+    file.write(reinterpret_cast<const char*>(source.data()), std::min(audio_bytes, source.size()));
+    return bool(file);
+}
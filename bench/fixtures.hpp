@@ -0,0 +1,25 @@
+#ifndef ZAPAUDIO_BENCH_FIXTURES_HPP
+#define ZAPAUDIO_BENCH_FIXTURES_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/*
+ * Synthetic benchmark inputs.  The signal is a few detuned partials with a slow amplitude envelope and a little
+ * noise, so the encoder has to do representative work rather than coding silence.
+ */
+
+std::vector<short> make_signal(double seconds, size_t sample_rate, size_t channels);
+
+bool write_wav_fixture(const std::string& filename, const std::vector<short>& samples, size_t sample_rate,
+                       size_t channels);
+bool write_mp3_fixture(const std::string& filename, const std::vector<short>& samples, size_t sample_rate,
+                       size_t channels, int kbps);
+
+// A library track: an ID3v2.3 tag with text frames and an art_bytes picture, then up to audio_bytes of the MP3 in
+// source.  number makes the text fields distinct.
+bool write_tagged_mp3_fixture(const std::string& filename, const std::vector<unsigned char>& source, size_t audio_bytes,
+                              size_t art_bytes, size_t number);
+
+#endif //ZAPAUDIO_BENCH_FIXTURES_HPP
@@ -0,0 +1,627 @@
+#include <ctime>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include "bench.hpp"
+#include "fixtures.hpp"
+#include "streams/mp3_stream.hpp"
+#include "decoders/mp3_decoder.hpp"
+#include "streams/mp3_scanner.hpp"
+#include "streams/adapter_stream.hpp"
+#include "streams/buffered_stream.hpp"
+#include "streams/mixer_stream.hpp"
+#include "streams/resampler_stream.hpp"
+#include "streams/pipeline.hpp"
+#include "streams/wave_stream.hpp"
+#include "tools/file_decoder.hpp"
+#include "tools/library_indexer.hpp"
+#include "buffers/ring_buffer.hpp"
+#include "buffers/read_ahead_file.hpp"
+#include "backends/null_backend.hpp"
+#include "audio_output.hpp"
+#include "dsp/sample_convert.hpp"
+#include "log.hpp"
+
+/*
+ * zapaudio_bench [--out results.json] [--seconds fixture_length] [--repeats n] [--filter substring] [--dir path]
+ *
+ * Generates the fixtures in --dir (the working directory by default), runs every benchmark whose name contains the
+ * filter and writes the results as JSON to --out or stdout.
+ */
+
+namespace {
+
+const size_t fixture_rate = 44100;
+const size_t fixture_channels = 2;
+
+// Decode throughput, as multiples of realtime
+
+void bench_mp3_stream(bench_context& ctx) {
+    const mp3_input_mode modes[] = { mp3_input_mode::stream, mp3_input_mode::mapped };
+    const char* names[] = { "mp3_stream.decode.stream", "mp3_stream.decode.mapped" };
+
+    for(size_t m = 0; m != 2; ++m) {
+        size_t samples = 0;
+        std::vector<short> buffer(4096);
+        double t = best_of(ctx.repeats, [&]() {
+            mp3_stream<short> stream(ctx.mp3_path, 1024, nullptr, modes[m]);
+            if(!stream.start()) return;
+            samples = 0;
+            size_t len = 0;
+            while((len = stream.read(buffer.data(), buffer.size())) > 0) samples += len;
+        });
+        const double audio = double(samples) / (fixture_rate * fixture_channels);
+        ctx.report.add(names[m], t > 0. ? audio / t : 0., "x_realtime");
+    }
+
+    // A float consumer, fed by the float decode or by the 16 bit decode through an adapter
+    for(size_t adapted = 0; adapted != 2; ++adapted) {
+        size_t samples = 0;
+        std::vector<float> buffer(4096);
+        double t = best_of(ctx.repeats, [&]() {
+            mp3_stream<float> direct(ctx.mp3_path, 1024, nullptr, mp3_input_mode::mapped);
+            mp3_stream<short> decoded(ctx.mp3_path, 1024, nullptr, mp3_input_mode::mapped);
+            adapter_stream<float, short> adapter(&decoded);
+            audio_stream<float>* stream = &direct;
+            if(adapted) stream = &adapter;
+            if(!(adapted ? decoded.start() : direct.start())) return;
+            samples = 0;
+            size_t len = 0;
+            while((len = stream->read(buffer.data(), buffer.size())) > 0) samples += len;
+            do_not_optimise(buffer[0]);
+        });
+        const double audio = double(samples) / (fixture_rate * fixture_channels);
+        ctx.report.add(adapted ? "mp3_stream.decode.s16_adapted" : "mp3_stream.decode.f32", t > 0. ? audio / t : 0.,
+                       "x_realtime");
+    }
+}
+
+// Time to read the length and format of the fixture, in microseconds.  If the encoder wrote a LAME tag, tags mode stops
+// after the first frames; full always walks every frame header.
+
+void bench_mp3_scan(bench_context& ctx) {
+    const mp3_scan_mode modes[] = { mp3_scan_mode::tags, mp3_scan_mode::full };
+    const char* names[] = { "mp3_scan.tags", "mp3_scan.full" };
+
+    mapped_file map;
+    if(!map.open(ctx.mp3_path)) return;
+    for(size_t m = 0; m != 2; ++m) {
+        mp3_scan_info info;
+        double t = best_of(ctx.repeats, [&]() {
+            scan_mp3(map.data(), map.size(), info, modes[m]);
+            do_not_optimise(info.frames);
+        });
+        ctx.report.add(names[m], t * 1e6, "us");
+    }
+
+    double t = best_of(ctx.repeats, [&]() {
+        mp3_stream<short> stream(ctx.mp3_path, 1024, nullptr, mp3_input_mode::mapped);
+        stream.start();
+        do_not_optimise(stream.get_header().total_frames);
+    });
+    ctx.report.add("mp3_stream.open", t * 1e6, "us");
+}
+
+// Indexing cost per track and the time to open a catalog and find a track in it.  The tracks are short copies of the
+// fixture behind a tag with a 256kB picture, which the indexer should never read.
+
+void bench_library(bench_context& ctx) {
+    const size_t tracks = 512;
+
+    std::ifstream source_file(ctx.mp3_path, std::ios_base::binary | std::ios_base::in);
+    std::vector<unsigned char> source((std::istreambuf_iterator<char>(source_file)), std::istreambuf_iterator<char>());
+
+    std::vector<std::string> paths;
+    for(size_t i = 0; i != tracks; ++i) {
+        paths.push_back(ctx.mp3_path + ".library." + std::to_string(i) + ".mp3");
+        if(!write_tagged_mp3_fixture(paths.back(), source, 256*1024, 256*1024, i)) return;
+    }
+
+    std::vector<library_entry> entries;
+    double t = best_of(ctx.repeats, [&]() {
+        library_indexer indexer;
+        entries = indexer.index(paths);
+    });
+    ctx.report.add("library.index", entries.size() == tracks ? t * 1e6 / tracks : 0., "us_per_track");
+
+    const std::string catalog_path = ctx.mp3_path + ".zcat";
+    t = best_of(ctx.repeats, [&]() { library_catalog::write(catalog_path, entries); });
+    ctx.report.add("library.catalog_write", t * 1e3, "ms");
+
+    t = best_of(ctx.repeats, [&]() {
+        library_catalog catalog;
+        if(!catalog.open(catalog_path)) return;
+        do_not_optimise(catalog.find(paths[tracks/2]));
+    });
+    ctx.report.add("library.catalog_open", t * 1e6, "us");
+
+    for(const auto& path : paths) std::remove(path.c_str());
+    std::remove(catalog_path.c_str());
+}
+
+template <typename SampleT>
+void bench_wave_stream_case(bench_context& ctx, const char* name, wave_input_mode mode) {
+    size_t samples = 0;
+    std::vector<SampleT> buffer(4096);
+    double t = best_of(ctx.repeats, [&]() {
+        wave_stream<SampleT> stream(ctx.wav_path, nullptr, mode);
+        if(!stream.start()) return;
+        samples = 0;
+        size_t len = 0;
+        while((len = stream.read(buffer.data(), buffer.size())) > 0) samples += len;
+        do_not_optimise(buffer[0]);
+    });
+    const double audio = double(samples) / (fixture_rate * fixture_channels);
+    ctx.report.add(name, t > 0. ? audio / t : 0., "x_realtime");
+}
+
+void bench_wave_stream(bench_context& ctx) {
+    bench_wave_stream_case<short>(ctx, "wave_stream.read.s16", wave_input_mode::mapped);
+    bench_wave_stream_case<float>(ctx, "wave_stream.read.f32", wave_input_mode::mapped);
+    bench_wave_stream_case<short>(ctx, "wave_stream.read.s16.stream", wave_input_mode::stream);
+}
+
+// read_ahead_file throughput over the WAVE fixture on each io_engine, reading one file through and reading many files
+// round robin, 4kB at a time, as one engine serving many streams would.  From the page cache, so this is the cost of
+// the engine and the copy rather than of the disk.
+
+void bench_read_ahead_case(bench_context& ctx, const char* name, io_engine* engine, size_t files) {
+    std::vector<unsigned char> buffer(4096);
+    size_t bytes = 0;
+    double t = best_of(ctx.repeats, [&]() {
+        std::vector<std::unique_ptr<read_ahead_file>> readers;
+        for(size_t i = 0; i != files; ++i) {
+            readers.emplace_back(new read_ahead_file(read_ahead_block, read_ahead_depth, engine));
+            if(!readers.back()->open(ctx.wav_path)) return;
+        }
+
+        bytes = 0;
+        for(size_t open = files; open != 0;) {
+            open = 0;
+            for(auto& reader : readers) {
+                const size_t len = reader->read(buffer.data(), buffer.size());
+                bytes += len;
+                if(len != 0) ++open;
+            }
+        }
+        do_not_optimise(buffer[0]);
+    });
+    ctx.report.add(name, t > 0. ? bytes / t * 1e-9 : 0., "GB_per_s");
+}
+
+void bench_read_ahead(bench_context& ctx) {
+    const io_backend backends[] = { io_backend::io_uring, io_backend::thread_pool };
+    const char* names[][2] = {
+        { "read_ahead.io_uring.1_file", "read_ahead.io_uring.64_files" },
+        { "read_ahead.thread_pool.1_file", "read_ahead.thread_pool.64_files" }
+    };
+
+    for(size_t b = 0; b != 2; ++b) {
+        auto engine = make_io_engine(backends[b]);
+        if(!engine) continue;
+        bench_read_ahead_case(ctx, names[b][0], engine.get(), 1);
+        bench_read_ahead_case(ctx, names[b][1], engine.get(), 64);
+    }
+}
+
+void bench_file_decoder(bench_context& ctx) {
+    const size_t threads[] = { 1, 0 };
+    const char* names[] = { "file_decoder.decode.serial", "file_decoder.decode.parallel" };
+
+    for(size_t i = 0; i != 2; ++i) {
+        size_t samples = 0;
+        double t = best_of(ctx.repeats, [&]() {
+            file_decoder decoder;
+            if(!decoder.initialise()) return;
+            auto output = threads[i] == 1 ? decoder.decode_file(ctx.mp3_path) : decoder.decode_file(ctx.mp3_path, 0);
+            samples = output.size();
+            decoder.shutdown();
+        });
+        const double audio = double(samples) / (fixture_rate * fixture_channels);
+        ctx.report.add(names[i], t > 0. ? audio / t : 0., "x_realtime");
+    }
+}
+
+// The hip backend through the mp3_decoder interface
+
+void bench_mp3_decoder(bench_context& ctx) {
+    mapped_file map;
+    if(!map.open(ctx.mp3_path)) return;
+
+    size_t frames = 0;
+    auto decoder = make_mp3_decoder(mp3_decoder_backend::hip);
+    if(!decoder) return;
+    short left[mp3_frame_size], right[mp3_frame_size];
+    const double t = best_of(ctx.repeats, [&]() {
+        decoder->reset();
+        frames = 0;
+        for(size_t pos = 0; pos < map.size(); pos += 4096) {
+            int ret = decoder->decode(map.data() + pos, std::min<size_t>(4096, map.size() - pos), left, right);
+            for(; ret > 0; ret = decoder->decode(map.data(), 0, left, right)) ++frames;
+        }
+        do_not_optimise(left[0]);
+    });
+    const double audio = double(frames * mp3_frame_size) / fixture_rate;
+    ctx.report.add(std::string("mp3_decoder.") + decoder->name(), t > 0. ? audio / t : 0., "x_realtime");
+}
+
+// ring_buffer throughput, single-threaded so both index modes are comparable, plus a threaded SPSC run
+
+template <bool IsAtomic>
+void bench_ring_single(bench_context& ctx, const char* name) {
+    const size_t ops = 1 << 24, batch = 64;
+    ring_buffer<float, int, IsAtomic> ring(1024);
+    float sum = 0.f;
+    double t = best_of(ctx.repeats, [&]() {
+        float v = 0.f;
+        for(size_t i = 0; i < ops; i += batch) {
+            for(size_t j = 0; j != batch; ++j) ring.write(v++);
+            for(size_t j = 0; j != batch; ++j) { float r; ring.read(r); sum += r; }
+        }
+    });
+    do_not_optimise(sum);
+    ctx.report.add(name, 2. * ops / t, "ops_per_s");
+}
+
+template <bool IsAtomic>
+void bench_ring_bulk(bench_context& ctx, const char* name) {
+    const size_t elements = 1 << 26, block = 256;
+    ring_buffer<float, int, IsAtomic> ring(4096);
+    std::vector<float> in(block, 1.f), out(block);
+    double t = best_of(ctx.repeats, [&]() {
+        for(size_t i = 0; i < elements; i += block) {
+            ring.write(in.data(), block);
+            ring.read(out.data(), block);
+        }
+    });
+    do_not_optimise(out[block-1]);
+    ctx.report.add(name, 2. * elements / t, "elements_per_s");
+}
+
+void bench_ring_spsc(bench_context& ctx) {
+    const size_t elements = 1 << 24, block = 256;
+    ring_buffer<float, int, true> ring(16384);
+    double t = best_of(ctx.repeats, [&]() {
+        std::thread producer([&]() {
+            std::vector<float> in(block, 1.f);
+            for(size_t i = 0; i < elements;) {
+                if(ring.write(in.data(), block)) i += block;
+                else std::this_thread::yield();
+            }
+        });
+        std::vector<float> out(block);
+        for(size_t i = 0; i < elements;) {
+            size_t n = ring.read(out.data(), block);
+            if(n == 0) std::this_thread::yield();
+            i += n;
+        }
+        producer.join();
+    });
+    ctx.report.add("ring_buffer.spsc.bulk.atomic", elements / t, "elements_per_s");
+}
+
+void bench_ring_buffer(bench_context& ctx) {
+    bench_ring_single<true>(ctx, "ring_buffer.single.atomic");
+    bench_ring_single<false>(ctx, "ring_buffer.single.non_atomic");
+    bench_ring_bulk<true>(ctx, "ring_buffer.bulk.atomic");
+    bench_ring_bulk<false>(ctx, "ring_buffer.bulk.non_atomic");
+    bench_ring_spsc(ctx);
+}
+
+// adapter_stream conversion, fed by a source that leaves its buffer untouched so only the conversion is timed
+
+template <typename SampleT>
+class null_source : public audio_stream<SampleT> {
+public:
+    using audio_stream<SampleT>::read;
+    using audio_stream<SampleT>::write;
+
+    virtual size_t read(SampleT* buffer, size_t len) override { return len; }
+    virtual size_t write(const SampleT* buffer, size_t len) override { return 0; }
+};
+
+template <typename OutSampleT, typename InSampleT>
+void bench_adapter_case(bench_context& ctx, const char* name) {
+    const size_t block = 4096, total = size_t(1) << 27;
+    null_source<InSampleT> source;
+    adapter_stream<OutSampleT, InSampleT> adapter(&source);
+    std::vector<OutSampleT> out(block);
+    double t = best_of(ctx.repeats, [&]() {
+        for(size_t i = 0; i < total; i += block) adapter.read(out.data(), block);
+    });
+    do_not_optimise(out[0]);
+    // Bytes read plus bytes written
+    ctx.report.add(name, total * (sizeof(InSampleT) + sizeof(OutSampleT)) / t * 1e-9, "GB_per_s");
+}
+
+void bench_adapter(bench_context& ctx) {
+    bench_adapter_case<float, short>(ctx, "adapter_stream.s16_f32");
+    bench_adapter_case<short, float>(ctx, "adapter_stream.f32_s16");
+}
+
+// mixer_stream with many inputs, in multiples of realtime for 44.1kHz stereo output
+
+template <typename SampleT>
+void bench_mixer_case(bench_context& ctx, const char* name, size_t inputs) {
+    const size_t block = 1024, total = size_t(1) << 24;
+    std::vector<null_source<SampleT>> sources(inputs);
+    mixer_stream<SampleT> mixer(inputs, block);
+    for(auto& source : sources) mixer.add_input(&source, 0.5f);
+    std::vector<SampleT> out(block);
+    double t = best_of(ctx.repeats, [&]() {
+        for(size_t i = 0; i < total; i += block) mixer.read(out.data(), block);
+    });
+    do_not_optimise(out[0]);
+    ctx.report.add(name, double(total) / (fixture_rate * fixture_channels) / t, "x_realtime");
+}
+
+void bench_mixer(bench_context& ctx) {
+    bench_mixer_case<float>(ctx, "mixer_stream.f32.32_inputs", 32);
+    bench_mixer_case<short>(ctx, "mixer_stream.s16.32_inputs", 32);
+}
+
+// resampler_stream per stream, 48kHz stereo input to 44.1kHz output.  Reported in multiples of realtime, the inverse
+// is the share of one core a stream costs.
+
+template <typename SampleT>
+void bench_resampler_case(bench_context& ctx, const char* name, resample_quality quality) {
+    const size_t block = 1024, total = size_t(1) << 22;
+    null_source<SampleT> source;
+    resampler_stream<SampleT> resampler(&source, fixture_channels, 48000, fixture_rate, quality, block);
+    std::vector<SampleT> out(block);
+    double t = best_of(ctx.repeats, [&]() {
+        for(size_t i = 0; i < total; i += block) resampler.read(out.data(), block);
+    });
+    do_not_optimise(out[0]);
+    ctx.report.add(name, double(total) / (fixture_rate * fixture_channels) / t, "x_realtime");
+}
+
+void bench_resampler(bench_context& ctx) {
+    bench_resampler_case<float>(ctx, "resampler_stream.f32.low", resample_quality::RQ_LOW);
+    bench_resampler_case<float>(ctx, "resampler_stream.f32.medium", resample_quality::RQ_MEDIUM);
+    bench_resampler_case<float>(ctx, "resampler_stream.f32.high", resample_quality::RQ_HIGH);
+    bench_resampler_case<short>(ctx, "resampler_stream.s16.medium", resample_quality::RQ_MEDIUM);
+}
+
+// The same s16 -> f32 -> gain -> s16 chain as linked audio_streams and as a static_pipeline, at a small and a large
+// read size, in multiples of realtime
+
+void bench_pipeline_case(bench_context& ctx, const char* name, audio_stream<short>& stream, size_t block) {
+    const size_t total = size_t(1) << 25;
+    std::vector<short> out(block);
+    double t = best_of(ctx.repeats, [&]() {
+        for(size_t i = 0; i < total; i += block) stream.read(out.data(), block);
+    });
+    do_not_optimise(out[0]);
+    ctx.report.add(name, double(total) / (fixture_rate * fixture_channels) / t, "x_realtime");
+}
+
+void bench_pipeline(bench_context& ctx) {
+    null_source<short> source;
+    adapter_stream<float, short> to_float(&source);
+    mixer_stream<float> gain(1, 1024);
+    gain.add_input(&to_float, 0.5f);
+    adapter_stream<short, float> to_short(&gain);
+
+    pipeline<null_source<short>, s16_to_f32_stage, gain_stage, f32_to_s16_stage> fused(&source, s16_to_f32_stage(),
+                                                                                      gain_stage(0.5f),
+                                                                                      f32_to_s16_stage());
+
+    bench_pipeline_case(ctx, "pipeline.virtual.64", to_short, 64);
+    bench_pipeline_case(ctx, "pipeline.static.64", fused, 64);
+    bench_pipeline_case(ctx, "pipeline.virtual.1024", to_short, 1024);
+    bench_pipeline_case(ctx, "pipeline.static.1024", fused, 1024);
+}
+
+// Block-to-output latency: the source stamps each block as it produces it and a probe between the buffered_stream
+// and the output measures how long each block took to reach the device, which is dominated by ring occupancy
+
+const size_t latency_block = 256;
+
+class stamped_source : public audio_stream<float> {
+public:
+    using audio_stream<float>::read;
+    using audio_stream<float>::write;
+    using clock_t = std::chrono::steady_clock;
+
+    explicit stamped_source(size_t samples) : produced_(0), stamps_(samples / latency_block + 1) { }
+
+    virtual size_t read(float* buffer, size_t len) override {
+        len = std::min(len, stamps_.size() * latency_block - produced_);
+        const auto now = clock_t::now();
+        for(size_t i = 0; i != len; ++i, ++produced_) {
+            if(produced_ % latency_block == 0) stamps_[produced_ / latency_block] = now;
+            buffer[i] = float(produced_);
+        }
+        return len;
+    }
+    virtual size_t write(const float* buffer, size_t len) override { return 0; }
+
+    clock_t::time_point stamp(size_t block) const { return stamps_[block]; }
+
+private:
+    size_t produced_;
+    std::vector<clock_t::time_point> stamps_;
+};
+
+class latency_probe : public audio_stream<float> {
+public:
+    using audio_stream<float>::read;
+    using audio_stream<float>::write;
+
+    latency_probe(audio_stream<float>* parent, const stamped_source* source) : audio_stream<float>(parent),
+            source_(source) { latencies_.reserve(1 << 16); }
+
+    virtual size_t read(float* buffer, size_t len) override {
+        const size_t ret = parent()->read(buffer, len);
+        const auto now = stamped_source::clock_t::now();
+        for(size_t i = 0; i != ret; ++i) {
+            const size_t index = size_t(buffer[i]);
+            if(index % latency_block == 0 && latencies_.size() < latencies_.capacity())
+                latencies_.push_back(std::chrono::duration<double>(now - source_->stamp(index / latency_block)).count());
+        }
+        return ret;
+    }
+    virtual size_t write(const float* buffer, size_t len) override { return 0; }
+
+    std::vector<double>& latencies() { return latencies_; }
+
+private:
+    const stamped_source* source_;
+    std::vector<double> latencies_;
+};
+
+void bench_buffered_latency(bench_context& ctx) {
+    // Float samples stay exact integers up to 2^24, plenty for a few seconds of stereo
+    const double speed = 4.;
+    const size_t seconds = 4, buffer_size = 16*1024;
+    stamped_source source(seconds * fixture_rate * fixture_channels);
+    buffered_stream<float> buffered(buffer_size, buffer_size/2, 60, &source);
+    latency_probe probe(&buffered, &source);
+
+    null_backend backend(speed);
+    audio_output<float> output(&probe, fixture_channels, fixture_rate, 1024, &backend);
+    buffered.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));     // Let the ring fill as it would before playback
+    output.play();
+    while(!output.is_completed()) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    output.stop();
+
+    auto& l = probe.latencies();
+    if(l.empty()) return;
+    std::sort(l.begin(), l.end());
+    // Wall time is scaled back to device time, the backend consumed speed times faster than realtime
+    auto pct = [&l, speed](double p) { return 1e3 * speed * l[std::min(l.size() - 1, size_t(p * l.size()))]; };
+    ctx.report.add("buffered_stream.latency.p50", pct(.5), "ms");
+    ctx.report.add("buffered_stream.latency.p99", pct(.99), "ms");
+    ctx.report.add("buffered_stream.latency.max", 1e3 * speed * l.back(), "ms");
+    ctx.report.add("buffered_stream.underflows", double(backend.underflows()), "count");
+}
+
+// Cost of one SM_LOG call on the producer side.  Bursts stay below the ring's capacity so nothing is dropped, the
+// formatter drains between bursts and its output is discarded.
+
+void bench_log_case(bench_context& ctx, const char* name, size_t threads) {
+    const size_t bursts = 64, burst = 1024/threads;
+    double total = 0.;
+    for(size_t b = 0; b != bursts; ++b) {
+        std::atomic<size_t> ready(0);
+        std::vector<std::thread> producers;
+        std::vector<double> times(threads);
+        for(size_t t = 0; t != threads; ++t) {
+            producers.emplace_back([&, t]() {
+                ready.fetch_add(1);
+                while(ready.load() != threads) std::this_thread::yield();
+                bench_timer timer;
+                for(size_t i = 0; i != burst; ++i) SM_LOG("Refill", i, 0.5, "samples in", 12.5f, "ms");
+                times[t] = timer.seconds();
+            });
+        }
+        for(auto& producer : producers) producer.join();
+        total += *std::max_element(times.begin(), times.end());
+        log_flush();
+    }
+    ctx.report.add(name, 1e9 * total / (bursts * burst), "ns_per_call");
+}
+
+void bench_log(bench_context& ctx) {
+    auto& ring = log_ring::instance();
+    log_flush();
+    ring.set_output(nullptr);
+    const size_t dropped = ring.dropped();
+    bench_log_case(ctx, "log.record.single", 1);
+    bench_log_case(ctx, "log.record.contended4", 4);
+    ctx.report.add("log.dropped", double(ring.dropped() - dropped), "count");
+    ring.set_output(&std::cerr);
+}
+
+struct bench_entry {
+    const char* name;
+    void (*fnc)(bench_context&);
+};
+
+const bench_entry benchmarks[] = {
+    { "mp3_stream", bench_mp3_stream },
+    { "mp3_scan", bench_mp3_scan },
+    { "file_decoder", bench_file_decoder },
+    { "mp3_decoder", bench_mp3_decoder },
+    { "wave_stream", bench_wave_stream },
+    { "read_ahead", bench_read_ahead },
+    { "ring_buffer", bench_ring_buffer },
+    { "adapter_stream", bench_adapter },
+    { "mixer_stream", bench_mixer },
+    { "resampler_stream", bench_resampler },
+    { "pipeline", bench_pipeline },
+    { "buffered_stream", bench_buffered_latency },
+    { "log", bench_log },
+    { "library", bench_library }
+};
+
+std::string timestamp() {
+    char buf[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return buf;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string out_path, filter, dir = ".";
+    bench_context ctx;
+    ctx.fixture_seconds = 30.;
+    ctx.repeats = 3;
+
+    for(int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "--out" && has_value) out_path = argv[++i];
+        else if(arg == "--seconds" && has_value) ctx.fixture_seconds = std::atof(argv[++i]);
+        else if(arg == "--repeats" && has_value) ctx.repeats = size_t(std::atoi(argv[++i]));
+        else if(arg == "--filter" && has_value) filter = argv[++i];
+        else if(arg == "--dir" && has_value) dir = argv[++i];
+        else {
+            std::cerr << "usage: " << argv[0] << " [--out file] [--seconds n] [--repeats n] [--filter name] [--dir path]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    ctx.wav_path = dir + "/zapaudio_bench_fixture.wav";
+    ctx.mp3_path = dir + "/zapaudio_bench_fixture.mp3";
+
+    auto signal = make_signal(ctx.fixture_seconds, fixture_rate, fixture_channels);
+    if(!write_wav_fixture(ctx.wav_path, signal, fixture_rate, fixture_channels) ||
+       !write_mp3_fixture(ctx.mp3_path, signal, fixture_rate, fixture_channels, 192)) {
+        std::cerr << "Failed to write the benchmark fixtures to " << dir << std::endl;
+        return 1;
+    }
+
+    for(const auto& entry : benchmarks) {
+        if(!filter.empty() && std::string(entry.name).find(filter) == std::string::npos) continue;
+        std::cerr << "Running " << entry.name << std::endl;
+        entry.fnc(ctx);
+    }
+
+    std::vector<std::pair<std::string, std::string>> info = {
+        { "timestamp", timestamp() },
+        { "convert_kernels", get_convert_kernels().name },
+        { "io_engine", default_io_engine().name() },
+        { "hardware_threads", std::to_string(std::thread::hardware_concurrency()) },
+        { "fixture_seconds", std::to_string(ctx.fixture_seconds) }
+    };
+
+    if(out_path.empty()) {
+        ctx.report.write_json(std::cout, info);
+    } else {
+        std::ofstream file(out_path);
+        ctx.report.write_json(file, info);
+    }
+
+    std::remove(ctx.wav_path.c_str());
+    std::remove(ctx.mp3_path.c_str());
+    return 0;
+}
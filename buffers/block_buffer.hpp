@@ -14,10 +14,11 @@ public:
     ~block_buffer() = default;
 
     size_t size() const { return buffer_.size(); }
+    void reserve(size_t len) { buffer_.reserve(len); }
 
     const T* read_ptr() const { return &(*(buffer_.begin() + cursor_)); }
 
-    void write(T* block, size_t len) {
+    void write(const T* block, size_t len) {
         std::copy(block, block+len, std::back_inserter(buffer_));
     }
 
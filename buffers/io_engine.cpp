@@ -0,0 +1,378 @@
+#include "io_engine.hpp"
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include "log.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif //_WIN32
+#ifdef ZAPAUDIO_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif //ZAPAUDIO_IO_URING
+
+namespace {
+
+// Reads until len bytes, the end of the file or an error
+ptrdiff_t read_at(intptr_t handle, void* buffer, size_t len, uint64_t offset) {
+#ifdef _WIN32
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = DWORD(offset);
+    overlapped.OffsetHigh = DWORD(offset >> 32);
+    DWORD count = 0;
+    if(!ReadFile(HANDLE(handle), buffer, DWORD(len), &count, &overlapped)) {
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -EIO;
+    }
+    return ptrdiff_t(count);
+#else
+    size_t total = 0;
+    while(total < len) {
+        const ssize_t count = ::pread(int(handle), static_cast<char*>(buffer) + total, len - total,
+                                      off_t(offset + total));
+        if(count < 0 && errno == EINTR) continue;
+        if(count < 0) return total != 0 ? ptrdiff_t(total) : -errno;
+        if(count == 0) break;
+        total += size_t(count);
+    }
+    return ptrdiff_t(total);
+#endif //_WIN32
+}
+
+class pool_engine : public io_engine {
+public:
+    explicit pool_engine(size_t threads) : stop_(false) {
+        for(size_t i = 0; i != threads; ++i) workers_.emplace_back(&pool_engine::run, this);
+    }
+
+    virtual ~pool_engine() {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for(auto& worker : workers_) worker.join();
+    }
+
+    virtual bool submit(io_request* request) override {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if(stop_) return false;
+            queue_.push_back(request);
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    virtual io_backend get_backend() const override { return io_backend::thread_pool; }
+    virtual const char* name() const override { return "thread_pool"; }
+
+private:
+    // Drains the queue before stopping so every submitted request completes
+    void run() {
+        for(;;) {
+            io_request* request = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                if(queue_.empty()) return;
+                request = queue_.front();
+                queue_.pop_front();
+            }
+            request->complete(request, read_at(request->handle, request->buffer, request->len, request->offset));
+        }
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<io_request*> queue_;
+    bool stop_;
+    std::vector<std::thread> workers_;
+};
+
+#ifdef ZAPAUDIO_IO_URING
+
+/*
+ * io_uring through the raw system calls.  Submitters share the submission ring under a mutex and enter the kernel to
+ * submit, a single thread waits on the completion ring and runs the completions.  A NOP with no request stops it.
+ * Requests submitted by a completion are held on that thread and pushed once its batch is reaped: with the completion
+ * ring overflowed the kernel refuses submissions until it is drained, and that thread is the only one draining it.
+ */
+class uring_engine : public io_engine {
+public:
+    uring_engine() : ring_fd_(-1), sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED), sqes_(nullptr), sq_size_(0), cq_size_(0),
+        sqes_size_(0), sq_entries_(0) { }
+
+    virtual ~uring_engine() {
+        if(thread_.joinable()) {
+            while(push(IORING_OP_NOP, nullptr, true) != pushed) std::this_thread::yield();
+            thread_.join();
+        }
+        if(sqes_) munmap(sqes_, sqes_size_);
+        if(cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_size_);
+        if(sq_ptr_ != MAP_FAILED) munmap(sq_ptr_, sq_size_);
+        if(ring_fd_ >= 0) ::close(ring_fd_);
+    }
+
+    bool initialise(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd_ = int(syscall(__NR_io_uring_setup, entries, &params));
+        if(ring_fd_ < 0) return false;
+
+        // Without NODROP completions are lost when the ring overflows
+        if(!(params.features & IORING_FEAT_NODROP) || !supports(IORING_OP_READ)) return false;
+
+        sq_size_ = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+        const bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if(single_map) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+
+        sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                       IORING_OFF_SQ_RING);
+        if(sq_ptr_ == MAP_FAILED) return false;
+        cq_ptr_ = single_map ? sq_ptr_ : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                              ring_fd_, IORING_OFF_CQ_RING);
+        if(cq_ptr_ == MAP_FAILED) return false;
+        sqes_size_ = params.sq_entries*sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                          IORING_OFF_SQES);
+        if(sqes == MAP_FAILED) return false;
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        auto sq = static_cast<char*>(sq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+
+        auto cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        thread_ = std::thread(&uring_engine::run, this);
+        return true;
+    }
+
+    virtual bool submit(io_request* request) override {
+        if(std::this_thread::get_id() == thread_.get_id()) {
+            deferred_.push_back(request);
+            return true;
+        }
+        return push(IORING_OP_READ, request, true) == pushed;
+    }
+
+    virtual io_backend get_backend() const override { return io_backend::io_uring; }
+    virtual const char* name() const override { return "io_uring"; }
+
+private:
+    enum push_result {
+        pushed,
+        busy,               // The rings are full, retry once completions are reaped
+        failed
+    };
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return int(syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    bool supports(unsigned opcode) {
+        const size_t ops = 256;
+        std::vector<char> mem(sizeof(io_uring_probe) + ops*sizeof(io_uring_probe_op), 0);
+        auto probe = reinterpret_cast<io_uring_probe*>(mem.data());
+        if(syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe, ops) < 0) return false;
+        return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    // With wait, EBUSY and EAGAIN are retried until the completion thread drains the completion ring.  Without, the
+    // submission lock is not waited for either, its holder may be retrying on the completion thread.
+    push_result push(unsigned char opcode, io_request* request, bool wait) {
+        std::unique_lock<std::mutex> lock(submit_mtx_, std::defer_lock);
+        if(wait) lock.lock();
+        else if(!lock.try_lock()) return busy;
+        const unsigned tail = *sq_tail_;
+        if(tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) return busy;
+
+        const unsigned index = tail & sq_mask_;
+        io_uring_sqe& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = request ? int(request->handle) : -1;
+        if(request) {
+            sqe.addr = uint64_t(uintptr_t(request->buffer));
+            sqe.len = unsigned(request->len);
+            sqe.off = request->offset;
+        }
+        sqe.user_data = uint64_t(uintptr_t(request));
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+        for(;;) {
+            if(enter(1, 0, 0) >= 0) return pushed;
+            if(errno != EINTR && errno != EBUSY && errno != EAGAIN) break;
+            if(errno != EINTR && !wait) break;
+            std::this_thread::yield();
+        }
+
+        const bool retry = errno == EBUSY || errno == EAGAIN;
+        if(!retry) SM_WARN("io_uring_enter failed:", std::strerror(errno));
+        if(__atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == tail) __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+        return retry ? busy : failed;
+    }
+
+    // Pushes the requests submitted by completions, stopping at the first that has to wait for more to be reaped
+    void push_deferred() {
+        while(!deferred_.empty()) {
+            io_request* request = deferred_.front();
+            const push_result result = push(IORING_OP_READ, request, false);
+            if(result == busy) {
+                std::this_thread::yield();
+                return;
+            }
+            deferred_.pop_front();
+            if(result == failed) request->complete(request, -EIO);
+        }
+    }
+
+    // Does not block for a completion while requests are deferred, so they are retried as soon as possible
+    void run() {
+        for(;;) {
+            if(enter(0, deferred_.empty() ? 1 : 0, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EBUSY) {
+                SM_WARN("io_uring_enter failed:", std::strerror(errno));
+            }
+
+            unsigned head = *cq_head_;
+            const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            while(head != tail) {
+                const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+                auto request = reinterpret_cast<io_request*>(uintptr_t(cqe.user_data));
+                const ptrdiff_t result = cqe.res;
+                // Released before the completion runs, which may submit again
+                __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+                if(!request) {
+                    cancel_deferred();
+                    return;
+                }
+                request->complete(request, result);
+            }
+            push_deferred();
+        }
+    }
+
+    void cancel_deferred() {
+        while(!deferred_.empty()) {
+            io_request* request = deferred_.front();
+            deferred_.pop_front();
+            request->complete(request, -ECANCELED);
+        }
+    }
+
+    int ring_fd_;
+    void* sq_ptr_;
+    void* cq_ptr_;
+    io_uring_sqe* sqes_;
+    size_t sq_size_;
+    size_t cq_size_;
+    size_t sqes_size_;
+    unsigned sq_entries_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+    std::mutex submit_mtx_;
+    std::deque<io_request*> deferred_;      // Only touched on the completion thread
+    std::thread thread_;
+};
+
+#endif //ZAPAUDIO_IO_URING
+
+}
+
+// Enough for a few hundred files with a handful of reads in flight each; the completion ring is twice the size
+constexpr unsigned io_uring_entries = 1024;
+constexpr size_t io_pool_threads = 4;
+
+std::unique_ptr<io_engine> make_io_engine(io_backend backend, size_t threads) {
+    if(backend == io_backend::thread_pool) {
+        return std::unique_ptr<io_engine>(new pool_engine(threads != 0 ? threads : io_pool_threads));
+    }
+
+#ifdef ZAPAUDIO_IO_URING
+    std::unique_ptr<uring_engine> engine(new uring_engine());
+    if(engine->initialise(io_uring_entries)) return std::unique_ptr<io_engine>(std::move(engine));
+#endif //ZAPAUDIO_IO_URING
+    return nullptr;
+}
+
+io_engine& default_io_engine() {
+    static std::unique_ptr<io_engine> engine = []() {
+        auto ptr = make_io_engine(io_backend::io_uring);
+        return ptr ? std::move(ptr) : make_io_engine(io_backend::thread_pool);
+    }();
+    return *engine;
+}
+
+#ifdef _WIN32
+
+intptr_t io_open_file(const std::string& filename, size_t& size) {
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        SM_LOG("Could not open file:", filename);
+        return -1;
+    }
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return -1;
+    }
+    size = size_t(file_size.QuadPart);
+    return intptr_t(file);
+}
+
+void io_close_file(intptr_t handle) {
+    if(handle != -1) CloseHandle(HANDLE(handle));
+}
+
+#else
+
+intptr_t io_open_file(const std::string& filename, size_t& size) {
+    const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        SM_LOG("Could not open file:", filename);
+        return -1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    size = size_t(st.st_size);
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return fd;
+}
+
+void io_close_file(intptr_t handle) {
+    if(handle >= 0) ::close(int(handle));
+}
+
+#endif //_WIN32
@@ -0,0 +1,58 @@
+#ifndef ZAPAUDIO_IO_ENGINE_HPP
+#define ZAPAUDIO_IO_ENGINE_HPP
+
+#include <memory>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "streams/audio_stream.hpp"
+
+/*
+ * Asynchronous positional reads, serviced off the caller's thread.  The io_uring backend keeps every read of every
+ * file in one kernel ring drained by a single completion thread, so one thread serves any number of open files.  The
+ * thread pool backend runs blocking preads on a few worker threads and is used where io_uring is not available.
+ *
+ * Files are opened with io_open_file() and identified by a native handle: a file descriptor, or a HANDLE on Windows.
+ */
+
+struct io_request;
+
+// Called once per request on an I/O thread with the bytes read, 0 at end of file, or a negative errno
+using io_complete_fnc = void (*)(io_request* request, ptrdiff_t result);
+
+struct io_request {
+    intptr_t handle;
+    uint64_t offset;
+    void* buffer;
+    size_t len;
+    io_complete_fnc complete;
+    void* context;                  // For the completion, the engine does not touch it
+};
+
+enum class io_backend {
+    io_uring,
+    thread_pool
+};
+
+class ZAPAUDIO_EXPORT io_engine {
+public:
+    virtual ~io_engine() = default;
+
+    // Queues the read.  The request must stay valid until its completion has run.  Returns false if it could not be
+    // queued, in which case complete is not called.
+    virtual bool submit(io_request* request) = 0;
+    virtual io_backend get_backend() const = 0;
+    virtual const char* name() const = 0;
+};
+
+// Returns nullptr if the backend is not available on this system.  threads sizes the thread pool, 0 picks a default.
+ZAPAUDIO_EXPORT std::unique_ptr<io_engine> make_io_engine(io_backend backend, size_t threads=0);
+
+// The process-wide engine shared by the file readers: io_uring where the kernel supports it, otherwise the pool
+ZAPAUDIO_EXPORT io_engine& default_io_engine();
+
+// Opens the file read-only, returning -1 on failure
+ZAPAUDIO_EXPORT intptr_t io_open_file(const std::string& filename, size_t& size);
+ZAPAUDIO_EXPORT void io_close_file(intptr_t handle);
+
+#endif //ZAPAUDIO_IO_ENGINE_HPP
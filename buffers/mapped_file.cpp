@@ -0,0 +1,146 @@
+#include "mapped_file.hpp"
+#include <algorithm>
+#include "log.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif //_WIN32
+
+mapped_file::mapped_file() : data_(nullptr), size_(0)
+#ifdef _WIN32
+    , file_handle_(INVALID_HANDLE_VALUE), map_handle_(nullptr)
+#endif
+{
+}
+
+mapped_file::~mapped_file() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool mapped_file::open(const std::string& filename) {
+    close();
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        SM_LOG("Could not open file for mapping:", filename);
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!mapping) {
+        CloseHandle(file);
+        SM_LOG("CreateFileMapping failed:", filename);
+        return false;
+    }
+
+    void* ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!ptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        SM_LOG("MapViewOfFile failed:", filename);
+        return false;
+    }
+
+    file_handle_ = file;
+    map_handle_ = mapping;
+    data_ = static_cast<const unsigned char*>(ptr);
+    size_ = size_t(size.QuadPart);
+    return true;
+}
+
+void mapped_file::close() {
+    if(data_) UnmapViewOfFile(data_);
+    if(map_handle_) CloseHandle(map_handle_);
+    if(file_handle_ != INVALID_HANDLE_VALUE) CloseHandle(file_handle_);
+    data_ = nullptr;
+    size_ = 0;
+    map_handle_ = nullptr;
+    file_handle_ = INVALID_HANDLE_VALUE;
+}
+
+// FILE_FLAG_SEQUENTIAL_SCAN already drives read-ahead on Windows
+void mapped_file::advise_sequential() { }
+void mapped_file::prefetch(size_t offset, size_t len) { }
+void mapped_file::release(size_t offset, size_t len) { }
+
+#else
+
+bool mapped_file::open(const std::string& filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd == -1) {
+        SM_LOG("Could not open file for mapping:", filename);
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);    // The mapping holds its own reference to the file
+    if(ptr == MAP_FAILED) {
+        SM_LOG("mmap failed:", filename);
+        return false;
+    }
+
+    data_ = static_cast<const unsigned char*>(ptr);
+    size_ = size_t(st.st_size);
+    return true;
+}
+
+void mapped_file::close() {
+    if(data_) munmap(const_cast<unsigned char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+namespace {
+
+// madvise requires a page aligned start address
+bool page_range(size_t size, size_t& offset, size_t& len) {
+    static const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    if(offset >= size) return false;
+    size_t end = std::min(offset + len, size);
+    offset -= offset % page;
+    len = end - offset;
+    return len > 0;
+}
+
+}
+
+void mapped_file::advise_sequential() {
+    if(data_) madvise(const_cast<unsigned char*>(data_), size_, MADV_SEQUENTIAL);
+}
+
+void mapped_file::prefetch(size_t offset, size_t len) {
+    if(data_ && page_range(size_, offset, len)) madvise(const_cast<unsigned char*>(data_) + offset, len, MADV_WILLNEED);
+}
+
+void mapped_file::release(size_t offset, size_t len) {
+    static const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    // Only whole pages inside the range may be dropped
+    const size_t end = std::min(offset + len, size_);
+    offset = (offset + page - 1) / page * page;
+    if(!data_ || end <= offset) return;
+    len = (end - offset) / page * page;
+    if(len > 0) madvise(const_cast<unsigned char*>(data_) + offset, len, MADV_DONTNEED);
+}
+
+#endif //_WIN32
@@ -0,0 +1,44 @@
+#ifndef ZAPAUDIO_MAPPED_FILE_HPP
+#define ZAPAUDIO_MAPPED_FILE_HPP
+
+#include <string>
+#include <cstddef>
+#include "streams/audio_stream.hpp"
+
+/*
+ * A read-only memory mapping of a whole file.  Readers consume the mapping through pointers instead of copying the
+ * file through stream buffers, and can give the kernel access-pattern hints for read-ahead.
+ */
+
+class ZAPAUDIO_EXPORT mapped_file {
+public:
+    mapped_file();
+    ~mapped_file();
+
+    mapped_file(const mapped_file& rhs) = delete;
+    mapped_file& operator=(const mapped_file& rhs) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+
+    bool is_open() const { return data_ != nullptr; }
+    const unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // Hint that the mapping will be read front to back
+    void advise_sequential();
+    // Start reading the range into the page cache ahead of use
+    void prefetch(size_t offset, size_t len);
+    // Drop the range from this process' working set; it is faulted back in from the page cache if touched again
+    void release(size_t offset, size_t len);
+
+private:
+    const unsigned char* data_;
+    size_t size_;
+#ifdef _WIN32
+    void* file_handle_;
+    void* map_handle_;
+#endif
+};
+
+#endif //ZAPAUDIO_MAPPED_FILE_HPP
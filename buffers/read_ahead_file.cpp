@@ -0,0 +1,192 @@
+#include "read_ahead_file.hpp"
+#include <algorithm>
+#include <cstring>
+#include "log.hpp"
+
+namespace {
+
+// Reads are aligned to this in the file and in memory, so they suit direct I/O as well as the page cache
+constexpr size_t read_ahead_alignment = 4096;
+
+size_t align_up(size_t value) { return (value + read_ahead_alignment - 1) & ~(read_ahead_alignment - 1); }
+size_t align_down(size_t value) { return value & ~(read_ahead_alignment - 1); }
+
+}
+
+read_ahead_file::read_ahead_file(size_t block_size, size_t depth, io_engine* engine) : engine_(engine),
+        block_size_(align_up(std::max(block_size, size_t(1)))), depth_(std::max(depth, size_t(1))), handle_(-1),
+        size_(0), position_(0), head_(0), next_offset_(0), waits_(0) {
+}
+
+read_ahead_file::~read_ahead_file() {
+    close();
+}
+
+bool read_ahead_file::open(const std::string& filename, size_t offset) {
+    close();
+    if(!engine_) engine_ = &default_io_engine();
+    if(!blocks_) allocate();
+
+    size_t size = 0;
+    const intptr_t handle = io_open_file(filename, size);
+    if(handle == -1) return false;
+
+    handle_ = handle;
+    filename_ = filename;
+    size_ = size;
+    waits_ = 0;
+    restart(offset);
+    return true;
+}
+
+void read_ahead_file::close() {
+    if(handle_ == -1) return;
+    wait_idle();
+    io_close_file(handle_);
+    handle_ = -1;
+    size_ = position_ = next_offset_ = head_ = 0;
+}
+
+bool read_ahead_file::seek(size_t offset) {
+    if(handle_ == -1) return false;
+    if(offset == position_) return true;
+
+    // Forward inside the blocks in flight: recycle the blocks passed over and keep the rest
+    if(offset > position_ && offset < std::min(next_offset_, size_)) {
+        while(offset >= blocks_[head_].offset + blocks_[head_].length) {
+            block& blk = blocks_[head_];
+            wait_for(blk);
+            issue(blk);
+            head_ = (head_ + 1) % depth_;
+        }
+        position_ = offset;
+        return true;
+    }
+
+    wait_idle();
+    restart(offset);
+    return true;
+}
+
+size_t read_ahead_file::read(void* buffer, size_t len, bool wait) {
+    auto dst = static_cast<unsigned char*>(buffer);
+    size_t count = 0;
+
+    while(count < len && position_ < size_) {
+        block& blk = blocks_[head_];
+        if(blk.state.load(std::memory_order_acquire) == pending) {
+            if(!wait) break;
+            ++waits_;
+        }
+
+        if(!wait_for(blk) || position_ >= blk.offset + blk.filled) {
+            // The file shrank or could not be read, end it here
+            SM_WARN("Read failed, ending file at", position_, filename_);
+            size_ = position_;
+            break;
+        }
+
+        const size_t n = std::min(len - count, blk.offset + blk.filled - position_);
+        std::memcpy(dst + count, blk.data + (position_ - blk.offset), n);
+        count += n;
+        position_ += n;
+
+        if(position_ == blk.offset + blk.length) {
+            issue(blk);
+            head_ = (head_ + 1) % depth_;
+        }
+    }
+
+    return count;
+}
+
+// The buffers are allocated on first open, a stream that never opens its file costs nothing
+void read_ahead_file::allocate() {
+    memory_.reset(new unsigned char[block_size_*depth_ + read_ahead_alignment]);
+    blocks_.reset(new block[depth_]);
+
+    const uintptr_t base = reinterpret_cast<uintptr_t>(memory_.get());
+    auto data = reinterpret_cast<unsigned char*>(uintptr_t(align_up(size_t(base))));
+    for(size_t i = 0; i != depth_; ++i) {
+        block& blk = blocks_[i];
+        blk.owner = this;
+        blk.data = data + i*block_size_;
+        blk.offset = blk.length = blk.filled = 0;
+        blk.state.store(idle, std::memory_order_relaxed);
+    }
+}
+
+// Issues blk for the next unread block of the file, or leaves it idle past the end
+void read_ahead_file::issue(block& blk) {
+    if(next_offset_ >= size_) {
+        blk.state.store(idle, std::memory_order_relaxed);
+        return;
+    }
+
+    blk.offset = next_offset_;
+    blk.length = std::min(block_size_, size_ - next_offset_);
+    blk.filled = 0;
+    next_offset_ += blk.length;
+
+    blk.request.handle = handle_;
+    blk.request.offset = blk.offset;
+    blk.request.buffer = blk.data;
+    blk.request.len = blk.length;
+    blk.request.complete = &read_ahead_file::on_complete;
+    blk.request.context = &blk;
+
+    blk.state.store(pending, std::memory_order_relaxed);
+    if(!engine_->submit(&blk.request)) blk.state.store(failed, std::memory_order_relaxed);
+}
+
+// Runs on an I/O thread.  Short reads are resubmitted for the rest of the block.
+void read_ahead_file::on_complete(io_request* request, ptrdiff_t result) {
+    block& blk = *static_cast<block*>(request->context);
+    read_ahead_file* owner = blk.owner;
+
+    int state = ready;
+    if(result < 0) {
+        state = failed;
+    } else if(result > 0) {
+        blk.filled += size_t(result);
+        if(blk.filled < blk.length) {
+            request->offset = blk.offset + blk.filled;
+            request->buffer = blk.data + blk.filled;
+            request->len = blk.length - blk.filled;
+            if(owner->engine_->submit(request)) return;
+            state = failed;
+        }
+    }
+
+    // Notified under the lock so the owner cannot be destroyed in between
+    std::lock_guard<std::mutex> lock(owner->mtx_);
+    blk.state.store(state, std::memory_order_release);
+    owner->cv_.notify_all();
+}
+
+// Waits for blk to land, returns false if it failed
+bool read_ahead_file::wait_for(block& blk) {
+    if(blk.state.load(std::memory_order_acquire) == pending) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [&blk]() { return blk.state.load(std::memory_order_acquire) != pending; });
+    }
+    return blk.state.load(std::memory_order_acquire) == ready;
+}
+
+void read_ahead_file::wait_idle() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_.wait(lock, [this]() {
+        for(size_t i = 0; i != depth_; ++i) {
+            if(blocks_[i].state.load(std::memory_order_acquire) == pending) return false;
+        }
+        return true;
+    });
+}
+
+// Requires no reads in flight
+void read_ahead_file::restart(size_t offset) {
+    position_ = std::min(offset, size_);
+    next_offset_ = align_down(position_);
+    head_ = 0;
+    for(size_t i = 0; i != depth_; ++i) issue(blocks_[i]);
+}
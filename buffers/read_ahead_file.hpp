@@ -0,0 +1,90 @@
+#ifndef ZAPAUDIO_READ_AHEAD_FILE_HPP
+#define ZAPAUDIO_READ_AHEAD_FILE_HPP
+
+/*
+ * Sequential file input that keeps a fixed number of large reads in flight on an io_engine.  The file is read in
+ * page-aligned blocks into page-aligned buffers, each block being resubmitted for the next unread part of the file as
+ * soon as the reader has consumed it, so the disk works depth blocks ahead of the read position.
+ *
+ * read() copies out of completed blocks and only blocks when the next block is still in flight, which with enough
+ * depth happens after start or a seek and on a disk that cannot keep up.  A forward seek inside the blocks in flight
+ * keeps them, any other seek waits for the reads in flight to land and restarts the read-ahead.
+ *
+ * One reader thread per file.  A read error is logged and ends the file at the last byte read.
+ */
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <condition_variable>
+#include "io_engine.hpp"
+
+constexpr size_t read_ahead_block = 256*1024;
+constexpr size_t read_ahead_depth = 4;
+
+class ZAPAUDIO_EXPORT read_ahead_file {
+public:
+    // block_size is rounded up to a whole number of pages.  engine defaults to default_io_engine().
+    explicit read_ahead_file(size_t block_size=read_ahead_block, size_t depth=read_ahead_depth,
+                             io_engine* engine=nullptr);
+    ~read_ahead_file();
+
+    read_ahead_file(const read_ahead_file& rhs) = delete;
+    read_ahead_file& operator=(const read_ahead_file& rhs) = delete;
+
+    // Opens the file and starts reading ahead from offset
+    bool open(const std::string& filename, size_t offset=0);
+    void close();
+
+    bool is_open() const { return handle_ != -1; }
+    size_t size() const { return size_; }
+    size_t tell() const { return position_; }
+    bool eof() const { return position_ >= size_; }
+    // Number of reads that had to wait for their block
+    size_t get_waits() const { return waits_; }
+
+    bool seek(size_t offset);
+
+    // Copies up to len bytes from the read position.  With wait false only completed blocks are read, so fewer than
+    // len bytes may be returned before the end of the file.
+    size_t read(void* buffer, size_t len, bool wait=true);
+
+private:
+    enum block_state : int { idle, pending, ready, failed };
+
+    struct block {
+        io_request request;
+        read_ahead_file* owner;
+        unsigned char* data;
+        size_t offset;              // In the file
+        size_t length;              // Bytes requested
+        size_t filled;              // Bytes read so far
+        std::atomic<int> state;
+    };
+
+    static void on_complete(io_request* request, ptrdiff_t result);
+
+    void allocate();
+    void issue(block& blk);
+    bool wait_for(block& blk);
+    void wait_idle();
+    void restart(size_t offset);
+
+    io_engine* engine_;
+    size_t block_size_;
+    size_t depth_;
+    std::unique_ptr<unsigned char[]> memory_;
+    std::unique_ptr<block[]> blocks_;
+    intptr_t handle_;
+    std::string filename_;
+    size_t size_;
+    size_t position_;
+    size_t head_;                   // The block holding the read position
+    size_t next_offset_;            // Of the next block to issue
+    size_t waits_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+#endif //ZAPAUDIO_READ_AHEAD_FILE_HPP
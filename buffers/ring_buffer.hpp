@@ -9,6 +9,17 @@
 #include <vector>
 #include <limits>
 #include <cassert>
+#include <algorithm>
+
+/*
+ * A single-producer, single-consumer ring buffer.  In the atomic variant the producer publishes the write cursor with
+ * release semantics and the consumer acquires it (and vice versa for the read cursor), so the elements written before
+ * a publish are visible to the other side.  Each side keeps a private copy of the other side's cursor and only reloads
+ * it when the copy says there is not enough data or space, which keeps the shared cache lines quiet.
+ *
+ * The prepare_write/commit_write and peek_read/commit_read pairs expose the free or readable region in place as up to
+ * two contiguous spans (two when the region wraps) so producers and consumers can work without a temporary buffer.
+ */
 
 template <typename IndexT, bool IsAtomic>
 struct index_traits;
@@ -18,7 +29,9 @@ struct index_traits<IndexT, true> {
     using value_t = IndexT;
     using index_t = std::atomic<IndexT>;
     static inline value_t load(const index_t& idx) { return idx.load(std::memory_order_relaxed); }
+    static inline value_t acquire(const index_t& idx) { return idx.load(std::memory_order_acquire); }
     static inline void store(index_t& idx, value_t value) { idx.store(value, std::memory_order_relaxed); }
+    static inline void release(index_t& idx, value_t value) { idx.store(value, std::memory_order_release); }
 };
 
 template <typename IndexT>
@@ -26,9 +39,23 @@ struct index_traits<IndexT, false> {
     using value_t = IndexT;
     using index_t = IndexT;
     static inline value_t load(const index_t& idx) { return idx; }
+    static inline value_t acquire(const index_t& idx) { return idx; }
     static inline void store(index_t& idx, value_t value) { idx = value; }
+    static inline void release(index_t& idx, value_t value) { idx = value; }
 };
 
+template <typename T>
+struct ring_span {
+    T* first;
+    size_t first_size;
+    T* second;
+    size_t second_size;
+
+    size_t size() const { return first_size + second_size; }
+    bool empty() const { return size() == 0; }
+};
+
+constexpr size_t cache_line_size = 64;
 
 template <typename T, typename IndexT, bool IsAtomic=true, typename IndexTraits=index_traits<IndexT, IsAtomic>>
 class ring_buffer {
@@ -39,9 +66,12 @@ public:
     using ptr_t = T*;
     using idx_type = IndexT;
     using cursor_type = typename IndexTraits::index_t;
+    using span_t = ring_span<T>;
+    using const_span_t = ring_span<const T>;
 
-    ring_buffer() = default;
-    ring_buffer(size_t size) : buffer_(size+1), read_(0), write_(0), mod_(idx_type(size+1)) {
+    ring_buffer() : mod_(1), write_{}, cached_read_(0), read_{}, cached_write_(0) { }
+    ring_buffer(size_t size) : buffer_(size+1), mod_(idx_type(size+1)), write_{}, cached_read_(0), read_{},
+                               cached_write_(0) {
         assert(size <= std::numeric_limits<int32_t>::max() && "size must be < max(int32_t)-1");
     }
     ring_buffer(const ring_buffer& rhs) = delete;
@@ -50,157 +80,165 @@ public:
     ring_buffer& operator=(const ring_buffer& rhs) = delete;
 
     // These are not atomic!
-    void clear() { read_ = write_ = 0; }
+    void clear() {
+        IndexTraits::store(read_, 0);
+        IndexTraits::store(write_, 0);
+        cached_read_ = cached_write_ = 0;
+    }
     void resize(size_t size) {
         clear();
         buffer_.resize(size+1);
         mod_ = idx_type(size+1);
     }
 
-    idx_type read_cursor() const { return read_; }
-    idx_type write_cursor() const { return write_; }
+    idx_type read_cursor() const { return IndexTraits::load(read_); }
+    idx_type write_cursor() const { return IndexTraits::load(write_); }
     const ptr_t read_ptr() {
-        idx_type curr_read = read_;
-        if(curr_read != write_) return &buffer_[curr_read];
-        else                    return nullptr;
+        idx_type curr_read = IndexTraits::load(read_);
+        if(read_space(curr_read, 1) != 0) return &buffer_[curr_read];
+        else                              return nullptr;
     }
     idx_type modulus() const { return mod_; }
 
     bool empty() const { return size() == 0; }
     idx_type size() const {
-        idx_type curr_read = read_, curr_write = write_;
-        return curr_write > curr_read ? curr_write - curr_read : curr_write < curr_read ? mod_ - curr_read + curr_write : 0;
+        return readable(IndexTraits::acquire(read_), IndexTraits::acquire(write_));
     }
     idx_type capacity() const { return mod_ - size() - 1; }
 
+    // Consumer
+
     bool read(T& val) {
         idx_type curr_read = IndexTraits::load(read_);
-        if(curr_read == IndexTraits::load(write_)) return false;
+        if(read_space(curr_read, 1) == 0) return false;
         val = buffer_[curr_read];
-        IndexTraits::store(read_, (curr_read + 1) % mod_);
+        IndexTraits::release(read_, advance(curr_read, 1));
         return true;
     }
 
+    // Reads up to len elements, returning the number read
     size_t read(T* ptr, size_t len) {
-        idx_type curr_read = read_, curr_write = write_;
-        idx_type new_read = curr_read + len;
-        idx_type mod_read = new_read % mod_;
-        if(curr_read == curr_write) {
-            return 0;
-        } else if(curr_read < curr_write) {
-            int l = std::min<int>(int(curr_read) + int(len), curr_write);
-            std::copy(buffer_.begin()+curr_read, buffer_.begin()+l, ptr);
-            read_ = l;
-            return len;
-        } else {
-            if(mod_read < curr_write) {
-                int d = mod_ - curr_read;
-                std::copy(buffer_.begin()+curr_read, buffer_.begin()+mod_, ptr);
-                std::copy(buffer_.begin(), buffer_.begin()+(len - d), ptr+d);
-                read_ = mod_read;
-                return len;
-            } else if(mod_read == new_read) {
-                std::copy(buffer_.begin()+curr_read, buffer_.begin()+curr_read+len, ptr);
-                read_ += len;
-                return len;
-            }
-            return 0;
-        }
+        const_span_t span = peek_read(len);
+        std::copy(span.first, span.first + span.first_size, ptr);
+        std::copy(span.second, span.second + span.second_size, ptr + span.first_size);
+        commit_read(span.size());
+        return span.size();
     }
 
-    // This is a non-overwriting ring_buffer
-    bool write(const T& val) {
-        idx_type curr_write = IndexTraits::load(write_);
-        idx_type new_write = (curr_write + 1) % mod_;
-        if(IndexTraits::load(read_) == new_write) return false;
-        buffer_[curr_write] = val;
-        IndexTraits::store(write_, new_write);
-        return true;
+    // The readable region (up to len elements) in place.  Nothing is consumed until commit_read.
+    const_span_t peek_read(size_t len) const {
+        const idx_type curr_read = IndexTraits::load(read_);
+        const size_t avail = std::min(len, size_t(read_space(curr_read, len)));
+        const size_t first = std::min(avail, size_t(mod_ - curr_read));
+        return { buffer_.data() + curr_read, first, buffer_.data(), avail - first };
     }
 
-    // Non-overwriting block copy (no partial writes)
-    bool write(T* ptr, size_t len) {
-        idx_type curr_read = read_, curr_write = write_;
-        idx_type new_write = curr_write + len;
-        idx_type mod_write = new_write % mod_;
-        if(curr_write >= curr_read) { // Empty or write not yet wrapped
-            if(new_write < mod_) {
-                std::copy(ptr, ptr+len, buffer_.begin()+curr_write);
-                write_ = new_write;
-            } else if(mod_write >= curr_read) {
-                return false;
-            } else {
-                int d = mod_ - curr_write;
-                std::copy(ptr, ptr+d, buffer_.begin()+curr_write);
-                int ww = int(len) - d;
-                if(ww > 0) std::copy(ptr+d, ptr+d+ww, buffer_.begin());
-                write_ = ww;
-            }
-        } else if(curr_write < curr_read) { // Write has wrapped and we're nearly full
-            if(new_write < curr_read) {
-                std::copy(ptr, ptr+len, buffer_.begin()+curr_write);
-                write_ = new_write;
-            } else return false;    // Cannot do a partial write
-        } else {    // We have to handle a wrap
-            if(mod_write < curr_read) { // There is sufficient write space
-                int d = mod_ - curr_write;
-                std::copy(ptr, ptr+d, buffer_.begin()+curr_write);
-                int ww = int(len) - d;
-                if(ww > 0) std::copy(ptr+d, ptr+d+ww, buffer_.begin());
-                write_ = ww;
-            } else return false;    // Cannot do a partial write
-        }
-        return true;
+    void commit_read(size_t len) {
+        assert(len <= size_t(readable(IndexTraits::load(read_), IndexTraits::acquire(write_))) && "commit exceeds data");
+        IndexTraits::release(read_, advance(IndexTraits::load(read_), len));
     }
 
     bool peek(T& val) const {
-        idx_type curr_read = read_;
-        if(curr_read == write_) return false;
+        idx_type curr_read = IndexTraits::load(read_);
+        if(read_space(curr_read, 1) == 0) return false;
         val = buffer_[curr_read];
         return true;
     }
 
     bool peek(idx_type idx, T& val) const {
-        auto temp_read = (read_ + idx) % mod_;
-        if(temp_read == write_) return false;
-        val = buffer_[temp_read];
+        idx_type curr_read = IndexTraits::load(read_);
+        if(read_space(curr_read, size_t(idx) + 1) <= idx) return false;
+        val = buffer_[advance(curr_read, size_t(idx))];
         return true;
     }
 
     bool skip() {
-        idx_type curr_read = read_;
-        if(curr_read == write_) return false;
-        read_ = (curr_read + 1) % mod_;
+        idx_type curr_read = IndexTraits::load(read_);
+        if(read_space(curr_read, 1) == 0) return false;
+        IndexTraits::release(read_, advance(curr_read, 1));
         return true;
     }
 
+    // Skips up to len elements, returning the number skipped
     idx_type skip(idx_type len) {
-        idx_type new_read = read_ + len;
-        idx_type mod_read = new_read % mod_;
-        idx_type curr_write = write_;
-        if(read_ == curr_write) {
-            return 0;
-        } else if(read_ < curr_write) {
-            int l = std::min<int>(int(read_) + int(len), curr_write);
-            read_ = l;
-            return len;
-        } else {
-            if(mod_read < curr_write) {
-                read_ = mod_read;
-                return len;
-            } else if(mod_read == new_read) {
-                read_ += len;
-                return len;
-            }
-            return 0;
-        }
+        idx_type curr_read = IndexTraits::load(read_);
+        idx_type step = std::min(len, read_space(curr_read, size_t(len)));
+        IndexTraits::release(read_, advance(curr_read, size_t(step)));
+        return step;
+    }
+
+    // Producer
+
+    // This is a non-overwriting ring_buffer
+    bool write(const T& val) {
+        idx_type curr_write = IndexTraits::load(write_);
+        if(write_space(curr_write, 1) == 0) return false;
+        buffer_[curr_write] = val;
+        IndexTraits::release(write_, advance(curr_write, 1));
+        return true;
+    }
+
+    // Non-overwriting block copy (no partial writes)
+    bool write(const T* ptr, size_t len) {
+        span_t span = prepare_write(len);
+        if(span.size() != len) return false;
+        std::copy(ptr, ptr + span.first_size, span.first);
+        std::copy(ptr + span.first_size, ptr + len, span.second);
+        commit_write(len);
+        return true;
+    }
+
+    // The free region (up to len elements) in place.  Nothing is published until commit_write.
+    span_t prepare_write(size_t len) {
+        const idx_type curr_write = IndexTraits::load(write_);
+        const size_t avail = std::min(len, size_t(write_space(curr_write, len)));
+        const size_t first = std::min(avail, size_t(mod_ - curr_write));
+        return { buffer_.data() + curr_write, first, buffer_.data(), avail - first };
+    }
+
+    void commit_write(size_t len) {
+        assert(len <= size_t(mod_ - 1 - readable(IndexTraits::acquire(read_), IndexTraits::load(write_))) &&
+               "commit exceeds space");
+        IndexTraits::release(write_, advance(IndexTraits::load(write_), len));
     }
 
 protected:
+    idx_type advance(idx_type cursor, size_t len) const { return idx_type((size_t(cursor) + len) % size_t(mod_)); }
+    idx_type readable(idx_type curr_read, idx_type curr_write) const {
+        return curr_write >= curr_read ? curr_write - curr_read : mod_ - curr_read + curr_write;
+    }
+
+    // Data available to the consumer; the write cursor is only reloaded if the cached copy shows too little
+    idx_type read_space(idx_type curr_read, size_t wanted) const {
+        idx_type avail = readable(curr_read, cached_write_);
+        if(size_t(avail) < wanted) {
+            cached_write_ = IndexTraits::acquire(write_);
+            avail = readable(curr_read, cached_write_);
+        }
+        return avail;
+    }
+
+    // Space available to the producer; the read cursor is only reloaded if the cached copy shows too little
+    idx_type write_space(idx_type curr_write, size_t wanted) {
+        idx_type space = mod_ - 1 - readable(cached_read_, curr_write);
+        if(size_t(space) < wanted) {
+            cached_read_ = IndexTraits::acquire(read_);
+            space = mod_ - 1 - readable(cached_read_, curr_write);
+        }
+        return space;
+    }
+
     std::vector<T> buffer_;
-    cursor_type read_;
-    cursor_type write_;
     idx_type mod_;
+
+    // The producer and consumer state live on separate cache lines to avoid false sharing
+    char pad0_[cache_line_size];
+    cursor_type write_;
+    idx_type cached_read_;
+    char pad1_[cache_line_size];
+    cursor_type read_;
+    mutable idx_type cached_write_;
+    char pad2_[cache_line_size];
 };
 
 #endif //ZAPAUDIO_RING_BUFFER_HPP
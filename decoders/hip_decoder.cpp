@@ -0,0 +1,70 @@
+#include "hip_decoder.hpp"
+#include <cstring>
+#include "dsp/sample_convert.hpp"
+#include "log.hpp"
+
+#ifdef ZAPAUDIO_HIP_UNCLIPPED
+// Exported by libmp3lame but declared in its internal headers rather than lame.h, since it returns LAME's internal
+// sample_t, which is float in LAME's default configuration.  CMake checks that the library links it.
+extern "C" int hip_decode1_unclipped(hip_t hip, unsigned char* mp3buf, size_t len, float pcm_l[], float pcm_r[]);
+
+namespace {
+
+// hip_decode1_unclipped returns samples on the 16 bit scale
+const float s16_scale = 1.f/32767.f;
+
+}
+#endif
+
+hip_decoder::hip_decoder() : hip_(nullptr) {
+    reset();
+}
+
+hip_decoder::~hip_decoder() {
+    if(hip_) hip_decode_exit(hip_);
+}
+
+bool hip_decoder::reset() {
+    if(hip_) hip_decode_exit(hip_);
+    memset(&mp3data_, 0x00, sizeof(mp3data_struct));
+    hip_ = hip_decode_init();
+    if(!hip_) {
+        SM_LOG("LAME HIP failed to initialise");
+        return false;
+    }
+    return true;
+}
+
+int hip_decoder::decode(const byte* data, size_t len, short* left, short* right) {
+    // hip copies its input into its own buffers, it never writes through the pointer
+    return hip_decode1_headers(hip_, const_cast<byte*>(data), len, left, right, &mp3data_);
+}
+
+int hip_decoder::decode(const byte* data, size_t len, float* left, float* right) {
+#ifdef ZAPAUDIO_HIP_UNCLIPPED
+    const int ret = hip_decode1_unclipped(hip_, const_cast<byte*>(data), len, left, right);
+    for(int i = 0; i < ret; ++i) {
+        left[i] *= s16_scale;
+        right[i] *= s16_scale;
+    }
+    return ret;
+#else
+    // The library does not export the unclipped decode, so the peaks are saturated at 16 bits like the short path
+    const int ret = decode(data, len, left_s16_.data(), right_s16_.data());
+    if(ret > 0) {
+        convert_s16_f32(left_s16_.data(), left, size_t(ret));
+        convert_s16_f32(right_s16_.data(), right, size_t(ret));
+    }
+    return ret;
+#endif
+}
+
+bool hip_decoder::get_format(mp3_format& format) const {
+    if(mp3data_.header_parsed != 1) return false;
+    format.samplerate = mp3data_.samplerate;
+    format.bitrate = mp3data_.bitrate;
+    format.channels = mp3data_.stereo;
+    format.total_frames = mp3data_.totalframes;
+    format.duration = mp3data_.samplerate ? mp3data_.totalframes / mp3data_.samplerate : 0;
+    return true;
+}
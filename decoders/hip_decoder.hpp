@@ -0,0 +1,39 @@
+#ifndef ZAPAUDIO_HIP_DECODER_HPP
+#define ZAPAUDIO_HIP_DECODER_HPP
+
+#ifdef _WIN32
+#include <lame.h>
+#else
+#include <lame/lame.h>
+#endif //_WIN32
+#include <array>
+#include "mp3_decoder.hpp"
+
+/*
+ * Decodes through LAME's hip interface.  hip queues the input internally and hip_decode1_headers returns at most one
+ * frame per call, which is the mp3_decoder contract as it stands.  The float decode uses hip_decode1_unclipped, which
+ * does not report the header, so get_format() only follows the 16 bit decode.  Where libmp3lame does not export it
+ * (ZAPAUDIO_HIP_UNCLIPPED is not defined) the float decode is the 16 bit decode converted, clipped at full scale.
+ */
+
+class ZAPAUDIO_EXPORT hip_decoder : public mp3_decoder {
+public:
+    hip_decoder();
+    virtual ~hip_decoder();
+
+    bool is_open() const { return hip_ != nullptr; }
+
+    virtual bool reset() override;
+    virtual int decode(const byte* data, size_t len, short* left, short* right) override;
+    virtual int decode(const byte* data, size_t len, float* left, float* right) override;
+    virtual bool get_format(mp3_format& format) const override;
+    virtual const char* name() const override { return "hip"; }
+
+private:
+    hip_t hip_;
+    mp3data_struct mp3data_;
+    std::array<short, mp3_frame_size> left_s16_;        // For the float decode without hip_decode1_unclipped
+    std::array<short, mp3_frame_size> right_s16_;
+};
+
+#endif //ZAPAUDIO_HIP_DECODER_HPP
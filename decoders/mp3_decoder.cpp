@@ -0,0 +1,14 @@
+#include "mp3_decoder.hpp"
+#include <utility>
+#include "hip_decoder.hpp"
+
+std::unique_ptr<mp3_decoder> make_mp3_decoder(mp3_decoder_backend backend) {
+    switch(backend) {
+        case mp3_decoder_backend::hip: {
+            std::unique_ptr<hip_decoder> decoder(new hip_decoder());
+            if(!decoder->is_open()) return nullptr;
+            return std::unique_ptr<mp3_decoder>(std::move(decoder));
+        }
+    }
+    return nullptr;
+}
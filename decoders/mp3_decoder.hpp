@@ -0,0 +1,53 @@
+#ifndef ZAPAUDIO_MP3_DECODER_HPP
+#define ZAPAUDIO_MP3_DECODER_HPP
+
+#include <memory>
+#include <cstddef>
+#include "streams/audio_stream.hpp"
+#include "streams/mp3_frame.hpp"
+
+/*
+ * mp3_decoder is the decoding side of mp3_stream, decode_segment and file_decoder.  A decoder turns MPEG audio frames
+ * into 16 bit or float PCM one frame per call, keeping the bit reservoir and overlap state between frames, so the
+ * readers above it are independent of the library that does the work.
+ *
+ * LAME's hip decoder is the only backend so far, so playback still needs LAME.  A native Layer III decoder would be
+ * added as another mp3_decoder_backend.
+ */
+
+struct ZAPAUDIO_EXPORT mp3_format {
+    int samplerate;
+    int bitrate;
+    int channels;
+    int total_frames;
+    int duration;   // In seconds
+};
+
+constexpr size_t mp3_frame_size = 1152;
+
+enum class mp3_decoder_backend {
+    hip             // LAME's mpglib based decoder
+};
+
+class ZAPAUDIO_EXPORT mp3_decoder {
+public:
+    virtual ~mp3_decoder() = default;
+
+    // Drops the queued input, bit reservoir and overlap so the next frame decodes as the start of a stream
+    virtual bool reset() = 0;
+    // Queues len bytes and decodes the next complete frame into left and right, mp3_frame_size samples each.  Returns
+    // the samples per channel, 0 if more input is needed or -1 on an error.  Call again with len 0 until it returns 0
+    // to drain the frames still queued.  The input is copied, it only has to stay valid for the call.
+    virtual int decode(const byte* data, size_t len, short* left, short* right) = 0;
+    // As above with full scale at 1.0.  Where the backend supports it the samples are neither rounded nor clipped, so
+    // a loud frame keeps the peaks over full scale that the 16 bit decode saturates.
+    virtual int decode(const byte* data, size_t len, float* left, float* right) = 0;
+    // False until a frame header has been parsed
+    virtual bool get_format(mp3_format& format) const = 0;
+    virtual const char* name() const = 0;
+};
+
+// Returns nullptr (and logs) if the backend failed to initialise
+ZAPAUDIO_EXPORT std::unique_ptr<mp3_decoder> make_mp3_decoder(mp3_decoder_backend backend=mp3_decoder_backend::hip);
+
+#endif //ZAPAUDIO_MP3_DECODER_HPP
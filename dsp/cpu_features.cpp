@@ -0,0 +1,44 @@
+#include "cpu_features.hpp"
+#if defined(ZAPAUDIO_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+
+cpu_features detect_features() {
+    cpu_features features = { false, false, false, false };
+
+#if defined(ZAPAUDIO_X86)
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    features.sse2 = (regs[3] & (1 << 26)) != 0;
+    const bool fma = (regs[2] & (1 << 12)) != 0;
+    const bool osxsave = (regs[2] & (1 << 27)) != 0;
+    // The OS must save the YMM registers on context switches
+    const bool ymm = osxsave && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(regs, 7, 0);
+    features.avx2 = ymm && (regs[1] & (1 << 5)) != 0;
+    features.fma = ymm && fma;
+#else
+    __builtin_cpu_init();
+    features.sse2 = __builtin_cpu_supports("sse2") != 0;
+    features.avx2 = __builtin_cpu_supports("avx2") != 0;
+    features.fma = __builtin_cpu_supports("fma") != 0;
+#endif
+#endif
+
+#if defined(ZAPAUDIO_NEON)
+    features.neon = true;
+#endif
+
+    return features;
+}
+
+}
+
+const cpu_features& get_cpu_features() {
+    static const cpu_features features = detect_features();
+    return features;
+}
@@ -0,0 +1,34 @@
+#ifndef ZAPAUDIO_CPU_FEATURES_HPP
+#define ZAPAUDIO_CPU_FEATURES_HPP
+
+#include "streams/audio_stream.hpp"
+
+/*
+ * Runtime detection of the SIMD instruction sets used by the dsp kernels.  Detection runs once on first use.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ZAPAUDIO_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__) || defined(_M_ARM64)
+#define ZAPAUDIO_NEON 1
+#endif
+
+// GCC and Clang compile the AVX2 kernels with a function target attribute so the rest of the tree stays at baseline
+#if defined(ZAPAUDIO_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ZAPAUDIO_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define ZAPAUDIO_TARGET_AVX2
+#endif
+
+struct ZAPAUDIO_EXPORT cpu_features {
+    bool sse2;
+    bool avx2;
+    bool fma;
+    bool neon;
+};
+
+ZAPAUDIO_EXPORT const cpu_features& get_cpu_features();
+
+#endif //ZAPAUDIO_CPU_FEATURES_HPP
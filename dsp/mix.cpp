@@ -0,0 +1,127 @@
+#include "mix.hpp"
+#include "cpu_features.hpp"
+#if defined(ZAPAUDIO_X86)
+#include <immintrin.h>
+#endif
+#if defined(ZAPAUDIO_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const float s16_scale = 1.f/32767.f;
+
+void mix_f32_scalar(float* acc, const float* in, float gain, size_t len) {
+    for(size_t i = 0; i != len; ++i) acc[i] += gain * in[i];
+}
+
+void mix_s16_scalar(float* acc, const int16_t* in, float gain, size_t len) {
+    gain *= s16_scale;
+    for(size_t i = 0; i != len; ++i) acc[i] += gain * in[i];
+}
+
+#if defined(ZAPAUDIO_X86)
+
+void mix_f32_sse2(float* acc, const float* in, float gain, size_t len) {
+    const __m128 g = _mm_set1_ps(gain);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        __m128 a = _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(in + i), g));
+        __m128 b = _mm_add_ps(_mm_loadu_ps(acc + i + 4), _mm_mul_ps(_mm_loadu_ps(in + i + 4), g));
+        _mm_storeu_ps(acc + i, a);
+        _mm_storeu_ps(acc + i + 4, b);
+    }
+    mix_f32_scalar(acc + i, in + i, gain, len - i);
+}
+
+void mix_s16_sse2(float* acc, const int16_t* in, float gain, size_t len) {
+    const __m128 g = _mm_set1_ps(gain * s16_scale);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        const __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(lo, g)));
+        _mm_storeu_ps(acc + i + 4, _mm_add_ps(_mm_loadu_ps(acc + i + 4), _mm_mul_ps(hi, g)));
+    }
+    mix_s16_scalar(acc + i, in + i, gain, len - i);
+}
+
+ZAPAUDIO_TARGET_AVX2 void mix_f32_avx2(float* acc, const float* in, float gain, size_t len) {
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for(; i + 16 <= len; i += 16) {
+        _mm256_storeu_ps(acc + i, _mm256_fmadd_ps(_mm256_loadu_ps(in + i), g, _mm256_loadu_ps(acc + i)));
+        _mm256_storeu_ps(acc + i + 8, _mm256_fmadd_ps(_mm256_loadu_ps(in + i + 8), g, _mm256_loadu_ps(acc + i + 8)));
+    }
+    mix_f32_scalar(acc + i, in + i, gain, len - i);
+}
+
+ZAPAUDIO_TARGET_AVX2 void mix_s16_avx2(float* acc, const int16_t* in, float gain, size_t len) {
+    const __m256 g = _mm256_set1_ps(gain * s16_scale);
+    size_t i = 0;
+    for(; i + 16 <= len; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+        const __m256 fa = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a));
+        const __m256 fb = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b));
+        _mm256_storeu_ps(acc + i, _mm256_fmadd_ps(fa, g, _mm256_loadu_ps(acc + i)));
+        _mm256_storeu_ps(acc + i + 8, _mm256_fmadd_ps(fb, g, _mm256_loadu_ps(acc + i + 8)));
+    }
+    mix_s16_scalar(acc + i, in + i, gain, len - i);
+}
+
+#endif //ZAPAUDIO_X86
+
+#if defined(ZAPAUDIO_NEON)
+
+void mix_f32_neon(float* acc, const float* in, float gain, size_t len) {
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        vst1q_f32(acc + i, vmlaq_n_f32(vld1q_f32(acc + i), vld1q_f32(in + i), gain));
+        vst1q_f32(acc + i + 4, vmlaq_n_f32(vld1q_f32(acc + i + 4), vld1q_f32(in + i + 4), gain));
+    }
+    mix_f32_scalar(acc + i, in + i, gain, len - i);
+}
+
+void mix_s16_neon(float* acc, const int16_t* in, float gain, size_t len) {
+    const float g = gain * s16_scale;
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        const int16x8_t v = vld1q_s16(in + i);
+        const float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+        const float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+        vst1q_f32(acc + i, vmlaq_n_f32(vld1q_f32(acc + i), lo, g));
+        vst1q_f32(acc + i + 4, vmlaq_n_f32(vld1q_f32(acc + i + 4), hi, g));
+    }
+    mix_s16_scalar(acc + i, in + i, gain, len - i);
+}
+
+#endif //ZAPAUDIO_NEON
+
+mix_kernels select_kernels() {
+    mix_kernels kernels = { mix_f32_scalar, mix_s16_scalar, "scalar" };
+    const cpu_features& features = get_cpu_features();
+    (void)features;
+
+#if defined(ZAPAUDIO_X86)
+    if(features.avx2 && features.fma) {
+        kernels = { mix_f32_avx2, mix_s16_avx2, "avx2" };
+    } else if(features.sse2) {
+        kernels = { mix_f32_sse2, mix_s16_sse2, "sse2" };
+    }
+#endif
+
+#if defined(ZAPAUDIO_NEON)
+    if(features.neon) kernels = { mix_f32_neon, mix_s16_neon, "neon" };
+#endif
+
+    return kernels;
+}
+
+}
+
+const mix_kernels& get_mix_kernels() {
+    static const mix_kernels kernels = select_kernels();
+    return kernels;
+}
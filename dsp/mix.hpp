@@ -0,0 +1,24 @@
+#ifndef ZAPAUDIO_MIX_HPP
+#define ZAPAUDIO_MIX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "streams/audio_stream.hpp"
+
+/*
+ * Gain-and-accumulate kernels for mixing, acc[i] += gain * in[i].  The s16 variant folds the 1/32767 scale into the
+ * gain so integer inputs mix without a separate conversion pass.  Dispatched at runtime like sample_convert.
+ */
+
+struct ZAPAUDIO_EXPORT mix_kernels {
+    void (*mix_f32)(float* acc, const float* in, float gain, size_t len);
+    void (*mix_s16)(float* acc, const int16_t* in, float gain, size_t len);
+    const char* name;
+};
+
+ZAPAUDIO_EXPORT const mix_kernels& get_mix_kernels();
+
+inline void mix_f32(float* acc, const float* in, float gain, size_t len) { get_mix_kernels().mix_f32(acc, in, gain, len); }
+inline void mix_s16(float* acc, const int16_t* in, float gain, size_t len) { get_mix_kernels().mix_s16(acc, in, gain, len); }
+
+#endif //ZAPAUDIO_MIX_HPP
@@ -0,0 +1,124 @@
+#include "resample.hpp"
+#include "cpu_features.hpp"
+#if defined(ZAPAUDIO_X86)
+#include <immintrin.h>
+#endif
+#if defined(ZAPAUDIO_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+float dot_scalar(const float* a, const float* b, size_t len) {
+    float sum = 0.f;
+    for(size_t i = 0; i != len; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+void blend_scalar(float* out, const float* a, const float* b, float t, size_t len) {
+    for(size_t i = 0; i != len; ++i) out[i] = a[i] + t * (b[i] - a[i]);
+}
+
+#if defined(ZAPAUDIO_X86)
+
+float dot_sse2(const float* a, const float* b, size_t len) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    s0 = _mm_add_ps(s0, s1);
+    s0 = _mm_add_ps(s0, _mm_movehl_ps(s0, s0));
+    s0 = _mm_add_ss(s0, _mm_shuffle_ps(s0, s0, 1));
+    return _mm_cvtss_f32(s0) + dot_scalar(a + i, b + i, len - i);
+}
+
+void blend_sse2(float* out, const float* a, const float* b, float t, size_t len) {
+    const __m128 vt = _mm_set1_ps(t);
+    size_t i = 0;
+    for(; i + 4 <= len; i += 4) {
+        const __m128 va = _mm_loadu_ps(a + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(vt, _mm_sub_ps(_mm_loadu_ps(b + i), va))));
+    }
+    blend_scalar(out + i, a + i, b + i, t, len - i);
+}
+
+ZAPAUDIO_TARGET_AVX2 float dot_avx2(const float* a, const float* b, size_t len) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for(; i + 16 <= len; i += 16) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    for(; i + 8 <= len; i += 8) s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+    s0 = _mm256_add_ps(s0, s1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s) + dot_scalar(a + i, b + i, len - i);
+}
+
+ZAPAUDIO_TARGET_AVX2 void blend_avx2(float* out, const float* a, const float* b, float t, size_t len) {
+    const __m256 vt = _mm256_set1_ps(t);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        const __m256 va = _mm256_loadu_ps(a + i);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(vt, _mm256_sub_ps(_mm256_loadu_ps(b + i), va), va));
+    }
+    blend_scalar(out + i, a + i, b + i, t, len - i);
+}
+
+#endif //ZAPAUDIO_X86
+
+#if defined(ZAPAUDIO_NEON)
+
+float dot_neon(const float* a, const float* b, size_t len) {
+    float32x4_t s0 = vdupq_n_f32(0.f), s1 = vdupq_n_f32(0.f);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        s0 = vmlaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+        s1 = vmlaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    s0 = vaddq_f32(s0, s1);
+    const float32x2_t s = vadd_f32(vget_low_f32(s0), vget_high_f32(s0));
+    return vget_lane_f32(vpadd_f32(s, s), 0) + dot_scalar(a + i, b + i, len - i);
+}
+
+void blend_neon(float* out, const float* a, const float* b, float t, size_t len) {
+    size_t i = 0;
+    for(; i + 4 <= len; i += 4) {
+        const float32x4_t va = vld1q_f32(a + i);
+        vst1q_f32(out + i, vmlaq_n_f32(va, vsubq_f32(vld1q_f32(b + i), va), t));
+    }
+    blend_scalar(out + i, a + i, b + i, t, len - i);
+}
+
+#endif //ZAPAUDIO_NEON
+
+resample_kernels select_kernels() {
+    resample_kernels kernels = { dot_scalar, blend_scalar, "scalar" };
+    const cpu_features& features = get_cpu_features();
+    (void)features;
+
+#if defined(ZAPAUDIO_X86)
+    if(features.avx2 && features.fma) {
+        kernels = { dot_avx2, blend_avx2, "avx2" };
+    } else if(features.sse2) {
+        kernels = { dot_sse2, blend_sse2, "sse2" };
+    }
+#endif
+
+#if defined(ZAPAUDIO_NEON)
+    if(features.neon) kernels = { dot_neon, blend_neon, "neon" };
+#endif
+
+    return kernels;
+}
+
+}
+
+const resample_kernels& get_resample_kernels() {
+    static const resample_kernels kernels = select_kernels();
+    return kernels;
+}
@@ -0,0 +1,20 @@
+#ifndef ZAPAUDIO_RESAMPLE_HPP
+#define ZAPAUDIO_RESAMPLE_HPP
+
+#include <cstddef>
+#include "streams/audio_stream.hpp"
+
+/*
+ * Inner loops of the polyphase resampler: a dot product of the filter against the input history and a blend of two
+ * adjacent filter phases.  Dispatched at runtime like sample_convert.
+ */
+
+struct ZAPAUDIO_EXPORT resample_kernels {
+    float (*dot)(const float* a, const float* b, size_t len);
+    void (*blend)(float* out, const float* a, const float* b, float t, size_t len);   // out = a + t*(b - a)
+    const char* name;
+};
+
+ZAPAUDIO_EXPORT const resample_kernels& get_resample_kernels();
+
+#endif //ZAPAUDIO_RESAMPLE_HPP
@@ -0,0 +1,212 @@
+#include "sample_convert.hpp"
+#include "cpu_features.hpp"
+#include <cmath>
+#if defined(ZAPAUDIO_X86)
+#include <immintrin.h>
+#endif
+#if defined(ZAPAUDIO_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const float s16_scale = 1.f/32767.f;
+const float s24_scale = 1.f/8388607.f;
+const float s32_scale = 1.f/2147483647.f;
+
+// Scalar kernels, also used for the tails of the vector kernels
+
+void s16_f32_scalar(const int16_t* in, float* out, size_t len) {
+    for(size_t i = 0; i != len; ++i) out[i] = in[i] * s16_scale;
+}
+
+void f32_s16_scalar(const float* in, int16_t* out, size_t len) {
+    for(size_t i = 0; i != len; ++i) {
+        float v = in[i] * 32767.f;
+        v = v > -32768.f ? v : -32768.f;     // NaN saturates low, as the vector kernels do
+        v = v < 32767.f ? v : 32767.f;
+        out[i] = int16_t(std::lrint(v));
+    }
+}
+
+void s32_f32_scalar(const int32_t* in, float* out, size_t len) {
+    for(size_t i = 0; i != len; ++i) out[i] = in[i] * s32_scale;
+}
+
+void s24_f32_scalar(const uint8_t* in, float* out, size_t len) {
+    for(size_t i = 0; i != len; ++i, in += 3) {
+        const int32_t v = int32_t(uint32_t(in[0]) << 8 | uint32_t(in[1]) << 16 | uint32_t(in[2]) << 24) >> 8;
+        out[i] = v * s24_scale;
+    }
+}
+
+#if defined(ZAPAUDIO_X86)
+
+void s16_f32_sse2(const int16_t* in, float* out, size_t len) {
+    const __m128 scale = _mm_set1_ps(s16_scale);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    s16_f32_scalar(in + i, out + i, len - i);
+}
+
+void f32_s16_sse2(const float* in, int16_t* out, size_t len) {
+    const __m128 scale = _mm_set1_ps(32767.f), lo = _mm_set1_ps(-32768.f), hi = _mm_set1_ps(32767.f);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        // Clamp before converting, out of range floats convert to INT_MIN
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+        a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+        b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+        const __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+    f32_s16_scalar(in + i, out + i, len - i);
+}
+
+void s32_f32_sse2(const int32_t* in, float* out, size_t len) {
+    const __m128 scale = _mm_set1_ps(s32_scale);
+    size_t i = 0;
+    for(; i + 4 <= len; i += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    s32_f32_scalar(in + i, out + i, len - i);
+}
+
+ZAPAUDIO_TARGET_AVX2 void s16_f32_avx2(const int16_t* in, float* out, size_t len) {
+    const __m256 scale = _mm256_set1_ps(s16_scale);
+    size_t i = 0;
+    for(; i + 16 <= len; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a)), scale));
+        _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b)), scale));
+    }
+    s16_f32_scalar(in + i, out + i, len - i);
+}
+
+ZAPAUDIO_TARGET_AVX2 void f32_s16_avx2(const float* in, int16_t* out, size_t len) {
+    const __m256 scale = _mm256_set1_ps(32767.f), lo = _mm256_set1_ps(-32768.f), hi = _mm256_set1_ps(32767.f);
+    size_t i = 0;
+    for(; i + 16 <= len; i += 16) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(in + i), scale);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale);
+        a = _mm256_min_ps(_mm256_max_ps(a, lo), hi);
+        b = _mm256_min_ps(_mm256_max_ps(b, lo), hi);
+        // packs works per 128 bit lane, the permute restores the sample order
+        const __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    f32_s16_scalar(in + i, out + i, len - i);
+}
+
+ZAPAUDIO_TARGET_AVX2 void s32_f32_avx2(const int32_t* in, float* out, size_t len) {
+    const __m256 scale = _mm256_set1_ps(s32_scale);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    s32_f32_scalar(in + i, out + i, len - i);
+}
+
+ZAPAUDIO_TARGET_AVX2 void s24_f32_avx2(const uint8_t* in, float* out, size_t len) {
+    // Moves each 3 byte sample into the top of a 32 bit lane, the arithmetic shift then sign extends it
+    const __m128i shuffle = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    const __m256 scale = _mm256_set1_ps(s24_scale);
+    size_t i = 0;
+    // Each 16 byte load uses 12 bytes, stop while a full load is still inside the input
+    for(; (len - i) * 3 >= 28; i += 8) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 3*i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 3*i + 12));
+        const __m256i v = _mm256_set_m128i(_mm_shuffle_epi8(b, shuffle), _mm_shuffle_epi8(a, shuffle));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(v, 8)), scale));
+    }
+    s24_f32_scalar(in + 3*i, out + i, len - i);
+}
+
+#endif //ZAPAUDIO_X86
+
+#if defined(ZAPAUDIO_NEON)
+
+void s16_f32_neon(const int16_t* in, float* out, size_t len) {
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        const int16x8_t v = vld1q_s16(in + i);
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), s16_scale));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), s16_scale));
+    }
+    s16_f32_scalar(in + i, out + i, len - i);
+}
+
+void f32_s16_neon(const float* in, int16_t* out, size_t len) {
+    size_t i = 0;
+#if defined(__aarch64__) || defined(_M_ARM64)
+    // vcvtn rounds to nearest and the conversions saturate, so no clamp is needed
+    for(; i + 8 <= len; i += 8) {
+        const int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(in + i), 32767.f));
+        const int32x4_t b = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(in + i + 4), 32767.f));
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+#endif
+    f32_s16_scalar(in + i, out + i, len - i);
+}
+
+void s32_f32_neon(const int32_t* in, float* out, size_t len) {
+    size_t i = 0;
+    for(; i + 4 <= len; i += 4) vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in + i)), s32_scale));
+    s32_f32_scalar(in + i, out + i, len - i);
+}
+
+void s24_f32_neon(const uint8_t* in, float* out, size_t len) {
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        // De-interleave the three bytes of each sample and rebuild them at the top of 32 bit lanes
+        const uint8x8x3_t b = vld3_u8(in + 3*i);
+        const uint16x8_t lo = vmovl_u8(b.val[0]), mid = vmovl_u8(b.val[1]), hi = vmovl_u8(b.val[2]);
+        const uint16x8_t top = vorrq_u16(vshlq_n_u16(hi, 8), mid);
+        const int32x4_t v0 = vreinterpretq_s32_u32(vorrq_u32(vshlq_n_u32(vmovl_u16(vget_low_u16(top)), 16),
+                                                             vshlq_n_u32(vmovl_u16(vget_low_u16(lo)), 8)));
+        const int32x4_t v1 = vreinterpretq_s32_u32(vorrq_u32(vshlq_n_u32(vmovl_u16(vget_high_u16(top)), 16),
+                                                             vshlq_n_u32(vmovl_u16(vget_high_u16(lo)), 8)));
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vshrq_n_s32(v0, 8)), s24_scale));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vshrq_n_s32(v1, 8)), s24_scale));
+    }
+    s24_f32_scalar(in + 3*i, out + i, len - i);
+}
+
+#endif //ZAPAUDIO_NEON
+
+convert_kernels select_kernels() {
+    convert_kernels kernels = { s16_f32_scalar, f32_s16_scalar, s32_f32_scalar, s24_f32_scalar, "scalar" };
+    const cpu_features& features = get_cpu_features();
+    (void)features;
+
+#if defined(ZAPAUDIO_X86)
+    if(features.avx2) {
+        kernels = { s16_f32_avx2, f32_s16_avx2, s32_f32_avx2, s24_f32_avx2, "avx2" };
+    } else if(features.sse2) {
+        kernels = { s16_f32_sse2, f32_s16_sse2, s32_f32_sse2, s24_f32_scalar, "sse2" };
+    }
+#endif
+
+#if defined(ZAPAUDIO_NEON)
+    if(features.neon) kernels = { s16_f32_neon, f32_s16_neon, s32_f32_neon, s24_f32_neon, "neon" };
+#endif
+
+    return kernels;
+}
+
+}
+
+const convert_kernels& get_convert_kernels() {
+    static const convert_kernels kernels = select_kernels();
+    return kernels;
+}
@@ -0,0 +1,29 @@
+#ifndef ZAPAUDIO_SAMPLE_CONVERT_HPP
+#define ZAPAUDIO_SAMPLE_CONVERT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "streams/audio_stream.hpp"
+
+/*
+ * Block sample format conversion.  Each kernel has scalar, SSE2, AVX2 and NEON implementations and the best one the
+ * CPU supports is chosen at runtime.  Integer formats map to [-1, 1] by their maximum positive value, matching
+ * sample_convert; float to s16 rounds to nearest and saturates.  s24 is packed little-endian, 3 bytes per sample.
+ */
+
+struct ZAPAUDIO_EXPORT convert_kernels {
+    void (*s16_f32)(const int16_t* in, float* out, size_t len);
+    void (*f32_s16)(const float* in, int16_t* out, size_t len);
+    void (*s32_f32)(const int32_t* in, float* out, size_t len);
+    void (*s24_f32)(const uint8_t* in, float* out, size_t len);
+    const char* name;
+};
+
+ZAPAUDIO_EXPORT const convert_kernels& get_convert_kernels();
+
+inline void convert_s16_f32(const int16_t* in, float* out, size_t len) { get_convert_kernels().s16_f32(in, out, len); }
+inline void convert_f32_s16(const float* in, int16_t* out, size_t len) { get_convert_kernels().f32_s16(in, out, len); }
+inline void convert_s32_f32(const int32_t* in, float* out, size_t len) { get_convert_kernels().s32_f32(in, out, len); }
+inline void convert_s24_f32(const uint8_t* in, float* out, size_t len) { get_convert_kernels().s24_f32(in, out, len); }
+
+#endif //ZAPAUDIO_SAMPLE_CONVERT_HPP
@@ -0,0 +1,101 @@
+#include "sync_scan.hpp"
+#include "cpu_features.hpp"
+#if defined(ZAPAUDIO_X86)
+#include <immintrin.h>
+#endif
+#if defined(ZAPAUDIO_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+size_t find_sync_scalar(const uint8_t* data, size_t len) {
+    for(size_t i = 0; i + 1 < len; ++i) {
+        if(data[i] == 0xFF && (data[i+1] & 0xE0) == 0xE0) return i;
+    }
+    return len;
+}
+
+#if defined(ZAPAUDIO_X86)
+
+#if defined(_MSC_VER)
+inline unsigned count_trailing_zeros(unsigned mask) { unsigned long idx; _BitScanForward(&idx, mask); return idx; }
+#else
+inline unsigned count_trailing_zeros(unsigned mask) { return unsigned(__builtin_ctz(mask)); }
+#endif
+
+// Compares each byte and its successor in one pass by loading the block twice, one byte apart
+size_t find_sync_sse2(const uint8_t* data, size_t len) {
+    const __m128i ff = _mm_set1_epi8(char(0xFF));
+    const __m128i e0 = _mm_set1_epi8(char(0xE0));
+    size_t i = 0;
+    for(; i + 17 <= len; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+        const __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(a, ff), _mm_cmpeq_epi8(_mm_and_si128(b, e0), e0));
+        const unsigned mask = unsigned(_mm_movemask_epi8(hit));
+        if(mask) return i + count_trailing_zeros(mask);
+    }
+    return i + find_sync_scalar(data + i, len - i);
+}
+
+ZAPAUDIO_TARGET_AVX2 size_t find_sync_avx2(const uint8_t* data, size_t len) {
+    const __m256i ff = _mm256_set1_epi8(char(0xFF));
+    const __m256i e0 = _mm256_set1_epi8(char(0xE0));
+    size_t i = 0;
+    for(; i + 33 <= len; i += 32) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 1));
+        const __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(a, ff), _mm256_cmpeq_epi8(_mm256_and_si256(b, e0), e0));
+        const unsigned mask = unsigned(_mm256_movemask_epi8(hit));
+        if(mask) return i + count_trailing_zeros(mask);
+    }
+    return i + find_sync_scalar(data + i, len - i);
+}
+
+#endif //ZAPAUDIO_X86
+
+#if defined(ZAPAUDIO_NEON)
+
+// NEON has no movemask, so blocks are only tested for any hit and the scalar loop locates it
+size_t find_sync_neon(const uint8_t* data, size_t len) {
+    const uint8x16_t e0 = vdupq_n_u8(0xE0);
+    size_t i = 0;
+    for(; i + 17 <= len; i += 16) {
+        const uint8x16_t a = vld1q_u8(data + i);
+        const uint8x16_t b = vld1q_u8(data + i + 1);
+        const uint8x16_t hit = vandq_u8(vceqq_u8(a, vdupq_n_u8(0xFF)), vceqq_u8(vandq_u8(b, e0), e0));
+        const uint64x2_t wide = vreinterpretq_u64_u8(hit);
+        if(vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1)) return i + find_sync_scalar(data + i, 17);
+    }
+    return i + find_sync_scalar(data + i, len - i);
+}
+
+#endif //ZAPAUDIO_NEON
+
+sync_scan_kernels select_kernels() {
+    sync_scan_kernels kernels = { find_sync_scalar, "scalar" };
+    const cpu_features& features = get_cpu_features();
+    (void)features;
+
+#if defined(ZAPAUDIO_X86)
+    if(features.avx2) {
+        kernels = { find_sync_avx2, "avx2" };
+    } else if(features.sse2) {
+        kernels = { find_sync_sse2, "sse2" };
+    }
+#endif
+
+#if defined(ZAPAUDIO_NEON)
+    if(features.neon) kernels = { find_sync_neon, "neon" };
+#endif
+
+    return kernels;
+}
+
+}
+
+const sync_scan_kernels& get_sync_scan_kernels() {
+    static const sync_scan_kernels kernels = select_kernels();
+    return kernels;
+}
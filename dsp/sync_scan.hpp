@@ -0,0 +1,24 @@
+#ifndef ZAPAUDIO_SYNC_SCAN_HPP
+#define ZAPAUDIO_SYNC_SCAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "streams/audio_stream.hpp"
+
+/*
+ * Search for MPEG audio sync candidates: a 0xFF byte followed by a byte with its top three bits set (the 11 bit
+ * 0xFFE sync word).  Candidates still need their header validated.  Dispatched at runtime like sample_convert.
+ */
+
+struct ZAPAUDIO_EXPORT sync_scan_kernels {
+    // Offset of the first candidate in data[0, len), or len if there is none.  A candidate needs both of its bytes in
+    // range, so the last byte is only ever checked as the second byte.
+    size_t (*find_sync)(const uint8_t* data, size_t len);
+    const char* name;
+};
+
+ZAPAUDIO_EXPORT const sync_scan_kernels& get_sync_scan_kernels();
+
+inline size_t find_sync(const uint8_t* data, size_t len) { return get_sync_scan_kernels().find_sync(data, len); }
+
+#endif //ZAPAUDIO_SYNC_SCAN_HPP
@@ -0,0 +1,147 @@
+#include "log.hpp"
+#include <mutex>
+#include <thread>
+#include <iostream>
+
+// Slots in the ring, a power of two; 2048 records of 256 bytes is 512kB
+constexpr size_t log_ring_slots = 2048;
+
+// How long the formatter sleeps when the ring is empty.  Producers never signal it, that would cost a syscall.
+constexpr auto log_idle_wait = std::chrono::milliseconds(2);
+
+struct log_ring::state_t {
+    std::mutex mutex;               // Serialises consumers: the formatter, flush() and direct writes at shutdown
+    std::ostream* out;
+    std::thread formatter;
+    std::atomic<bool> shutdown;
+    size_t dequeue;
+    size_t reported_drops;
+    std::ostringstream line;
+
+    state_t() : out(&std::cerr), shutdown(false), dequeue(0), reported_drops(0) { }
+};
+
+// Stops the formatter at exit.  The ring itself is never destroyed, so destructors that run later can still log.
+struct log_shutdown {
+    log_ring* ring;
+
+    log_shutdown() : ring(new log_ring()) { }
+    ~log_shutdown() {
+        auto& s = *ring->state_;
+        s.shutdown.store(true, std::memory_order_release);
+#ifdef _WIN32
+        // Joining from a DLL's static destructors can deadlock on the loader lock
+        s.formatter.detach();
+#else
+        s.formatter.join();
+#endif
+        ring->direct_.store(true, std::memory_order_release);
+        ring->drain_direct();
+    }
+};
+
+void format_record(std::ostringstream& line, const log_record& record) {
+    switch(record.level) {
+        case log_level::debug: line << "debug: "; break;
+        case log_level::warning: line << "warning: "; break;
+        case log_level::error: line << "error: "; break;
+        default: break;
+    }
+
+    // Matches the old synchronous SM_LOG, every argument is followed by a space
+    const char* ptr = record.payload;
+    for(size_t i = 0; i != record.count; ++i) {
+        const auto type = log_arg(*ptr++);
+        switch(type) {
+            case log_arg::signed_int: { int64_t v; std::memcpy(&v, ptr, sizeof(v)); ptr += sizeof(v); line << v; break; }
+            case log_arg::unsigned_int: { uint64_t v; std::memcpy(&v, ptr, sizeof(v)); ptr += sizeof(v); line << v; break; }
+            case log_arg::floating: { double v; std::memcpy(&v, ptr, sizeof(v)); ptr += sizeof(v); line << v; break; }
+            case log_arg::boolean: line << int(*ptr++ != 0); break;
+            case log_arg::character: line << *ptr++; break;
+            case log_arg::string: {
+                uint16_t len;
+                std::memcpy(&len, ptr, sizeof(len));
+                line.write(ptr + sizeof(len), len);
+                ptr += sizeof(len) + len;
+                break;
+            }
+        }
+        line << ' ';
+    }
+    if(record.truncated) line << "...";
+    line << '\n';
+}
+
+log_ring::log_ring() : state_(new state_t()), slots_(new log_record[log_ring_slots]), mask_(log_ring_slots - 1),
+        enqueue_(0), dropped_(0), direct_(false) {
+    for(size_t i = 0; i != log_ring_slots; ++i) slots_[i].sequence.store(i, std::memory_order_relaxed);
+
+    state_->formatter = std::thread([this]() {
+        auto& s = *state_;
+        while(!s.shutdown.load(std::memory_order_acquire)) {
+            bool busy;
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                busy = drain();
+            }
+            if(!busy) std::this_thread::sleep_for(log_idle_wait);
+        }
+    });
+}
+
+log_ring& log_ring::instance() {
+    static log_shutdown shutdown;
+    return *shutdown.ring;
+}
+
+bool log_ring::drain() {
+    auto& s = *state_;
+    const size_t dropped = this->dropped();
+    bool any = false;
+    for(;;) {
+        log_record& record = slots_[s.dequeue & mask_];
+        if(record.sequence.load(std::memory_order_acquire) != s.dequeue + 1) break;
+
+        if(s.out) format_record(s.line, record);
+        record.sequence.store(s.dequeue + mask_ + 1, std::memory_order_release);
+        ++s.dequeue;
+        any = true;
+    }
+
+    if(dropped != s.reported_drops) {
+        if(s.out) s.line << "log: " << dropped - s.reported_drops << " records dropped, the ring was full\n";
+        s.reported_drops = dropped;
+        any = true;
+    }
+
+    if(any && s.out) {
+        const std::string text = s.line.str();
+        s.out->write(text.data(), std::streamsize(text.size()));
+        s.out->flush();
+    }
+    s.line.str(std::string());
+    return any;
+}
+
+void log_ring::drain_direct() {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    drain();
+}
+
+void log_ring::flush() {
+    const size_t target = enqueue_.load(std::memory_order_acquire);
+    for(;;) {
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            drain();
+            if(intptr_t(state_->dequeue - target) >= 0) return;
+        }
+        // A producer has claimed a slot but not yet committed it
+        std::this_thread::yield();
+    }
+}
+
+void log_ring::set_output(std::ostream* out) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->out = out;
+}
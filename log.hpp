@@ -5,20 +5,221 @@
 #ifndef SIMPLE_MP3_LOG_HPP
 #define SIMPLE_MP3_LOG_HPP
 
-#include <iostream>
+/*
+ * Asynchronous logging.  SM_LOG and friends encode their arguments into a fixed-size binary record in a bounded
+ * lock-free ring; a background thread formats the records and writes them out, so a call never allocates, formats or
+ * blocks.  When the ring is full the record is dropped and counted rather than waiting for the formatter, which makes
+ * the calls safe on the audio thread.
+ *
+ * Integers, floating point values, bools, chars and strings are stored by value, strings truncated to fit the record.
+ * Any other type is formatted with its operator<< at the call site, which allocates, so keep those off the audio path.
+ *
+ * Levels below ZAPAUDIO_LOG_LEVEL (0 debug, 1 info, 2 warning, 3 error, 4 off) compile to nothing.  SM_LOG logs at
+ * info, as it always has.
+ */
 
-template <typename T, typename... Args>
-void SM_LOG(T arg, Args... args);
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include "streams/audio_stream.hpp"
 
-template <typename... Args>
-void SM_LOG() {
-    std::cerr << std::endl;
-}
+#ifndef ZAPAUDIO_LOG_LEVEL
+#define ZAPAUDIO_LOG_LEVEL 1
+#endif
+
+enum class log_level : uint8_t {
+    debug,
+    info,
+    warning,
+    error
+};
+
+enum class log_arg : uint8_t {
+    signed_int,
+    unsigned_int,
+    floating,
+    boolean,
+    character,
+    string
+};
+
+constexpr size_t log_record_size = 256;
+
+struct log_record {
+    std::atomic<size_t> sequence;       // Slot state for the ring, see log_ring
+    log_level level;
+    uint8_t count;                      // Arguments encoded in the payload
+    uint16_t used;                      // Payload bytes in use
+    bool truncated;                     // Arguments were cut short or dropped to fit
+    char payload[log_record_size - sizeof(std::atomic<size_t>) - 5];
+};
+
+static_assert(sizeof(log_record) == log_record_size, "log_record should fill exactly one slot");
+
+/*
+ * A bounded multi-producer, single-consumer ring of log records.  Each slot carries a sequence number: producers claim
+ * a slot by advancing the enqueue position with a CAS when the slot's sequence says it is free, encode into it in
+ * place and publish by bumping the sequence.  The formatter thread consumes slots in order.
+ */
+class ZAPAUDIO_EXPORT log_ring {
+public:
+    static log_ring& instance();
+
+    log_record* acquire() {
+        size_t pos = enqueue_.load(std::memory_order_relaxed);
+        for(;;) {
+            log_record& slot = slots_[pos & mask_];
+            const auto diff = intptr_t(slot.sequence.load(std::memory_order_acquire)) - intptr_t(pos);
+            if(diff == 0) {
+                if(enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return &slot;
+            } else if(diff < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            } else {
+                pos = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void commit(log_record* record) {
+        record->sequence.store(record->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        if(direct_.load(std::memory_order_relaxed)) drain_direct();
+    }
+
+    // Blocks until every record committed before the call has been written out
+    void flush();
+    // Records are written to std::cerr by default; nullptr discards them.  The stream must outlive its use here.
+    void set_output(std::ostream* out);
+    size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+protected:
+    log_ring();
+    // Formats every committed record in order with the state mutex held, returns false if there were none
+    bool drain();
+    void drain_direct();
+
+private:
+    struct state_t;
+    state_t* state_;
+    log_record* slots_;
+    size_t mask_;
+    std::atomic<size_t> enqueue_;
+    std::atomic<size_t> dropped_;
+    std::atomic<bool> direct_;          // Set once the formatter has exited at shutdown, producers then write inline
+
+    friend struct log_shutdown;
+};
+
+class log_encoder {
+public:
+    explicit log_encoder(log_record* record) : record_(record), pos_(0) {
+        record_->count = 0;
+        record_->truncated = false;
+    }
+
+    ~log_encoder() { record_->used = uint16_t(pos_); }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value && !std::is_same<T, char>::value>::type
+    put(T value) { put_value(log_arg::signed_int, int64_t(value)); }
 
-template <typename T, typename... Args>
-void SM_LOG(T t, Args... args) {
-    std::cerr << t << " ";
-    SM_LOG(args...);
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value && !std::is_same<T, bool>::value>::type
+    put(T value) { put_value(log_arg::unsigned_int, uint64_t(value)); }
+
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+    put(T value) { put_value(log_arg::floating, double(value)); }
+
+    void put(bool value) { put_value(log_arg::boolean, uint8_t(value)); }
+    void put(char value) { put_value(log_arg::character, value); }
+    void put(const char* str) { put_string(str ? str : "(null)", str ? std::strlen(str) : 6); }
+    void put(char* str) { put(static_cast<const char*>(str)); }
+    void put(const std::string& str) { put_string(str.data(), str.size()); }
+
+    template <typename T>
+    typename std::enable_if<!std::is_arithmetic<T>::value &&
+                            !std::is_convertible<typename std::decay<T>::type, const char*>::value>::type
+    put(const T& value) {
+        std::ostringstream str;
+        str << value;
+        put(str.str());
+    }
+
+private:
+    template <typename T>
+    void put_value(log_arg type, T value) {
+        if(pos_ + 1 + sizeof(T) > sizeof(record_->payload)) {
+            record_->truncated = true;
+            return;
+        }
+        record_->payload[pos_] = char(type);
+        std::memcpy(record_->payload + pos_ + 1, &value, sizeof(T));
+        pos_ += 1 + sizeof(T);
+        ++record_->count;
+    }
+
+    void put_string(const char* str, size_t len) {
+        const size_t header = 1 + sizeof(uint16_t);
+        if(pos_ + header > sizeof(record_->payload)) {
+            record_->truncated = true;
+            return;
+        }
+        const size_t room = sizeof(record_->payload) - pos_ - header;
+        if(len > room) {
+            len = room;
+            record_->truncated = true;
+        }
+        const auto length = uint16_t(len);
+        record_->payload[pos_] = char(log_arg::string);
+        std::memcpy(record_->payload + pos_ + 1, &length, sizeof(length));
+        std::memcpy(record_->payload + pos_ + header, str, len);
+        pos_ += header + len;
+        ++record_->count;
+    }
+
+    log_record* record_;
+    size_t pos_;
 };
 
+template <log_level Level, typename... Args>
+inline void log_write(std::true_type, const Args&... args) {
+    auto& ring = log_ring::instance();
+    log_record* record = ring.acquire();
+    if(!record) return;
+
+    record->level = Level;
+    {
+        log_encoder encoder(record);
+        int expand[] = { 0, (encoder.put(args), 0)... };
+        (void)expand;
+    }
+    ring.commit(record);
+}
+
+template <log_level Level, typename... Args>
+inline void log_write(std::false_type, const Args&...) { }
+
+template <log_level Level, typename... Args>
+inline void log_at(const Args&... args) {
+    log_write<Level>(std::integral_constant<bool, (int(Level) >= ZAPAUDIO_LOG_LEVEL)>(), args...);
+}
+
+template <typename... Args>
+void SM_LOG(const Args&... args) { log_at<log_level::info>(args...); }
+
+template <typename... Args>
+void SM_DEBUG(const Args&... args) { log_at<log_level::debug>(args...); }
+
+template <typename... Args>
+void SM_WARN(const Args&... args) { log_at<log_level::warning>(args...); }
+
+template <typename... Args>
+void SM_ERROR(const Args&... args) { log_at<log_level::error>(args...); }
+
+inline void log_flush() { log_ring::instance().flush(); }
+
 #endif //SIMPLE_MP3_LOG_HPP
@@ -0,0 +1,137 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+
+watermark_snapshot metric_watermark::snapshot() const {
+    const auto relaxed = std::memory_order_relaxed;
+    watermark_snapshot snapshot;
+    snapshot.valid = valid_.load(std::memory_order_acquire) && !reset_.load(relaxed);
+    snapshot.low = low_.load(relaxed);
+    snapshot.high = high_.load(relaxed);
+    snapshot.last = last_.load(relaxed);
+    return snapshot;
+}
+
+uint64_t histogram_snapshot::percentile_ns(double quantile) const {
+    if(count == 0) return 0;
+    const uint64_t target = std::max(uint64_t(1), uint64_t(quantile*double(count) + .5));
+    uint64_t seen = 0;
+    for(size_t b = 0; b != histogram_buckets; ++b) {
+        seen += buckets[b];
+        if(seen >= target) return std::min(bucket_limit(b), max_ns);
+    }
+    return max_ns;
+}
+
+latency_histogram::latency_histogram() : count_(0), total_ns_(0), max_ns_(0) {
+    for(auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+}
+
+histogram_snapshot latency_histogram::snapshot() const {
+    const auto relaxed = std::memory_order_relaxed;
+    histogram_snapshot snapshot;
+    for(size_t b = 0; b != histogram_buckets; ++b) snapshot.buckets[b] = buckets_[b].load(relaxed);
+    snapshot.count = count_.load(relaxed);
+    snapshot.total_ns = total_ns_.load(relaxed);
+    snapshot.max_ns = max_ns_.load(relaxed);
+    return snapshot;
+}
+
+stage_metrics::stage_metrics(const std::string& name) : name_(name) {
+    metrics_registry::instance().add(this);
+}
+
+stage_metrics::~stage_metrics() {
+    metrics_registry::instance().remove(this);
+}
+
+stage_snapshot stage_metrics::snapshot() const {
+    stage_snapshot snapshot;
+    snapshot.name = name_;
+    snapshot.reads = reads.get();
+    snapshot.samples_requested = samples_requested.get();
+    snapshot.samples_produced = samples_produced.get();
+    snapshot.short_reads = short_reads.get();
+    snapshot.underflows = underflows.get();
+    snapshot.occupancy = occupancy.snapshot();
+    snapshot.work = work.snapshot();
+    snapshot.budget_ns = budget_ns.get();
+    snapshot.over_budget = over_budget.get();
+    return snapshot;
+}
+
+struct metrics_registry::state_t {
+    mutable std::mutex mutex;
+    std::vector<stage_metrics*> stages;
+};
+
+metrics_registry& metrics_registry::instance() {
+    static metrics_registry registry;
+    return registry;
+}
+
+metrics_registry::state_t& metrics_registry::state() const {
+    static state_t state;
+    return state;
+}
+
+std::vector<stage_snapshot> metrics_registry::snapshot_all() const {
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    std::vector<stage_snapshot> snapshots;
+    snapshots.reserve(s.stages.size());
+    for(auto stage : s.stages) snapshots.push_back(stage->snapshot());
+    return snapshots;
+}
+
+void metrics_registry::reset_watermarks() {
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for(auto stage : s.stages) stage->occupancy.request_reset();
+}
+
+void metrics_registry::add(stage_metrics* stage) {
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto in_use = [&s](const std::string& name) {
+        return std::any_of(s.stages.begin(), s.stages.end(), [&name](const stage_metrics* m) { return m->name_ == name; });
+    };
+
+    const std::string base = stage->name_;
+    for(size_t n = 2; in_use(stage->name_); ++n) stage->name_ = base + "#" + std::to_string(n);
+    s.stages.push_back(stage);
+}
+
+void metrics_registry::remove(stage_metrics* stage) {
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.stages.erase(std::remove(s.stages.begin(), s.stages.end(), stage), s.stages.end());
+}
+
+std::string format_snapshot(const stage_snapshot& snapshot) {
+    char line[512];
+    std::snprintf(line, sizeof(line), "%s: reads %llu, samples %llu/%llu, short %llu, underflows %llu",
+                  snapshot.name.c_str(), (unsigned long long)snapshot.reads,
+                  (unsigned long long)snapshot.samples_produced, (unsigned long long)snapshot.samples_requested,
+                  (unsigned long long)snapshot.short_reads, (unsigned long long)snapshot.underflows);
+
+    std::string result(line);
+    if(snapshot.occupancy.valid) {
+        std::snprintf(line, sizeof(line), ", occupancy %llu..%llu", (unsigned long long)snapshot.occupancy.low,
+                      (unsigned long long)snapshot.occupancy.high);
+        result += line;
+    }
+    if(snapshot.work.count != 0) {
+        std::snprintf(line, sizeof(line), ", work mean %.1fus p99 %.1fus max %.1fus", snapshot.work.mean_ns()/1e3,
+                      snapshot.work.percentile_ns(.99)/1e3, snapshot.work.max_ns/1e3);
+        result += line;
+    }
+    if(snapshot.budget_ns != 0) {
+        std::snprintf(line, sizeof(line), ", budget %.1fus over %llu", snapshot.budget_ns/1e3,
+                      (unsigned long long)snapshot.over_budget);
+        result += line;
+    }
+    return result;
+}
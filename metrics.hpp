@@ -0,0 +1,214 @@
+#ifndef ZAPAUDIO_METRICS_HPP
+#define ZAPAUDIO_METRICS_HPP
+
+/*
+ * Runtime counters and latency histograms for the stages of a stream graph.
+ *
+ * Every metric has exactly one writer, the thread that runs the stage, so updates are relaxed loads and stores with
+ * no read-modify-write and no fences on the audio thread.  Any other thread may take a snapshot at any time; it sees
+ * each value torn-free but the values are not a consistent cut across metrics.  Watermarks are reset by the reader
+ * raising a flag that the writer acts on at its next update, so polling never writes to a value the audio thread owns.
+ *
+ * stage_metrics objects register themselves with the process-wide metrics_registry under a mutex that only
+ * construction, destruction and snapshot_all() take.
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "streams/audio_stream.hpp"
+
+class ZAPAUDIO_EXPORT metric_counter {
+public:
+    metric_counter() : value_(0) { }
+
+    void add(uint64_t n=1) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_;
+};
+
+class ZAPAUDIO_EXPORT metric_gauge {
+public:
+    metric_gauge() : value_(0) { }
+
+    void set(uint64_t value) { value_.store(value, std::memory_order_relaxed); }
+    uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_;
+};
+
+struct watermark_snapshot {
+    uint64_t low;
+    uint64_t high;
+    uint64_t last;
+    bool valid;             // False until the writer has recorded a level since the last reset
+};
+
+// Low and high watermarks of a level, typically ring occupancy in samples
+class ZAPAUDIO_EXPORT metric_watermark {
+public:
+    metric_watermark() : low_(0), high_(0), last_(0), valid_(false), reset_(false) { }
+
+    void record(uint64_t level) {
+        const auto relaxed = std::memory_order_relaxed;
+        if(!valid_.load(relaxed) || (reset_.load(relaxed) && reset_.exchange(false, std::memory_order_acquire))) {
+            low_.store(level, relaxed);
+            high_.store(level, relaxed);
+            valid_.store(true, std::memory_order_release);
+        } else {
+            if(level < low_.load(relaxed)) low_.store(level, relaxed);
+            if(level > high_.load(relaxed)) high_.store(level, relaxed);
+        }
+        last_.store(level, relaxed);
+    }
+
+    watermark_snapshot snapshot() const;
+    // Asks the writer to restart both watermarks from its next recorded level
+    void request_reset() { reset_.store(true, std::memory_order_release); }
+
+private:
+    std::atomic<uint64_t> low_;
+    std::atomic<uint64_t> high_;
+    std::atomic<uint64_t> last_;
+    std::atomic<bool> valid_;
+    std::atomic<bool> reset_;
+};
+
+using metrics_clock = std::chrono::steady_clock;
+
+inline uint64_t elapsed_ns(metrics_clock::time_point start) {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(metrics_clock::now() - start).count());
+}
+
+constexpr size_t histogram_buckets = 32;
+
+struct histogram_snapshot {
+    std::array<uint64_t, histogram_buckets> buckets;
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+
+    uint64_t mean_ns() const { return count ? total_ns/count : 0; }
+    // Upper bound of the bucket holding the given quantile (0..1), so estimates are at most a factor two high
+    uint64_t percentile_ns(double quantile) const;
+    // Upper bound in nanoseconds of the durations counted in bucket b
+    static uint64_t bucket_limit(size_t b) { return b + 1 < histogram_buckets ? (uint64_t(1) << b) : UINT64_MAX; }
+};
+
+// Durations in power-of-two nanosecond buckets: bucket b counts durations of at most 2^b ns, the last bucket the rest
+class ZAPAUDIO_EXPORT latency_histogram {
+public:
+    latency_histogram();
+
+    void record(uint64_t ns) {
+        const auto relaxed = std::memory_order_relaxed;
+        auto& bucket = buckets_[bucket_of(ns)];
+        bucket.store(bucket.load(relaxed) + 1, relaxed);
+        count_.store(count_.load(relaxed) + 1, relaxed);
+        total_ns_.store(total_ns_.load(relaxed) + ns, relaxed);
+        if(ns > max_ns_.load(relaxed)) max_ns_.store(ns, relaxed);
+    }
+
+    histogram_snapshot snapshot() const;
+
+    static size_t bucket_of(uint64_t ns) {
+        size_t b = 0;
+        while(b + 1 < histogram_buckets && (uint64_t(1) << b) < ns) ++b;
+        return b;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, histogram_buckets> buckets_;
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> total_ns_;
+    std::atomic<uint64_t> max_ns_;
+};
+
+struct stage_snapshot {
+    std::string name;
+    uint64_t reads;
+    uint64_t samples_requested;
+    uint64_t samples_produced;
+    uint64_t short_reads;           // Reads that returned fewer samples than requested
+    uint64_t underflows;            // Reads that had to be padded with silence or returned nothing
+    watermark_snapshot occupancy;   // Samples held by the stage's buffer
+    histogram_snapshot work;        // Refill, fill or callback execution time
+    uint64_t budget_ns;             // Time available to each unit of work, the buffer period for callbacks
+    uint64_t over_budget;           // Units of work that took longer than budget_ns
+};
+
+/*
+ * The metrics of one stage.  Each group has a single writer: the read counters and occupancy belong to the thread
+ * calling the stage's read(), the work histogram to whichever thread does the refill.
+ */
+class ZAPAUDIO_EXPORT stage_metrics {
+public:
+    // Names are made unique among live stages by appending "#n"
+    explicit stage_metrics(const std::string& name);
+    ~stage_metrics();
+
+    stage_metrics(const stage_metrics&) = delete;
+    stage_metrics& operator=(const stage_metrics&) = delete;
+
+    void record_read(size_t requested, size_t produced) {
+        reads.add();
+        samples_requested.add(requested);
+        samples_produced.add(produced);
+        if(produced < requested) short_reads.add();
+    }
+
+    // For stages that time work against a deadline: records the duration and counts overruns of budget_ns
+    void record_work(uint64_t ns) {
+        work.record(ns);
+        const uint64_t budget = budget_ns.get();
+        if(budget != 0 && ns > budget) over_budget.add();
+    }
+
+    const std::string& name() const { return name_; }
+    stage_snapshot snapshot() const;
+
+    metric_counter reads;
+    metric_counter samples_requested;
+    metric_counter samples_produced;
+    metric_counter short_reads;
+    metric_counter underflows;
+    metric_watermark occupancy;
+    latency_histogram work;
+    metric_gauge budget_ns;
+    metric_counter over_budget;
+
+private:
+    friend class metrics_registry;
+    std::string name_;
+};
+
+class ZAPAUDIO_EXPORT metrics_registry {
+public:
+    static metrics_registry& instance();
+
+    // Snapshots every live stage in registration order; never blocks the threads writing the metrics
+    std::vector<stage_snapshot> snapshot_all() const;
+    // Restarts the occupancy watermarks of every stage, so the next poll reports levels since this one
+    void reset_watermarks();
+
+protected:
+    friend class stage_metrics;
+    void add(stage_metrics* stage);
+    void remove(stage_metrics* stage);
+
+private:
+    metrics_registry() = default;
+    struct state_t;
+    state_t& state() const;
+};
+
+// One line per stage, for logging from a monitoring thread
+ZAPAUDIO_EXPORT std::string format_snapshot(const stage_snapshot& snapshot);
+
+#endif //ZAPAUDIO_METRICS_HPP
@@ -1,28 +1,32 @@
-#include "streams/mp3_stream.hpp"
+#include "streams/playlist_stream.hpp"
 #include "audio_output.hpp"
 #include "streams/buffered_stream.hpp"
-#include "streams/adapter_stream.hpp"
+#include "log.hpp"
 
 //const char* const def_filename = "/Users/otgaard/test/another.mp3";
 const char* const def_filename = "/Users/otgaard/Ibiza/des cha cha - live mix.mp3";
 
 int main(int argc, char* argv[]) {
-    // Create an MP3 tools stream
-    auto file_stream = std::make_unique<mp3_stream>(argc > 1 ? argv[1] : def_filename, 1024, nullptr);
-    file_stream->start();
-
-    // We have to hook up an adapter if we want to play a signed short sample producer in a floating point audio_output.
-    auto adapter = std::make_unique<adapter_stream<float, short>>(file_stream.get());
+    // Every file on the command line is queued on one playlist so the tracks play back to back without gaps.  The
+    // device runs at a fixed rate and the playlist resamples 32 and 48kHz files to it.  The tracks decode straight to
+    // float for the float device, without a conversion stage.
+    const size_t kDEVICE_RATE = 44100;
+    auto playlist = std::make_unique<playlist_stream<float>>(kDEVICE_RATE);
+    if(argc > 1) {
+        for(int i = 1; i != argc; ++i) playlist->enqueue(argv[i]);
+    } else {
+        playlist->enqueue(def_filename);
+    }
 
     // Connect the MP3 tools to a buffered stream because the MP3 tools must do I/O.
     const size_t kBUFFER_SIZE = 64*1024;            // The size of the whole buffer
     const size_t kREFILL_SIZE = kBUFFER_SIZE/2;     // The size at which we should refill the buffer
-    const size_t kSCAN_MS = 60;                     // The milliseconds between refill scans
-    auto buf_stream = std::make_unique<buffered_stream<float>>(kBUFFER_SIZE, kREFILL_SIZE, kSCAN_MS, adapter.get());
+    const size_t kSCAN_MS = 60;                     // Unused, the refill thread is always woken by the reader
+    auto buf_stream = std::make_unique<buffered_stream<float>>(kBUFFER_SIZE, kREFILL_SIZE, kSCAN_MS, playlist.get());
     buf_stream->start();
 
     // Use the buffered stream as the source for the audio device and play.
-    audio_output<float> audio_dev(buf_stream.get());
+    audio_output<float> audio_dev(buf_stream.get(), 2, kDEVICE_RATE);
     audio_dev.play();
 
     while(audio_dev.is_playing() || audio_dev.is_paused()) {
@@ -32,5 +36,8 @@ int main(int argc, char* argv[]) {
 
     audio_dev.stop();
 
+    // Where any dropouts came from: the device callback, the buffered ring or the decoder's I/O
+    for(const auto& stage : metrics_registry::instance().snapshot_all()) SM_LOG(format_snapshot(stage));
+
     return 0;
 }
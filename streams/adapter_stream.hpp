@@ -7,35 +7,59 @@
 
 #include <limits>
 #include "audio_stream.hpp"
+#include "dsp/sample_convert.hpp"
 
 template <typename OutSampleT, typename InSampleT> OutSampleT sample_convert(InSampleT sample);
 
 template <>
-float sample_convert<float, short>(short sample) {
+inline float sample_convert<float, short>(short sample) {
     static const float inv = 1.f/std::numeric_limits<short>::max();
     return sample * inv;
 }
 
+template <>
+inline short sample_convert<short, float>(float sample) {
+    short out;
+    convert_f32_s16(&sample, &out, 1);
+    return out;
+}
+
+// Block conversion through the vectorised kernels
+template <typename OutSampleT, typename InSampleT> void convert_block(const InSampleT* in, OutSampleT* out, size_t len);
+
+template <>
+inline void convert_block<float, short>(const short* in, float* out, size_t len) { convert_s16_f32(in, out, len); }
+
+template <>
+inline void convert_block<short, float>(const float* in, short* out, size_t len) { convert_f32_s16(in, out, len); }
+
+template <>
+inline void convert_block<float, int32_t>(const int32_t* in, float* out, size_t len) { convert_s32_f32(in, out, len); }
+
 template <typename OutSampleT, typename InSampleT>
 class adapter_stream : public audio_stream<OutSampleT> {
 public:
     using in_stream_t = audio_stream<InSampleT>;
     using out_stream_t = audio_stream<OutSampleT>;
     using buffer_t = typename audio_stream<OutSampleT>::buffer_t;
+    using audio_stream<OutSampleT>::read;
+    using audio_stream<OutSampleT>::write;
 
     adapter_stream(audio_stream<InSampleT>* in_stream) : in_stream_(in_stream) { }
 
-    virtual size_t read(buffer_t& buffer, size_t len) override {
-        if(in_buffer_.size() != len) in_buffer_.resize(len);
-        auto ret = in_stream_->read(in_buffer_, len);
-        for(int i = 0; i != ret; ++i) buffer[i] = sample_convert<float>(in_buffer_[i]);
+    virtual size_t read(OutSampleT* buffer, size_t len) override {
+        if(in_buffer_.size() < len) in_buffer_.resize(len);     // Only grows, reads of varying length reuse it
+        auto ret = in_stream_->read(in_buffer_.data(), len);
+        convert_block(in_buffer_.data(), buffer, ret);
         return ret;
     }
 
-    virtual size_t write(const buffer_t& buffer, size_t len) override {
+    virtual size_t write(const OutSampleT* buffer, size_t len) override {
         return 0;
     }
 
+    virtual bool is_finished() const override { return in_stream_->is_finished(); }
+
 private:
     typename in_stream_t::buffer_t in_buffer_;
     audio_stream<InSampleT>* in_stream_;
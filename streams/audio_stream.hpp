@@ -22,11 +22,19 @@ public:
     audio_stream(audio_stream<SampleT>* parent=nullptr) : parent_(parent) { }
     virtual ~audio_stream() = default;
 
-    virtual size_t read(buffer_t& buffer, size_t len) = 0;
-    virtual size_t write(const buffer_t& buffer, size_t len) = 0;
+    // Streams implement the pointer interface so each stage can produce straight into its consumer's memory
+    virtual size_t read(sample_t* buffer, size_t len) = 0;
+    virtual size_t write(const sample_t* buffer, size_t len) = 0;
+
+    virtual size_t read(buffer_t& buffer, size_t len) { return read(buffer.data(), len); }
+    virtual size_t write(const buffer_t& buffer, size_t len) { return write(buffer.data(), len); }
 
     virtual sample_t read() { return 0; }
 
+    // Whether a read that returned nothing means the stream has ended rather than run dry for now.  Streams that can
+    // underrun and recover, such as buffered_stream, override it so a consumer does not end the stream early.
+    virtual bool is_finished() const { return true; }
+
 protected:
     audio_stream<SampleT>* parent() const { return parent_; }
 
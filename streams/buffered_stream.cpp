@@ -5,7 +5,8 @@
 template <typename SampleT>
 buffered_stream<SampleT>::buffered_stream(size_t buffer_size, size_t refill, size_t scan_freq,
     audio_stream<SampleT>* parent) : audio_stream<SampleT>(parent), buffer_(buffer_size), refill_(refill),
-                                     scan_freq_(scan_freq), shutdown_(true) {
+                                     shutdown_(true), refill_requested_(false), source_finished_(false),
+                                     metrics_("buffered_stream") {
 }
 
 template <typename SampleT>
@@ -13,7 +14,11 @@ buffered_stream<SampleT>::~buffered_stream() {
     SM_LOG("Shutting down buffered stream");
     if(shutdown_ == true) return;   // The stream is already closed
 
-    shutdown_ = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutdown_ = true;
+    }
+    refill_cv_.notify_one();
     scan_thread_.join();
 }
 
@@ -25,12 +30,35 @@ bool buffered_stream<SampleT>::start() {
 }
 
 template <typename SampleT>
-size_t buffered_stream<SampleT>::read(buffer_t& buffer, size_t len) {
-    return buffer_.read(buffer.data(), len);
+size_t buffered_stream<SampleT>::read(SampleT* buffer, size_t len) {
+    const size_t level = size_t(buffer_.size());
+    auto ret = buffer_.read(buffer, len);
+
+    metrics_.record_read(len, ret);
+    metrics_.occupancy.record(level);
+    metrics_.occupancy.record(level - ret);
+    if(ret == 0 && len != 0) metrics_.underflows.add();
+
+    // Wake the producer once per drop below the watermark.  The flag is set under the mutex so the request cannot
+    // land between the producer testing it and going to sleep.
+    if(size_t(buffer_.size()) < refill_ && !refill_requested_.load(std::memory_order_acquire)) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            refill_requested_.store(true, std::memory_order_release);
+        }
+        refill_cv_.notify_one();
+    }
+    return ret;
+}
+
+template <typename SampleT>
+bool buffered_stream<SampleT>::is_finished() const {
+    // The flag is set after the last commit, so once it is seen the ring holds everything the parent produced
+    return source_finished_.load(std::memory_order_acquire) && buffer_.size() == 0;
 }
 
 template <typename SampleT>
-size_t buffered_stream<SampleT>::write(const buffer_t& buffer, size_t len) {
+size_t buffered_stream<SampleT>::write(const SampleT* buffer, size_t len) {
     return 0;
 }
 
@@ -45,21 +73,32 @@ void buffered_stream<SampleT>::scan_thread(buffered_stream* ptr) {
         return;
     }
 
-    size_t cache_cur = 0;
-    typename audio_stream<SampleT>::buffer_t cache(ptr->refill_);
-    const auto scan_ms = std::chrono::milliseconds(ptr->scan_freq_);
-
     while(!ptr->shutdown_) {
-        if(cache_cur == 0) {
-            // Refill the cache
-            cache_cur = parent_ptr->read(cache, ptr->refill_);
-        }
+        // Top the ring up to capacity, the parent reads straight into the free region of the ring
+        // Only passes that moved samples are timed, idle wake-ups would swamp the histogram
+        const auto start = metrics_clock::now();
+        bool filled = false;
+        while(!ptr->shutdown_) {
+            auto span = ptr->buffer_.prepare_write(ptr->refill_);
+            if(span.empty()) break;
 
-        if(ptr->buffer_.size() < ptr->refill_) {
-            if(ptr->buffer_.write(cache.data(), cache_cur)) cache_cur = 0;
+            size_t len = parent_ptr->read(span.first, span.first_size);
+            if(len == span.first_size && span.second_size != 0) len += parent_ptr->read(span.second, span.second_size);
+            if(len == 0) {
+                ptr->source_finished_.store(parent_ptr->is_finished(), std::memory_order_release);
+                break;
+            }
+            ptr->source_finished_.store(false, std::memory_order_relaxed);
+            ptr->buffer_.commit_write(len);
+            filled = true;
         }
+        if(filled) ptr->metrics_.record_work(elapsed_ns(start));
 
-        std::this_thread::sleep_for(scan_ms);
+        std::unique_lock<std::mutex> lock(ptr->mutex_);
+        ptr->refill_cv_.wait(lock, [ptr]() {
+            return ptr->shutdown_ || ptr->refill_requested_.load(std::memory_order_acquire);
+        });
+        ptr->refill_requested_.store(false, std::memory_order_release);
     }
 }
 
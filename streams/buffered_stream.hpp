@@ -4,27 +4,42 @@
 
 /*
  * Creates a buffered stream to avoid blocking on I/O or long-running processes.
+ *
+ * The producer thread sleeps until the reader sees the ring drop below the refill watermark, then tops the ring up to
+ * capacity.  It waits without a timeout, so an idle stream costs no wake-ups.  The reader takes the mutex only on the
+ * read that crosses the watermark, to set the request flag, and the producer holds it only to test that flag, so the
+ * audio side never waits behind a refill.
  */
 
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include "audio_stream.hpp"
 #include "buffers/ring_buffer.hpp"
+#include "metrics.hpp"
 
 template <typename SampleT>
 class ZAPAUDIO_EXPORT buffered_stream : public audio_stream<SampleT> {
 public:
     using stream_t = audio_stream<SampleT>;
     using buffer_t = typename stream_t::buffer_t;
+    using stream_t::read;
+    using stream_t::write;
 
+    // refill is the low watermark in samples.  scan_freq is no longer used, the producer is always signalled.
     buffered_stream(size_t buffer_size, size_t refill, size_t scan_freq, audio_stream<SampleT>* parent);
     virtual ~buffered_stream();
 
     bool start();
 
-    virtual size_t read(buffer_t& buffer, size_t len) override final;
-    virtual size_t write(const buffer_t& buffer, size_t len) override final;
+    virtual size_t read(SampleT* buffer, size_t len) override final;
+    virtual size_t write(const SampleT* buffer, size_t len) override final;
+    // True once the parent has finished and the ring is drained, an empty ring is otherwise an underrun
+    virtual bool is_finished() const override;
+
+    // Read counters and ring occupancy are written by the reader, the refill timings by the producer thread
+    const stage_metrics& get_metrics() const { return metrics_; }
 
 protected:
     static void scan_thread(buffered_stream* ptr);
@@ -32,9 +47,13 @@ protected:
 private:
     ring_buffer<SampleT, int> buffer_;
     size_t refill_;
-    size_t scan_freq_;
     std::thread scan_thread_;
     std::atomic<bool> shutdown_;
+    std::atomic<bool> refill_requested_;
+    std::atomic<bool> source_finished_;
+    std::mutex mutex_;
+    std::condition_variable refill_cv_;
+    stage_metrics metrics_;
 };
 
 #endif //ZAPAUDIO_BUFFERED_STREAM_HPP
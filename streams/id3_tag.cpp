@@ -0,0 +1,341 @@
+#include "id3_tag.hpp"
+#include <cstdlib>
+#include <algorithm>
+
+namespace {
+
+const char* const id3v1_genres[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop", "Jazz", "Metal", "New Age",
+    "Oldies", "Other", "Pop", "R&B", "Rap", "Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska",
+    "Death Metal", "Pranks", "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion",
+    "Trance", "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise", "AlternRock",
+    "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock", "Ethnic", "Gothic",
+    "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream", "Southern Rock", "Comedy", "Cult",
+    "Gangsta", "Top 40", "Christian Rap", "Pop/Funk", "Jungle", "Native American", "Cabaret", "New Wave",
+    "Psychadelic", "Rave", "Showtunes", "Trailer", "Lo-Fi", "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro",
+    "Musical", "Rock & Roll", "Hard Rock",
+    // Winamp extensions
+    "Folk", "Folk-Rock", "National Folk", "Swing", "Fast Fusion", "Bebob", "Latin", "Revival", "Celtic", "Bluegrass",
+    "Avantgarde", "Gothic Rock", "Progressive Rock", "Psychedelic Rock", "Symphonic Rock", "Slow Rock", "Big Band",
+    "Chorus", "Easy Listening", "Acoustic", "Humour", "Speech", "Chanson", "Opera", "Chamber Music", "Sonata",
+    "Symphony", "Booty Bass", "Primus", "Porn Groove", "Satire", "Slow Jam", "Club", "Tango", "Samba", "Folklore",
+    "Ballad", "Power Ballad", "Rhythmic Soul", "Freestyle", "Duet", "Punk Rock", "Drum Solo", "A capella", "Euro-House",
+    "Dance Hall"
+};
+
+const size_t id3v1_genre_count = sizeof(id3v1_genres) / sizeof(id3v1_genres[0]);
+
+size_t syncsafe32(const byte* p) {
+    return (size_t(p[0] & 0x7F) << 21) | (size_t(p[1] & 0x7F) << 14) | (size_t(p[2] & 0x7F) << 7) | size_t(p[3] & 0x7F);
+}
+
+size_t be32(const byte* p) {
+    return (size_t(p[0]) << 24) | (size_t(p[1]) << 16) | (size_t(p[2]) << 8) | size_t(p[3]);
+}
+
+// Walks the stored bytes of a tag.  With unsynchronisation every 0xFF is followed by a stuffed 0x00 that is not part
+// of the data, so counts are in data bytes while the cursor moves over stored bytes.
+struct tag_cursor {
+    const byte* pos;
+    const byte* end;
+    bool unsync;
+
+    // Advances over n data bytes, copying them to out if it is not null
+    bool read(size_t n, byte* out=nullptr) {
+        if(!unsync) {
+            if(size_t(end - pos) < n) return false;
+            if(out) memcpy(out, pos, n);
+            pos += n;
+            return true;
+        }
+        for(size_t i = 0; i != n; ++i) {
+            if(pos == end) return false;
+            const byte value = *pos++;
+            if(out) out[i] = value;
+            if(value == 0xFF && pos != end && *pos == 0x00) ++pos;
+        }
+        return true;
+    }
+};
+
+// The end of a string starting at ptr, the terminator is two aligned bytes for UTF-16.  A 0x00 stuffed after 0xFF by
+// unsynchronisation is not a terminator.
+const byte* find_terminator(const byte* ptr, const byte* end, bool wide, bool unsync) {
+    if(wide) {
+        for(const byte* p = ptr; p + 1 < end; p += 2) if(p[0] == 0 && p[1] == 0) return p;
+        return end;
+    }
+    for(const byte* p = ptr; p != end; ++p) {
+        if(*p == 0 && !(unsync && p != ptr && p[-1] == 0xFF)) return p;
+    }
+    return end;
+}
+
+id3_text make_text(const byte* ptr, const byte* end, id3_encoding encoding, bool unsync) {
+    id3_text text = { ptr, size_t(end - ptr), encoding, unsync };
+    return text;
+}
+
+bool is_wide(id3_encoding encoding) {
+    return encoding == id3_encoding::utf16 || encoding == id3_encoding::utf16be;
+}
+
+// Points field at a text frame's string
+void parse_text_frame(const byte* body, size_t size, bool unsync, id3_text& field) {
+    if(size < 2 || body[0] > 3 || !field.empty()) return;
+    field = make_text(body + 1, body + size, id3_encoding(body[0]), unsync);
+}
+
+// APIC in ID3v2.3+: encoding, MIME type, picture type, description, data.  PIC in ID3v2.2 has a 3 character image
+// format in place of the MIME type.
+void parse_picture_frame(const byte* base, const byte* body, size_t size, bool unsync, int version,
+                         id3_picture& picture) {
+    const byte* end = body + size;
+    if(size < 4 || body[0] > 3) return;
+    const auto encoding = id3_encoding(body[0]);
+
+    const byte* pos = body + 1;
+    id3_text mime;
+    if(version == 2) {
+        if(end - pos < 4) return;
+        mime = make_text(pos, pos + 3, id3_encoding::latin1, unsync);
+        pos += 3;
+    } else {
+        const byte* term = find_terminator(pos, end, false, unsync);
+        if(term == end) return;
+        mime = make_text(pos, term, id3_encoding::latin1, unsync);
+        pos = term + 1;
+    }
+
+    if(pos == end) return;
+    const byte type = *pos++;
+
+    const bool wide = is_wide(encoding);
+    const byte* term = find_terminator(pos, end, wide, unsync);
+    if(term == end) return;
+    pos = term + (wide ? 2 : 1);
+    if(pos >= end) return;
+
+    // Keep the first front cover, or the first picture until one turns up
+    if(!picture.empty() && (picture.type == 3 || type != 3)) return;
+    picture.offset = uint64_t(pos - base);
+    picture.size = size_t(end - pos);
+    picture.mime = mime;
+    picture.type = type;
+    picture.unsynchronised = unsync;
+}
+
+bool frame_is(const byte* id, const char* v2, const char* v34, int version) {
+    return version == 2 ? memcmp(id, v2, 3) == 0 : memcmp(id, v34, 4) == 0;
+}
+
+bool parse_id3v2(const byte* data, size_t len, id3_tags& tags) {
+    const size_t tag_bytes = id3v2_length(data, len);
+    if(tag_bytes == 0 || tag_bytes > len) return false;
+
+    const int version = data[3];
+    const byte flags = data[5];
+    if(version < 2 || version > 4) return false;
+    if(version == 2 && (flags & 0x40)) return false;        // ID3v2.2 compression was never defined
+
+    tag_cursor cursor = { data + 10, data + 10 + syncsafe32(data + 6), version < 4 && (flags & 0x80) != 0 };
+
+    // The extended header's size excludes its own size field in ID3v2.3 and includes it in ID3v2.4
+    if(version > 2 && (flags & 0x40)) {
+        byte size[4];
+        if(!cursor.read(4, size)) return false;
+        if(!cursor.read(version == 3 ? be32(size) : syncsafe32(size) - 4)) return false;
+    }
+
+    tags.version = version;
+    const size_t header_bytes = version == 2 ? 6 : 10;
+    byte header[10];
+    while(cursor.read(header_bytes, header)) {
+        if(header[0] == 0) break;           // Padding
+
+        size_t size;
+        byte format = 0;
+        if(version == 2) {
+            size = (size_t(header[3]) << 16) | (size_t(header[4]) << 8) | size_t(header[5]);
+        } else if(version == 3) {
+            size = be32(header + 4);
+            format = header[9];
+        } else {
+            // Some writers put plain 32 bit sizes in ID3v2.4 tags, which is detectable when a high bit is set
+            size = (header[4] | header[5] | header[6] | header[7]) & 0x80 ? be32(header + 4) : syncsafe32(header + 4);
+            format = header[9];
+        }
+
+        const byte* body = cursor.pos;
+        if(!cursor.read(size)) break;
+        size_t stored = size_t(cursor.pos - body);
+        bool unsync = cursor.unsync;
+
+        if(version == 3) {
+            if(format & 0xC0) continue;                     // Compressed or encrypted
+            if(format & 0x20) { ++body; --stored; }         // Group identifier
+        } else if(version == 4) {
+            if(format & 0x0C) continue;
+            if(format & 0x40) { ++body; --stored; }
+            if(format & 0x01) {                             // Data length indicator
+                if(stored < 4) continue;
+                body += 4;
+                stored -= 4;
+            }
+            unsync = unsync || (format & 0x02) != 0;
+        }
+        if(stored == 0 || stored > size_t(cursor.end - body)) continue;
+
+        if(frame_is(header, "TT2", "TIT2", version)) parse_text_frame(body, stored, unsync, tags.title);
+        else if(frame_is(header, "TP1", "TPE1", version)) parse_text_frame(body, stored, unsync, tags.artist);
+        else if(frame_is(header, "TAL", "TALB", version)) parse_text_frame(body, stored, unsync, tags.album);
+        else if(frame_is(header, "TP2", "TPE2", version)) parse_text_frame(body, stored, unsync, tags.album_artist);
+        else if(frame_is(header, "TCO", "TCON", version)) parse_text_frame(body, stored, unsync, tags.genre);
+        else if(frame_is(header, "TRK", "TRCK", version)) parse_text_frame(body, stored, unsync, tags.track);
+        else if(frame_is(header, "TPA", "TPOS", version)) parse_text_frame(body, stored, unsync, tags.disc);
+        else if(frame_is(header, "TYE", "TYER", version) || (version == 4 && memcmp(header, "TDRC", 4) == 0)) {
+            parse_text_frame(body, stored, unsync, tags.year);
+        } else if(frame_is(header, "PIC", "APIC", version)) {
+            parse_picture_frame(data, body, stored, unsync, version, tags.picture);
+        }
+    }
+    return true;
+}
+
+// ID3v1 is 128 bytes at the end of the file of fixed width Latin-1 fields.  ID3v1.1 puts the track number in the last
+// two bytes of the comment.
+bool parse_id3v1(const byte* data, size_t len, id3_tags& tags) {
+    if(len < 128 || memcmp(data + len - 128, "TAG", 3) != 0) return false;
+    const byte* tag = data + len - 128;
+
+    auto fill = [](id3_text& field, const byte* ptr, size_t size) {
+        if(field.empty()) field = make_text(ptr, ptr + size, id3_encoding::latin1, false);
+    };
+    fill(tags.title, tag + 3, 30);
+    fill(tags.artist, tag + 33, 30);
+    fill(tags.album, tag + 63, 30);
+    fill(tags.year, tag + 93, 4);
+    if(tag[125] == 0) tags.v1_track = tag[126];
+    tags.genre_index = tag[127];
+    if(tags.version == 0) tags.version = 1;
+    return true;
+}
+
+void append_utf8(std::string& out, uint32_t cp) {
+    if(cp < 0x80) {
+        out += char(cp);
+    } else if(cp < 0x800) {
+        out += char(0xC0 | (cp >> 6));
+        out += char(0x80 | (cp & 0x3F));
+    } else if(cp < 0x10000) {
+        out += char(0xE0 | (cp >> 12));
+        out += char(0x80 | ((cp >> 6) & 0x3F));
+        out += char(0x80 | (cp & 0x3F));
+    } else {
+        out += char(0xF0 | (cp >> 18));
+        out += char(0x80 | ((cp >> 12) & 0x3F));
+        out += char(0x80 | ((cp >> 6) & 0x3F));
+        out += char(0x80 | (cp & 0x3F));
+    }
+}
+
+}
+
+bool parse_id3(const byte* data, size_t len, id3_tags& tags) {
+    memset(&tags, 0x00, sizeof(id3_tags));
+    tags.genre_index = 255;
+    if(!data) return false;
+    const bool v2 = parse_id3v2(data, len, tags);
+    const bool v1 = parse_id3v1(data, len, tags);
+    return v2 || v1;
+}
+
+std::string id3_to_utf8(const id3_text& text) {
+    if(text.empty()) return std::string();
+
+    // Undo unsynchronisation into a copy, the common case works on the tag in place
+    std::string resync;
+    const byte* ptr = text.data;
+    size_t size = text.size;
+    if(text.unsynchronised) {
+        tag_cursor cursor = { text.data, text.data + text.size, true };
+        while(cursor.pos != cursor.end) {
+            byte value;
+            cursor.read(1, &value);
+            resync += char(value);
+        }
+        ptr = reinterpret_cast<const byte*>(resync.data());
+        size = resync.size();
+    }
+
+    std::string out;
+    switch(text.encoding) {
+        case id3_encoding::latin1:
+            for(size_t i = 0; i != size && ptr[i] != 0; ++i) append_utf8(out, ptr[i]);
+            break;
+        case id3_encoding::utf8:
+            for(size_t i = 0; i != size && ptr[i] != 0; ++i) out += char(ptr[i]);
+            break;
+        case id3_encoding::utf16:
+        case id3_encoding::utf16be: {
+            bool big_endian = text.encoding == id3_encoding::utf16be;
+            size_t i = 0;
+            if(text.encoding == id3_encoding::utf16 && size >= 2) {
+                // Without a byte order mark assume little endian, which is what the writers that omit it use
+                if(ptr[0] == 0xFE && ptr[1] == 0xFF) { big_endian = true; i = 2; }
+                else if(ptr[0] == 0xFF && ptr[1] == 0xFE) i = 2;
+            }
+            auto unit = [&](size_t at) {
+                return big_endian ? uint32_t(ptr[at] << 8 | ptr[at+1]) : uint32_t(ptr[at+1] << 8 | ptr[at]);
+            };
+            for(; i + 1 < size; i += 2) {
+                uint32_t cp = unit(i);
+                if(cp == 0) break;
+                if(cp >= 0xD800 && cp < 0xDC00 && i + 3 < size) {
+                    const uint32_t low = unit(i + 2);
+                    if(low >= 0xDC00 && low < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        i += 2;
+                    }
+                }
+                append_utf8(out, cp);
+            }
+            break;
+        }
+    }
+
+    // ID3v1 fields are padded with spaces by some writers
+    while(!out.empty() && out.back() == ' ') out.pop_back();
+    return out;
+}
+
+std::string id3_genre(const id3_tags& tags) {
+    std::string genre = id3_to_utf8(tags.genre);
+    if(genre.empty()) return tags.genre_index < id3v1_genre_count ? id3v1_genres[tags.genre_index] : std::string();
+
+    // ID3v2.3 refers to the ID3v1 list as "(17)", optionally followed by a refinement; ID3v2.4 uses a bare "17"
+    const size_t open = genre[0] == '(' ? 1 : 0;
+    char* end = nullptr;
+    const long index = std::strtol(genre.c_str() + open, &end, 10);
+    if(end == genre.c_str() + open || index < 0 || size_t(index) >= id3v1_genre_count) return genre;
+    if(open && *end == ')') return end[1] != '\0' ? std::string(end + 1) : std::string(id3v1_genres[index]);
+    return *end == '\0' ? std::string(id3v1_genres[index]) : genre;
+}
+
+std::string id3_picture_mime(const id3_picture& picture) {
+    std::string mime = id3_to_utf8(picture.mime);
+    if(mime == "JPG") return "image/jpeg";
+    if(mime == "PNG") return "image/png";
+    return mime;
+}
+
+int id3_number(const id3_text& text, int* total) {
+    if(total) *total = 0;
+    if(text.empty()) return 0;
+
+    const std::string value = id3_to_utf8(text);
+    char* end = nullptr;
+    const long number = std::strtol(value.c_str(), &end, 10);
+    if(total && *end == '/') *total = std::max(0, int(std::strtol(end + 1, nullptr, 10)));
+    return std::max(0, int(number));
+}
@@ -0,0 +1,75 @@
+#ifndef ZAPAUDIO_ID3_TAG_HPP
+#define ZAPAUDIO_ID3_TAG_HPP
+
+/*
+ * Reads the common fields of the ID3v2.2/2.3/2.4 tag at the start of a file and the ID3v1 tag at its end.  Parsing is
+ * zero-copy: every field is a view into the caller's buffer (normally a mapping of the whole file) and the embedded
+ * picture is located by its offset and size rather than copied, so a library scan never touches album art pages.
+ * Text is only converted to UTF-8 when a field is actually used.
+ */
+
+#include <string>
+#include <cstdint>
+#include "mp3_frame.hpp"
+#include "audio_stream.hpp"
+
+enum class id3_encoding : byte {
+    latin1 = 0,
+    utf16 = 1,                  // With a byte order mark
+    utf16be = 2,
+    utf8 = 3
+};
+
+// An encoded string inside the tag, empty if the field is absent
+struct id3_text {
+    const byte* data;
+    size_t size;
+    id3_encoding encoding;
+    bool unsynchronised;        // The frame was written with unsynchronisation, every 0xFF 0x00 stands for 0xFF
+
+    bool empty() const { return size == 0; }
+};
+
+// The location of an embedded picture in the file
+struct id3_picture {
+    uint64_t offset;            // Of the image data, from the start of the buffer given to the parser
+    size_t size;
+    id3_text mime;              // "image/jpeg" in ID3v2.3+, "JPG" or "PNG" in ID3v2.2
+    byte type;                  // 3 is the front cover
+    bool unsynchronised;        // The stored bytes must have unsynchronisation undone before use
+
+    bool empty() const { return size == 0; }
+};
+
+struct id3_tags {
+    int version;                // 2, 3 or 4 for an ID3v2 tag, 1 if only an ID3v1 tag was found, 0 for none
+    id3_text title;
+    id3_text artist;
+    id3_text album;
+    id3_text album_artist;
+    id3_text genre;
+    id3_text year;              // "2004", or an ID3v2.4 timestamp such as "2004-05-01"
+    id3_text track;             // "3" or "3/12"
+    id3_text disc;
+    byte v1_track;              // The ID3v1.1 track number, 0 if none
+    byte genre_index;           // The ID3v1 genre, 255 if none
+    id3_picture picture;        // The front cover if there is one, otherwise the first picture
+};
+
+// Parses the ID3v2 tag at data, then fills fields still empty from an ID3v1 tag in the last 128 bytes.  Returns false
+// if there is neither.  The views in tags point into data.
+ZAPAUDIO_EXPORT bool parse_id3(const byte* data, size_t len, id3_tags& tags);
+
+// Converts a field to UTF-8, stopping at the first terminator (ID3v2.4 separates multiple values with one)
+ZAPAUDIO_EXPORT std::string id3_to_utf8(const id3_text& text);
+
+// The genre as text: a text genre is returned as is, "(17)" or "17" and the ID3v1 index are looked up
+ZAPAUDIO_EXPORT std::string id3_genre(const id3_tags& tags);
+
+// The picture's MIME type, with the ID3v2.2 image formats mapped to their MIME types
+ZAPAUDIO_EXPORT std::string id3_picture_mime(const id3_picture& picture);
+
+// Parses the leading number of a field such as "3/12" or "2004-05-01" and the total after a '/', 0 if absent
+ZAPAUDIO_EXPORT int id3_number(const id3_text& text, int* total=nullptr);
+
+#endif //ZAPAUDIO_ID3_TAG_HPP
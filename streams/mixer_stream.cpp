@@ -0,0 +1,115 @@
+#include "mixer_stream.hpp"
+#include <thread>
+#include <cstring>
+#include <algorithm>
+#include "dsp/mix.hpp"
+#include "dsp/sample_convert.hpp"
+
+namespace {
+
+// Accumulates one input into the float mix
+inline void accumulate(float* acc, const float* in, float gain, size_t len) { mix_f32(acc, in, gain, len); }
+inline void accumulate(float* acc, const short* in, float gain, size_t len) { mix_s16(acc, in, gain, len); }
+
+// Float output is mixed in place, s16 output is mixed in the accumulator and converted with saturation at the end
+inline float* mix_target(float* out, float* accum) { return out; }
+inline float* mix_target(short* out, float* accum) { return accum; }
+
+inline void resolve(const float* acc, float* out, size_t len) { }
+inline void resolve(const float* acc, short* out, size_t len) { convert_f32_s16(acc, out, len); }
+
+}
+
+template <typename SampleT>
+mixer_stream<SampleT>::mixer_stream(size_t max_inputs, size_t block) : audio_stream<SampleT>(nullptr),
+        max_inputs_(max_inputs), block_(std::max<size_t>(block, 1)), slots_(new slot_t[max_inputs]), epoch_(0),
+        accum_(block_), scratch_(block_) {
+}
+
+template <typename SampleT>
+int mixer_stream<SampleT>::add_input(stream_t* stream, float gain) {
+    if(!stream) return invalid_input;
+
+    for(size_t i = 0; i != max_inputs_; ++i) {
+        bool expected = false;
+        if(slots_[i].claimed.load(std::memory_order_relaxed)) continue;
+        if(!slots_[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acquire)) continue;
+
+        // Publish the gain with the stream, a reader that sees the stream must not mix it at a stale gain
+        slots_[i].gain.store(gain, std::memory_order_relaxed);
+        slots_[i].stream.store(stream, std::memory_order_seq_cst);
+        return int(i);
+    }
+    return invalid_input;
+}
+
+template <typename SampleT>
+bool mixer_stream<SampleT>::remove_input(int slot) {
+    if(slot < 0 || size_t(slot) >= max_inputs_) return false;
+    if(slots_[slot].stream.exchange(nullptr, std::memory_order_seq_cst) == nullptr) return false;
+
+    // The reader bumps the epoch before it loads the slots, so if a read is in flight it may hold the old pointer;
+    // wait for that read to finish.  Reads started after the exchange see the empty slot.
+    const size_t epoch = epoch_.load(std::memory_order_seq_cst);
+    if(epoch & 1) {
+        while(epoch_.load(std::memory_order_acquire) == epoch) std::this_thread::yield();
+    }
+
+    slots_[slot].claimed.store(false, std::memory_order_release);
+    return true;
+}
+
+template <typename SampleT>
+bool mixer_stream<SampleT>::set_gain(int slot, float gain) {
+    if(slot < 0 || size_t(slot) >= max_inputs_) return false;
+    slots_[slot].gain.store(gain, std::memory_order_relaxed);
+    return true;
+}
+
+template <typename SampleT>
+float mixer_stream<SampleT>::get_gain(int slot) const {
+    if(slot < 0 || size_t(slot) >= max_inputs_) return 0.f;
+    return slots_[slot].gain.load(std::memory_order_relaxed);
+}
+
+template <typename SampleT>
+size_t mixer_stream<SampleT>::input_count() const {
+    size_t count = 0;
+    for(size_t i = 0; i != max_inputs_; ++i) {
+        if(slots_[i].stream.load(std::memory_order_relaxed) != nullptr) ++count;
+    }
+    return count;
+}
+
+template <typename SampleT>
+size_t mixer_stream<SampleT>::read(SampleT* buffer, size_t len) {
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    for(size_t offset = 0; offset < len; offset += block_) mix_block(buffer + offset, std::min(block_, len - offset));
+    epoch_.fetch_add(1, std::memory_order_release);
+    return len;
+}
+
+template <typename SampleT>
+void mixer_stream<SampleT>::mix_block(SampleT* buffer, size_t len) {
+    float* acc = mix_target(buffer, accum_.data());
+    memset(acc, 0x00, len*sizeof(float));
+
+    for(size_t i = 0; i != max_inputs_; ++i) {
+        stream_t* stream = slots_[i].stream.load(std::memory_order_seq_cst);
+        if(!stream) continue;
+
+        const float gain = slots_[i].gain.load(std::memory_order_relaxed);
+        const size_t ret = stream->read(scratch_.data(), len);
+        if(gain != 0.f) accumulate(acc, scratch_.data(), gain, ret);
+    }
+
+    resolve(acc, buffer, len);
+}
+
+template <typename SampleT>
+size_t mixer_stream<SampleT>::write(const SampleT* buffer, size_t len) {
+    return 0;
+}
+
+template class ZAPAUDIO_EXPORT mixer_stream<short>;
+template class ZAPAUDIO_EXPORT mixer_stream<float>;
@@ -0,0 +1,68 @@
+#ifndef ZAPAUDIO_MIXER_STREAM_HPP
+#define ZAPAUDIO_MIXER_STREAM_HPP
+
+/*
+ * Mixes up to max_inputs streams into one, each with its own gain, so a single audio_output can play many sources.
+ *
+ * Inputs are held in fixed slots.  add_input() claims a free slot with a compare-and-swap and remove_input() clears
+ * it, neither blocks the reader.  remove_input() waits until any read that may still be using the stream has
+ * finished, after which the caller may destroy it.  Reads never allocate: the mix is accumulated in float in a
+ * buffer sized at construction and longer reads are processed in blocks of that size.
+ *
+ * The mixer is a bus, it always returns the full length requested and produces silence when no inputs are playing.
+ * Inputs that return short reads are padded with silence; they stay attached until removed.
+ */
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "audio_stream.hpp"
+
+template <typename SampleT>
+class ZAPAUDIO_EXPORT mixer_stream : public audio_stream<SampleT> {
+public:
+    using stream_t = audio_stream<SampleT>;
+    using stream_t::read;
+    using stream_t::write;
+
+    static constexpr int invalid_input = -1;
+
+    // block is the largest number of samples mixed in one pass
+    mixer_stream(size_t max_inputs=64, size_t block=4096);
+    virtual ~mixer_stream() = default;
+
+    // Returns the slot of the new input or invalid_input if every slot is taken
+    int add_input(stream_t* stream, float gain=1.f);
+    // Detaches the input, on return the mixer no longer references the stream
+    bool remove_input(int slot);
+
+    bool set_gain(int slot, float gain);
+    float get_gain(int slot) const;
+
+    size_t input_count() const;
+    size_t max_inputs() const { return max_inputs_; }
+
+    virtual size_t read(SampleT* buffer, size_t len) override final;
+    virtual size_t write(const SampleT* buffer, size_t len) override final;
+
+protected:
+    struct slot_t {
+        std::atomic<bool> claimed;          // Owned by add_input/remove_input, never read by the mixer
+        std::atomic<stream_t*> stream;
+        std::atomic<float> gain;
+
+        slot_t() : claimed(false), stream(nullptr), gain(1.f) { }
+    };
+
+    void mix_block(SampleT* buffer, size_t len);
+
+private:
+    size_t max_inputs_;
+    size_t block_;
+    std::unique_ptr<slot_t[]> slots_;
+    std::atomic<size_t> epoch_;             // Odd while a read is in progress
+    std::vector<float> accum_;
+    std::vector<SampleT> scratch_;
+};
+
+#endif //ZAPAUDIO_MIXER_STREAM_HPP
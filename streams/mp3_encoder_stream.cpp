@@ -0,0 +1,422 @@
+#include "mp3_encoder_stream.hpp"
+#include <thread>
+#include <limits>
+#include <algorithm>
+#ifdef _WIN32
+#include <lame.h>
+#else
+#include <lame/lame.h>
+#endif //_WIN32
+#include "log.hpp"
+
+namespace {
+
+constexpr size_t preroll_frames = 2;        // Encoded before a parallel segment and dropped, primes the filterbank
+constexpr size_t lookahead_frames = 2;      // Encoded after a parallel segment so its last frames see real input
+constexpr size_t serial_block = 8192;       // Frames passed to LAME per call in sequential mode
+
+// Worst case output size from lame.h: 1.25 * samples + 7200
+size_t mp3_buffer_size(size_t frames) {
+    return frames + frames/4 + 7200;
+}
+
+lame_t create_encoder(const mp3_encoder_settings& settings, bool segment) {
+    lame_t lame = lame_init();
+    if(!lame) return nullptr;
+
+    lame_set_in_samplerate(lame, int(settings.sample_rate));
+    lame_set_num_channels(lame, int(settings.channels));
+    lame_set_quality(lame, settings.quality);
+    lame_set_mode(lame, settings.channels == 1 ? MONO : JOINT_STEREO);
+
+    switch(settings.mode) {
+        case mp3_bitrate_mode::cbr:
+            lame_set_VBR(lame, vbr_off);
+            lame_set_brate(lame, settings.bitrate);
+            break;
+        case mp3_bitrate_mode::abr:
+            lame_set_VBR(lame, vbr_abr);
+            lame_set_VBR_mean_bitrate_kbps(lame, settings.bitrate);
+            break;
+        case mp3_bitrate_mode::vbr:
+            lame_set_VBR(lame, vbr_default);
+            lame_set_VBR_quality(lame, float(settings.vbr_quality));
+            break;
+    }
+
+    // A parallel segment must stand on its own: no tag frame, and no frame borrowing reservoir bits from its neighbour
+    if(segment) {
+        lame_set_bWriteVbrTag(lame, 0);
+        lame_set_disable_reservoir(lame, 1);
+    }
+
+    if(lame_init_params(lame) < 0) {
+        lame_close(lame);
+        return nullptr;
+    }
+    return lame;
+}
+
+int encode_pcm(lame_t lame, const short* pcm, size_t frames, size_t channels, byte* output, size_t len) {
+    if(channels == 1) return lame_encode_buffer(lame, pcm, pcm, int(frames), output, int(len));
+    // LAME does not write to its input
+    return lame_encode_buffer_interleaved(lame, const_cast<short*>(pcm), int(frames), output, int(len));
+}
+
+// Encodes frames of PCM on a private context and keeps keep frames of the output after dropping the first drop
+bool encode_segment(const mp3_encoder_settings& settings, const short* pcm, size_t frames, size_t drop, size_t keep,
+                    std::vector<byte>& output) {
+    lame_t lame = create_encoder(settings, true);
+    if(!lame) return false;
+
+    std::vector<byte> encoded(mp3_buffer_size(frames));
+    int ret = encode_pcm(lame, pcm, frames, settings.channels, encoded.data(), encoded.size());
+    size_t len = ret > 0 ? size_t(ret) : 0;
+    if(ret >= 0) {
+        ret = lame_encode_flush(lame, encoded.data() + len, int(encoded.size() - len));
+        if(ret > 0) len += size_t(ret);
+    }
+    lame_close(lame);
+
+    if(ret < 0) {
+        SM_LOG("LAME failed to encode a segment:", ret);
+        return false;
+    }
+
+    output.clear();
+    size_t pos = 0;
+    for(size_t index = 0; pos + 4 <= len && (index < drop || index - drop < keep); ++index) {
+        mp3_frame_header hdr;
+        if(!parse_frame_header(encoded.data() + pos, hdr) || pos + hdr.frame_bytes > len) {
+            SM_LOG("LAME produced an invalid frame at", pos);
+            return false;
+        }
+        if(index >= drop) output.insert(output.end(), encoded.data() + pos, encoded.data() + pos + hdr.frame_bytes);
+        pos += hdr.frame_bytes;
+    }
+    return true;
+}
+
+// The CRC-16 LAME uses for the tag and music CRC fields
+uint16_t crc16_update(uint16_t crc, const byte* data, size_t len) {
+    for(size_t i = 0; i != len; ++i) {
+        crc ^= data[i];
+        for(int b = 0; b != 8; ++b) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
+
+void put_be32(byte* ptr, size_t value) {
+    ptr[0] = byte(value >> 24);
+    ptr[1] = byte(value >> 16);
+    ptr[2] = byte(value >> 8);
+    ptr[3] = byte(value);
+}
+
+}
+
+mp3_encoder_stream::mp3_encoder_stream(const mp3_encoder_settings& settings) : audio_stream<short>(nullptr),
+        settings_(settings), open_(false), failed_(false), bytes_(0), samples_(0), lame_(nullptr), frame_samples_(0),
+        encoder_delay_(0), pending_base_(0), next_sample_(0), music_crc_(0) {
+    settings_.channels = std::min<size_t>(std::max<size_t>(settings_.channels, 1), 2);
+    settings_.threads = std::max<size_t>(settings_.threads, 1);
+    settings_.segment_frames = std::max<size_t>(settings_.segment_frames, 1);
+    memset(tag_header_, 0x00, sizeof(tag_header_));
+}
+
+mp3_encoder_stream::~mp3_encoder_stream() {
+    if(open_) close();
+}
+
+bool mp3_encoder_stream::open(const std::string& filename) {
+    if(open_) close();
+
+    file_.open(filename, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    if(!file_.is_open()) {
+        SM_LOG("Failed to open", filename);
+        return false;
+    }
+    sink_ = nullptr;
+    return start();
+}
+
+bool mp3_encoder_stream::open(const byte_sink& sink) {
+    if(open_) close();
+    if(!sink) return false;
+
+    sink_ = sink;
+    return start();
+}
+
+bool mp3_encoder_stream::start() {
+    lame_ = create_encoder(settings_, false);
+    if(!lame_) {
+        SM_LOG("LAME rejected the encoder settings");
+        if(file_.is_open()) file_.close();
+        return false;
+    }
+
+    frame_samples_ = size_t(lame_get_framesize(lame_));
+    encoder_delay_ = size_t(lame_get_encoder_delay(lame_));
+
+    // The framing is in output samples, segments are cut in input samples: they only agree without resampling
+    if(settings_.threads > 1 && lame_get_out_samplerate(lame_) != int(settings_.sample_rate)) {
+        SM_LOG("LAME resamples", settings_.sample_rate, "Hz input, encoding sequentially");
+        settings_.threads = 1;
+    }
+
+    // The sequential encoder is only kept in sequential mode, in parallel mode it was only asked for its framing
+    if(settings_.threads > 1) {
+        lame_close(lame_);
+        lame_ = nullptr;
+    } else {
+        mp3_buffer_.resize(mp3_buffer_size(serial_block));
+    }
+
+    open_ = true;
+    failed_ = false;
+    bytes_ = samples_ = 0;
+    pending_.clear();
+    pending_base_ = next_sample_ = 0;
+    frame_offsets_.clear();
+    music_crc_ = 0;
+    tag_.clear();
+    return true;
+}
+
+bool mp3_encoder_stream::emit(const byte* data, size_t len) {
+    if(len == 0) return true;
+
+    const bool ok = file_.is_open() ? bool(file_.write(reinterpret_cast<const char*>(data), len)) : sink_(data, len);
+    if(!ok) {
+        SM_LOG("Failed to write the encoded stream");
+        failed_ = true;
+    }
+    bytes_ += len;
+    return ok;
+}
+
+size_t mp3_encoder_stream::write(const short* buffer, size_t len) {
+    if(!open_ || failed_) return 0;
+
+    const size_t channels = settings_.channels;
+    const size_t frames = len / channels;
+
+    if(settings_.threads == 1) {
+        if(!encode_serial(buffer, frames)) return 0;
+    } else {
+        pending_.insert(pending_.end(), buffer, buffer + frames * channels);
+        const size_t batch = (settings_.threads * settings_.segment_frames + lookahead_frames) * frame_samples_;
+        while(pending_base_ + pending_.size() / channels >= next_sample_ + batch) {
+            if(!encode_batch(false)) return 0;
+        }
+    }
+
+    samples_ += frames;
+    return frames * channels;
+}
+
+bool mp3_encoder_stream::encode_serial(const short* buffer, size_t frames) {
+    for(size_t i = 0; i < frames; i += serial_block) {
+        const size_t count = std::min(serial_block, frames - i);
+        const int ret = encode_pcm(lame_, buffer + i * settings_.channels, count, settings_.channels,
+                                   mp3_buffer_.data(), mp3_buffer_.size());
+        if(ret < 0) {
+            SM_LOG("LAME failed to encode:", ret);
+            failed_ = true;
+            return false;
+        }
+        if(!emit(mp3_buffer_.data(), size_t(ret))) return false;
+    }
+    return true;
+}
+
+// Encodes the next threads segments in parallel, or everything left when final.  Segment k produces the frames from
+// next_sample_ + k * segment length, whose input starts preroll_frames earlier so the first frame kept is primed.
+bool mp3_encoder_stream::encode_batch(bool final) {
+    const size_t channels = settings_.channels;
+    const size_t segment = settings_.segment_frames * frame_samples_;
+    const size_t end = pending_base_ + pending_.size() / channels;
+
+    size_t count = settings_.threads;
+    if(final) count = std::max<size_t>((end - next_sample_ + segment - 1) / segment, 1);
+
+    struct job_t {
+        size_t input_begin;
+        size_t input_end;
+        size_t drop;
+        size_t keep;
+        std::vector<byte> output;
+        bool result;
+    };
+
+    std::vector<job_t> jobs(count);
+    for(size_t k = 0; k != count; ++k) {
+        const size_t begin = next_sample_ + k * segment;
+        const size_t preroll = std::min(preroll_frames * frame_samples_, begin);
+        const bool last = final && k + 1 == count;
+
+        jobs[k].input_begin = begin - preroll;
+        jobs[k].input_end = last ? end : std::min(end, begin + segment + lookahead_frames * frame_samples_);
+        jobs[k].drop = preroll / frame_samples_;
+        jobs[k].keep = last ? std::numeric_limits<size_t>::max() : settings_.segment_frames;
+        jobs[k].result = false;
+    }
+
+    // The batch is cut into chunks of whole segments, at most threads segments run at once
+    for(size_t first = 0; first < count; first += settings_.threads) {
+        const size_t last = std::min(count, first + settings_.threads);
+        std::vector<std::thread> workers;
+        for(size_t k = first; k != last; ++k) {
+            workers.emplace_back([this, &jobs, k, channels]() {
+                job_t& job = jobs[k];
+                const short* pcm = pending_.data() + (job.input_begin - pending_base_) * channels;
+                job.result = encode_segment(settings_, pcm, job.input_end - job.input_begin, job.drop, job.keep,
+                                            job.output);
+            });
+        }
+        for(auto& worker : workers) worker.join();
+    }
+
+    for(auto& job : jobs) {
+        if(!job.result) {
+            failed_ = true;
+            return false;
+        }
+        if(!emit_segment(job.output)) return false;
+    }
+
+    next_sample_ += count * segment;
+
+    // Keep the preroll of the next segment
+    const size_t keep_from = std::max(pending_base_, next_sample_ - std::min(next_sample_, preroll_frames * frame_samples_));
+    const size_t trim = std::min(keep_from, end) - pending_base_;
+    pending_.erase(pending_.begin(), pending_.begin() + trim * channels);
+    pending_base_ += trim;
+    return true;
+}
+
+bool mp3_encoder_stream::emit_segment(const std::vector<byte>& segment) {
+    if(segment.empty()) return true;
+
+    // The first frame gives the header for the tag frame, whose placeholder leads the stream
+    if(bytes_ == 0) {
+        memcpy(tag_header_, segment.data(), 4);
+        build_tag_frame(true);
+        if(!emit(tag_.data(), tag_.size())) return false;
+    }
+
+    for(size_t pos = 0; pos < segment.size(); ) {
+        mp3_frame_header hdr;
+        parse_frame_header(segment.data() + pos, hdr);
+        frame_offsets_.push_back(uint32_t(bytes_ + pos));
+        pos += hdr.frame_bytes;
+    }
+
+    music_crc_ = crc16_update(music_crc_, segment.data(), segment.size());
+    return emit(segment.data(), segment.size());
+}
+
+// Writes an Info (cbr) or Xing frame with the LAME extension, the layout LAME itself writes.  The frame must hold the
+// full tag: cbr streams at bitrates too low for that are left without one, vbr streams use a higher bitrate frame.
+void mp3_encoder_stream::build_tag_frame(bool placeholder) {
+    byte header[4];
+    memcpy(header, tag_header_, 4);
+    header[1] |= 0x01;                  // No CRC
+    header[2] &= ~byte(0x02);           // No padding
+
+    mp3_frame_header hdr;
+    if(!parse_frame_header(header, hdr)) return;
+
+    const size_t xing = 4 + hdr.side_info_bytes();
+    const size_t lame_tag = xing + 8 + 4 + 4 + 100 + 4;
+    const size_t required = lame_tag + 36;
+
+    const bool cbr = settings_.mode == mp3_bitrate_mode::cbr;
+    while(hdr.frame_bytes < required && !cbr && (header[2] >> 4) < 14) {
+        header[2] = byte(header[2] + 0x10);
+        parse_frame_header(header, hdr);
+    }
+    if(hdr.frame_bytes < required) {
+        if(placeholder) SM_LOG("Frames are too small for a tag frame, the stream has no gapless information");
+        return;
+    }
+
+    tag_.assign(hdr.frame_bytes, 0);
+    byte* frame = tag_.data();
+    memcpy(frame, header, 4);
+    memcpy(frame + xing, cbr ? "Info" : "Xing", 4);
+    put_be32(frame + xing + 4, 0x0F);   // Frames, bytes, seek table and quality present
+    if(placeholder) return;
+
+    const size_t frames = frame_offsets_.size();
+    const size_t total_samples = frames * frame_samples_;
+    const size_t padding = total_samples > encoder_delay_ + samples_ ? total_samples - encoder_delay_ - samples_ : 0;
+
+    put_be32(frame + xing + 8, frames);
+    put_be32(frame + xing + 12, bytes_);
+
+    byte* toc = frame + xing + 16;
+    for(size_t i = 0; i != 100; ++i) {
+        const size_t offset = frames ? frame_offsets_[std::min(frames - 1, i * frames / 100)] : 0;
+        toc[i] = byte(std::min<size_t>(255, 256 * offset / std::max<size_t>(bytes_, 1)));
+    }
+    put_be32(frame + xing + 116, size_t(settings_.mode == mp3_bitrate_mode::vbr ? settings_.vbr_quality * 10 : 0));
+
+    byte* ext = frame + lame_tag;
+    const char* version = get_lame_very_short_version();
+    memset(ext, ' ', 9);
+    memcpy(ext, version, std::min<size_t>(strlen(version), 9));
+    // VBR method as LAME numbers it (vbr_default is mtrh), and the ABR target, CBR bitrate or VBR minimum bitrate
+    ext[9] = settings_.mode == mp3_bitrate_mode::cbr ? 1 : settings_.mode == mp3_bitrate_mode::abr ? 2 : 4;
+    const int min_bitrate = hdr.is_mpeg1() ? 32 : 8;
+    ext[20] = byte(settings_.mode == mp3_bitrate_mode::vbr ? min_bitrate : std::min(settings_.bitrate, 255));
+    ext[21] = byte(encoder_delay_ >> 4);
+    ext[22] = byte(((encoder_delay_ & 0x0F) << 4) | ((padding >> 8) & 0x0F));
+    ext[23] = byte(padding);
+    put_be32(ext + 28, bytes_);
+    ext[32] = byte(music_crc_ >> 8);
+    ext[33] = byte(music_crc_);
+
+    const uint16_t crc = crc16_update(0, frame, lame_tag + 34);
+    ext[34] = byte(crc >> 8);
+    ext[35] = byte(crc);
+}
+
+bool mp3_encoder_stream::close() {
+    if(!open_) return false;
+
+    if(settings_.threads > 1) {
+        if(!failed_) encode_batch(true);
+        if(!tag_.empty()) build_tag_frame(false);
+    } else {
+        const int ret = lame_encode_flush(lame_, mp3_buffer_.data(), int(mp3_buffer_.size()));
+        if(ret > 0) emit(mp3_buffer_.data(), size_t(ret));
+
+        tag_.resize(mp3_buffer_.size());
+        const size_t tag = lame_get_lametag_frame(lame_, tag_.data(), tag_.size());
+        tag_.resize(tag <= tag_.size() ? tag : 0);
+
+        lame_close(lame_);
+        lame_ = nullptr;
+    }
+
+    if(file_.is_open()) {
+        if(!tag_.empty() && !failed_) {
+            file_.seekp(0, std::ios::beg);
+            file_.write(reinterpret_cast<const char*>(tag_.data()), std::streamsize(tag_.size()));
+            if(!file_) failed_ = true;
+        }
+        file_.close();
+    }
+
+    sink_ = nullptr;
+    pending_.clear();
+    pending_.shrink_to_fit();
+    open_ = false;
+    return !failed_;
+}
+
+size_t mp3_encoder_stream::read(short* buffer, size_t len) {
+    return 0;
+}
@@ -0,0 +1,106 @@
+#ifndef ZAPAUDIO_MP3_ENCODER_STREAM_HPP
+#define ZAPAUDIO_MP3_ENCODER_STREAM_HPP
+
+/*
+ * Encodes interleaved PCM written to it into an MP3 file or byte sink with LAME.
+ *
+ * With one thread the stream is encoded sequentially and LAME writes its own Xing/LAME tag frame.  With more, the
+ * PCM is cut into segments of segment_frames MPEG frames that are encoded on independent LAME contexts in parallel
+ * and concatenated at frame boundaries.  Each segment is encoded from a little before its start, to prime the
+ * filterbank, to a little after its end, so its frames see the same input a sequential encode would, and only the
+ * segment's own frames are kept.  The bit reservoir is disabled in this mode so that no frame depends on the bytes
+ * of a frame from another segment; at a given bitrate this costs some quality.  The tag frame (with the stream
+ * length, seek table, encoder delay and padding) is written by the stream itself.  Segments are cut on the input
+ * sample clock, so when LAME would resample (a sample rate MPEG does not support) the stream is encoded sequentially.
+ *
+ * Files have the tag frame patched in place by close().  A byte sink receives a placeholder of the same size as the
+ * first frame, the final frame can be read from get_tag_frame() after close().
+ */
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <functional>
+#include "audio_stream.hpp"
+#include "mp3_frame.hpp"
+
+struct lame_global_struct;
+typedef struct lame_global_struct lame_global_flags;
+typedef lame_global_flags *lame_t;
+
+enum class mp3_bitrate_mode {
+    cbr,
+    abr,
+    vbr
+};
+
+struct ZAPAUDIO_EXPORT mp3_encoder_settings {
+    size_t sample_rate = 44100;
+    size_t channels = 2;
+    mp3_bitrate_mode mode = mp3_bitrate_mode::cbr;
+    int bitrate = 192;                  // kbps, the constant rate for cbr and the mean for abr
+    int vbr_quality = 2;                // 0 (best) to 9, vbr only
+    int quality = 3;                    // LAME's algorithm quality, 0 (best, slowest) to 9
+    size_t threads = 1;                 // Above 1, segments are encoded in parallel
+    size_t segment_frames = 256;        // MPEG frames per parallel segment
+};
+
+class ZAPAUDIO_EXPORT mp3_encoder_stream : public audio_stream<short> {
+public:
+    using audio_stream<short>::read;
+    using audio_stream<short>::write;
+    using byte_sink = std::function<bool(const byte* data, size_t len)>;
+
+    explicit mp3_encoder_stream(const mp3_encoder_settings& settings=mp3_encoder_settings());
+    virtual ~mp3_encoder_stream();
+
+    bool open(const std::string& filename);
+    bool open(const byte_sink& sink);
+    // Flushes the encoder and writes the tag frame, returns false if anything failed since open()
+    bool close();
+    bool is_open() const { return open_; }
+
+    const mp3_encoder_settings& get_settings() const { return settings_; }
+    const std::vector<byte>& get_tag_frame() const { return tag_; }
+
+    size_t bytes_written() const { return bytes_; }
+    size_t samples_encoded() const { return samples_; }         // Per channel
+
+    virtual size_t read(short* buffer, size_t len) override;
+    virtual size_t write(const short* buffer, size_t len) override;
+
+protected:
+    bool start();
+    bool emit(const byte* data, size_t len);
+    bool encode_serial(const short* buffer, size_t frames);
+    bool encode_batch(bool final);
+    bool emit_segment(const std::vector<byte>& segment);
+    void build_tag_frame(bool placeholder);
+
+private:
+    mp3_encoder_settings settings_;
+    bool open_;
+    bool failed_;
+    std::ofstream file_;
+    byte_sink sink_;
+    size_t bytes_;
+    size_t samples_;
+
+    // Sequential mode
+    lame_t lame_;
+    std::vector<byte> mp3_buffer_;
+
+    // Parallel mode, PCM is held from pending_base_ (per channel) until its segment is encoded
+    size_t frame_samples_;
+    size_t encoder_delay_;
+    std::vector<short> pending_;
+    size_t pending_base_;
+    size_t next_sample_;                // Start of the next segment to encode
+    std::vector<uint32_t> frame_offsets_;
+    uint16_t music_crc_;
+    byte tag_header_[4];
+    std::vector<byte> tag_;
+};
+
+#endif //ZAPAUDIO_MP3_ENCODER_STREAM_HPP
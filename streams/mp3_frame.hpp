@@ -0,0 +1,215 @@
+#ifndef ZAPAUDIO_MP3_FRAME_HPP
+#define ZAPAUDIO_MP3_FRAME_HPP
+
+#include <cstddef>
+#include <cstring>
+
+/*
+ * Parsing of MPEG audio frame headers.  Used to walk a stream frame by frame without invoking the decoder.
+ */
+
+using byte = unsigned char;
+
+struct mp3_frame_header {
+    int version;            // 10 = MPEG-1, 20 = MPEG-2, 25 = MPEG-2.5
+    int layer;              // 1, 2 or 3
+    int bitrate;            // kbps
+    int samplerate;         // Hz
+    int channels;
+    bool padding;
+    bool crc;
+    size_t frame_bytes;     // Total length of the frame, including the header
+    size_t samples;         // Samples per channel in the frame
+
+    bool is_mpeg1() const { return version == 10; }
+
+    // Size of the Layer III side information that follows the header (and CRC)
+    size_t side_info_bytes() const {
+        if(layer != 3) return 0;
+        if(is_mpeg1()) return channels == 1 ? 17 : 32;
+        return channels == 1 ? 9 : 17;
+    }
+
+    // The maximum number of bytes main_data_begin can reach back into previous frames
+    size_t max_reservoir() const {
+        if(layer != 3) return 0;
+        return is_mpeg1() ? 511 : 255;
+    }
+
+    // True if the frame has the same stream parameters, used to validate header chains
+    bool is_compatible(const mp3_frame_header& rhs) const {
+        return version == rhs.version && layer == rhs.layer && samplerate == rhs.samplerate;
+    }
+};
+
+// Decodes the 4 byte header at ptr.  Free-format streams (bitrate index 0) are rejected.
+inline bool parse_frame_header(const byte* ptr, mp3_frame_header& hdr) {
+    static const int bitrates[2][3][16] = {
+        {   // MPEG-1
+            { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+            { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+            { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 }
+        },
+        {   // MPEG-2 & MPEG-2.5
+            { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+            { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+            { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 }
+        }
+    };
+    static const int samplerates[3] = { 44100, 48000, 32000 };
+
+    if(ptr[0] != 0xFF || (ptr[1] & 0xE0) != 0xE0) return false;
+
+    const int version_bits = (ptr[1] >> 3) & 0x03;
+    const int layer_bits = (ptr[1] >> 1) & 0x03;
+    const int bitrate_idx = ptr[2] >> 4;
+    const int samplerate_idx = (ptr[2] >> 2) & 0x03;
+    if(version_bits == 1 || layer_bits == 0 || bitrate_idx == 0 || bitrate_idx == 15 || samplerate_idx == 3)
+        return false;
+
+    hdr.version = version_bits == 3 ? 10 : version_bits == 2 ? 20 : 25;
+    hdr.layer = 4 - layer_bits;
+    hdr.bitrate = bitrates[hdr.is_mpeg1() ? 0 : 1][hdr.layer - 1][bitrate_idx];
+    hdr.samplerate = samplerates[samplerate_idx] / (hdr.version == 10 ? 1 : hdr.version == 20 ? 2 : 4);
+    hdr.channels = (ptr[3] >> 6) == 3 ? 1 : 2;
+    hdr.padding = (ptr[2] & 0x02) != 0;
+    hdr.crc = (ptr[1] & 0x01) == 0;
+
+    const size_t pad = hdr.padding ? 1 : 0;
+    if(hdr.layer == 1) {
+        hdr.samples = 384;
+        hdr.frame_bytes = (12 * 1000 * size_t(hdr.bitrate) / hdr.samplerate + pad) * 4;
+    } else if(hdr.layer == 2 || hdr.is_mpeg1()) {
+        hdr.samples = 1152;
+        hdr.frame_bytes = 144 * 1000 * size_t(hdr.bitrate) / hdr.samplerate + pad;
+    } else {
+        hdr.samples = 576;
+        hdr.frame_bytes = 72 * 1000 * size_t(hdr.bitrate) / hdr.samplerate + pad;
+    }
+    return true;
+}
+
+// Returns the length of an ID3v2 tag at ptr (including its header and footer), or 0 if there is none
+inline size_t id3v2_length(const byte* ptr, size_t len) {
+    if(len < 10 || memcmp(ptr, "ID3", 3) != 0) return 0;
+    if((ptr[6] | ptr[7] | ptr[8] | ptr[9]) & 0x80) return 0;
+    size_t size = (size_t(ptr[6]) << 21) | (size_t(ptr[7]) << 14) | (size_t(ptr[8]) << 7) | size_t(ptr[9]);
+    return size + 10 + ((ptr[5] & 0x10) ? 10 : 0);
+}
+
+// True if the frame at ptr (of frame_bytes length) carries a Xing or Info VBR tag instead of audio
+inline bool is_xing_frame(const byte* ptr, const mp3_frame_header& hdr) {
+    if(hdr.layer != 3) return false;
+    const size_t off = 4 + hdr.side_info_bytes();
+    if(off + 4 > hdr.frame_bytes) return false;
+    return memcmp(ptr + off, "Xing", 4) == 0 || memcmp(ptr + off, "Info", 4) == 0;
+}
+
+// The decoder's own delay (the synthesis filterbank), added to the encoder delay by LAME-compatible gapless players
+constexpr size_t mp3_decoder_delay = 528 + 1;
+
+// Stream length and gapless information carried by a Xing/Info frame and its LAME extension
+struct mp3_xing_info {
+    size_t frames;              // Audio frames in the stream (excluding the Xing frame), 0 if not present
+    size_t bytes;               // Stream length in bytes, 0 if not present
+    bool vbr;                   // "Xing" marks a VBR stream, "Info" a CBR one
+    bool has_toc;
+    byte toc[100];              // Byte position of each 1% of the duration, in 1/256ths of bytes
+    bool has_lame;              // True if the LAME extension (encoder delay and padding) is present
+    size_t encoder_delay;       // Samples per channel added before the audio by the encoder
+    size_t encoder_padding;     // Samples per channel added after the audio to complete the last frame
+};
+
+// Reads the Xing/Info frame at ptr, returns false if the frame is an audio frame
+inline bool parse_xing_frame(const byte* ptr, const mp3_frame_header& hdr, mp3_xing_info& info) {
+    if(!is_xing_frame(ptr, hdr)) return false;
+
+    auto be32 = [](const byte* p) {
+        return (size_t(p[0]) << 24) | (size_t(p[1]) << 16) | (size_t(p[2]) << 8) | size_t(p[3]);
+    };
+
+    const byte* end = ptr + hdr.frame_bytes;
+    const byte* pos = ptr + 4 + hdr.side_info_bytes();
+    memset(&info, 0x00, sizeof(mp3_xing_info));
+    info.vbr = memcmp(pos, "Xing", 4) == 0;
+    pos += 4;
+    if(pos + 4 > end) return true;
+
+    const size_t flags = be32(pos);
+    pos += 4;
+    if(flags & 0x01) {
+        if(pos + 4 > end) return true;
+        info.frames = be32(pos);
+        pos += 4;
+    }
+    if(flags & 0x02) {
+        if(pos + 4 > end) return true;
+        info.bytes = be32(pos);
+        pos += 4;
+    }
+    if(flags & 0x04) {                  // Seek table
+        if(pos + 100 > end) return true;
+        memcpy(info.toc, pos, 100);
+        info.has_toc = true;
+        pos += 100;
+    }
+    if(flags & 0x08) pos += 4;          // Quality
+
+    // The LAME extension: a 9 byte encoder version, then the delay and padding as 12 bit fields at offset 21.  Other
+    // encoders built on LAME's tag writer (Lavf/Lavc) fill in the same fields.
+    if(pos + 24 > end) return true;
+    if(memcmp(pos, "LAME", 4) != 0 && memcmp(pos, "Lavf", 4) != 0 && memcmp(pos, "Lavc", 4) != 0) return true;
+
+    info.has_lame = true;
+    info.encoder_delay = (size_t(pos[21]) << 4) | (size_t(pos[22]) >> 4);
+    info.encoder_padding = ((size_t(pos[22]) & 0x0F) << 8) | size_t(pos[23]);
+    return true;
+}
+
+// Fraunhofer's VBRI tag, which always sits 32 bytes after the header of the first frame
+struct mp3_vbri_info {
+    size_t frames;              // Audio frames in the stream (excluding the VBRI frame)
+    size_t bytes;               // Stream length in bytes
+    size_t encoder_delay;       // Samples per channel added before the audio by the encoder
+    size_t toc_entries;
+    size_t frames_per_entry;
+    const byte* toc;            // toc_entries sizes in bytes, each entry_bytes wide and scaled by toc_scale
+    size_t entry_bytes;
+    size_t toc_scale;
+
+    // Bytes covered by TOC entry i
+    size_t entry_size(size_t i) const {
+        size_t value = 0;
+        for(size_t b = 0; b != entry_bytes; ++b) value = (value << 8) | toc[i*entry_bytes + b];
+        return value * toc_scale;
+    }
+};
+
+// Reads the VBRI frame at ptr, returns false if the frame does not carry one.  info.toc points into the frame.
+inline bool parse_vbri_frame(const byte* ptr, const mp3_frame_header& hdr, mp3_vbri_info& info) {
+    const size_t off = 4 + 32;
+    if(hdr.layer != 3 || off + 26 > hdr.frame_bytes || memcmp(ptr + off, "VBRI", 4) != 0) return false;
+
+    auto be16 = [](const byte* p) { return (size_t(p[0]) << 8) | size_t(p[1]); };
+    auto be32 = [](const byte* p) {
+        return (size_t(p[0]) << 24) | (size_t(p[1]) << 16) | (size_t(p[2]) << 8) | size_t(p[3]);
+    };
+
+    const byte* pos = ptr + off + 4;
+    info.encoder_delay = be16(pos + 2);
+    info.bytes = be32(pos + 6);
+    info.frames = be32(pos + 10);
+    info.toc_entries = be16(pos + 14);
+    info.toc_scale = be16(pos + 16);
+    info.entry_bytes = be16(pos + 18);
+    info.frames_per_entry = be16(pos + 20);
+    info.toc = pos + 22;
+
+    // Drop a seek table that does not fit in the frame rather than the tag
+    if(info.entry_bytes == 0 || info.entry_bytes > 4 || off + 26 + info.toc_entries*info.entry_bytes > hdr.frame_bytes) {
+        info.toc_entries = 0;
+    }
+    return true;
+}
+
+#endif //ZAPAUDIO_MP3_FRAME_HPP
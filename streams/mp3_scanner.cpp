@@ -0,0 +1,212 @@
+#include "mp3_scanner.hpp"
+#include <algorithm>
+#include "buffers/mapped_file.hpp"
+#include "dsp/sync_scan.hpp"
+
+namespace {
+
+const size_t profile_slices = 100;
+
+// Offset of the first byte after any ID3v2 tags and Album ID header at the start of the file
+size_t skip_leading_tags(const byte* data, size_t len) {
+    size_t pos = 0;
+    for(size_t tag = id3v2_length(data, len); tag != 0 && pos + tag <= len; tag = id3v2_length(data + pos, len - pos)) {
+        pos += tag;
+    }
+    if(pos + 6 <= len && memcmp(data + pos, "AiD\1", 4) == 0) pos += (size_t)data[pos+4] + 256 * (size_t)data[pos+5];
+    return std::min(pos, len);
+}
+
+// End of the audio once an ID3v1 tag and an APEv2 tag in front of it are excluded
+size_t strip_trailing_tags(const byte* data, size_t begin, size_t end) {
+    if(end - begin >= 128 && memcmp(data + end - 128, "TAG", 3) == 0) end -= 128;
+    if(end - begin >= 32 && memcmp(data + end - 32, "APETAGEX", 8) == 0) {
+        const byte* footer = data + end - 32;
+        size_t size = size_t(footer[12]) | (size_t(footer[13]) << 8) | (size_t(footer[14]) << 16) |
+                      (size_t(footer[15]) << 24);
+        if(footer[23] & 0x80) size += 32;       // The tag also has a header
+        if(size <= end - begin) end -= size;
+    }
+    return end;
+}
+
+// True if the chain-1 frames after the one at pos have headers compatible with it, or the data ends on a frame boundary
+bool chain_follows(const byte* data, size_t len, size_t pos, const mp3_frame_header& hdr, size_t chain) {
+    size_t at = pos + hdr.frame_bytes;
+    for(size_t i = 1; i < chain; ++i) {
+        if(at > len) return false;
+        if(at + 4 > len) return true;
+
+        mp3_frame_header next;
+        if(!parse_frame_header(data + at, next) || !next.is_compatible(hdr)) return false;
+        at += next.frame_bytes;
+    }
+    return true;
+}
+
+void set_profile_range(mp3_scan_info& info) {
+    if(info.bitrate_profile.empty()) {
+        info.min_bitrate = info.max_bitrate = info.average_bitrate;
+        return;
+    }
+    const auto range = std::minmax_element(info.bitrate_profile.begin(), info.bitrate_profile.end());
+    info.min_bitrate = *range.first;
+    info.max_bitrate = *range.second;
+}
+
+// Walks every frame header from audio_offset, resynchronising over damage with the same chain check used to find the
+// first frame.  The per-frame bitrates give the exact profile and range.
+void walk_frames(const byte* data, size_t end, mp3_scan_info& info) {
+    std::vector<uint16_t> rates;
+    rates.reserve((end - info.audio_offset) / std::max<size_t>(info.header.frame_bytes, 1) + 1);
+
+    size_t pos = info.audio_offset, audio_end = info.audio_offset;
+    mp3_frame_header hdr;
+    while(pos + 4 <= end) {
+        if(parse_frame_header(data + pos, hdr) && hdr.is_compatible(info.header) && pos + hdr.frame_bytes <= end) {
+            rates.push_back(uint16_t(hdr.bitrate));
+            pos += hdr.frame_bytes;
+            audio_end = pos;
+            continue;
+        }
+        pos = find_frame_chain(data, end, pos + 1, &info.header, 2);
+    }
+
+    info.frames = rates.size();
+    info.audio_bytes = audio_end - info.audio_offset;
+    if(rates.empty()) return;
+
+    info.bitrate_profile.resize(profile_slices);
+    for(size_t s = 0; s != profile_slices; ++s) {
+        const size_t a = s * rates.size() / profile_slices;
+        const size_t b = std::max(a + 1, (s + 1) * rates.size() / profile_slices);
+        size_t sum = 0;
+        for(size_t f = a; f != b; ++f) sum += rates[f];
+        info.bitrate_profile[s] = int(sum / (b - a));
+    }
+
+    const auto range = std::minmax_element(rates.begin(), rates.end());
+    info.min_bitrate = *range.first;
+    info.max_bitrate = *range.second;
+    info.vbr = info.vbr || info.min_bitrate != info.max_bitrate;
+}
+
+// Average kbps of each hundredth of the stream from the Xing seek table, which stores the byte position of each
+// percent of the duration
+void xing_profile(const mp3_xing_info& xing, double seconds, size_t bytes, mp3_scan_info& info) {
+    if(!xing.has_toc || seconds <= 0.) return;
+
+    info.bitrate_profile.resize(profile_slices);
+    for(size_t s = 0; s != profile_slices; ++s) {
+        const size_t next = s + 1 < profile_slices ? xing.toc[s+1] : 256;
+        const double slice = double(next > xing.toc[s] ? next - xing.toc[s] : 0) * bytes / 256.;
+        info.bitrate_profile[s] = int(slice * 8. * profile_slices / seconds / 1000. + .5);
+    }
+}
+
+void vbri_profile(const mp3_vbri_info& vbri, const mp3_scan_info& info, std::vector<int>& profile) {
+    if(vbri.toc_entries == 0 || vbri.frames_per_entry == 0 || info.header.samplerate <= 0) return;
+
+    const double entry_seconds = double(vbri.frames_per_entry * info.samples_per_frame) / info.header.samplerate;
+    profile.resize(profile_slices);
+    for(size_t s = 0; s != profile_slices; ++s) {
+        const size_t entry = s * vbri.toc_entries / profile_slices;
+        profile[s] = int(vbri.entry_size(entry) * 8. / entry_seconds / 1000. + .5);
+    }
+}
+
+}
+
+size_t find_frame_chain(const byte* data, size_t len, size_t pos, const mp3_frame_header* ref, size_t chain) {
+    while(pos + 4 <= len) {
+        pos += find_sync(data + pos, len - pos);
+        if(pos + 4 > len) break;
+
+        mp3_frame_header hdr;
+        if(parse_frame_header(data + pos, hdr) && (!ref || hdr.is_compatible(*ref)) &&
+           chain_follows(data, len, pos, hdr, chain)) {
+            return pos;
+        }
+        ++pos;
+    }
+    return len;
+}
+
+bool scan_mp3(const byte* data, size_t len, mp3_scan_info& info, mp3_scan_mode mode) {
+    info = mp3_scan_info();
+    if(!data) return false;
+
+    const size_t begin = skip_leading_tags(data, len);
+    info.stream_offset = find_frame_chain(data, len, begin);
+    if(info.stream_offset == len) return false;
+
+    const size_t end = strip_trailing_tags(data, info.stream_offset, len);
+    const byte* first = data + info.stream_offset;
+    parse_frame_header(first, info.header);
+    info.audio_offset = info.stream_offset;
+
+    mp3_xing_info xing;
+    mp3_vbri_info vbri;
+    size_t tag_frames = 0;
+    if(info.stream_offset + info.header.frame_bytes <= end) {
+        if(parse_xing_frame(first, info.header, xing)) {
+            info.tag = mp3_tag_type::xing;
+            info.vbr = xing.vbr;
+            info.has_gapless = xing.has_lame;
+            info.encoder_delay = xing.encoder_delay;
+            info.encoder_padding = xing.encoder_padding;
+            tag_frames = xing.frames;
+        } else if(parse_vbri_frame(first, info.header, vbri)) {
+            info.tag = mp3_tag_type::vbri;
+            info.vbr = true;
+            info.has_gapless = true;
+            info.encoder_delay = vbri.encoder_delay;
+            tag_frames = vbri.frames;
+        }
+    }
+
+    // The tag frame has the stream's parameters but not necessarily the audio's bitrate
+    if(info.tag != mp3_tag_type::none) {
+        info.audio_offset += info.header.frame_bytes;
+        mp3_frame_header audio;
+        if(info.audio_offset + 4 <= end && parse_frame_header(data + info.audio_offset, audio) &&
+           audio.is_compatible(info.header)) {
+            info.header = audio;
+        }
+    }
+    info.samples_per_frame = info.header.samples;
+    if(info.audio_offset > end) info.audio_offset = end;
+
+    if(mode == mp3_scan_mode::tags && tag_frames != 0) {
+        info.frames = tag_frames;
+        info.audio_bytes = end - info.audio_offset;
+        const double seconds = double(info.frames * info.samples_per_frame) / info.header.samplerate;
+        if(info.tag == mp3_tag_type::xing) {
+            xing_profile(xing, seconds, xing.bytes ? xing.bytes : info.audio_bytes, info);
+            if(!info.vbr) info.bitrate_profile.clear();     // A CBR stream needs no profile to know its bitrate
+        } else {
+            vbri_profile(vbri, info, info.bitrate_profile);
+        }
+    } else {
+        walk_frames(data, end, info);
+        if(info.frames == 0) return false;
+    }
+
+    info.stream_samples = info.frames * info.samples_per_frame;
+    const size_t trim = info.encoder_delay + info.encoder_padding;
+    info.total_samples = info.stream_samples > trim ? info.stream_samples - trim : 0;
+    info.duration = double(info.total_samples) / info.header.samplerate;
+
+    const double stream_seconds = double(info.stream_samples) / info.header.samplerate;
+    info.average_bitrate = stream_seconds > 0. ? int(info.audio_bytes * 8. / stream_seconds / 1000. + .5) : 0;
+    if(!info.vbr) info.average_bitrate = info.header.bitrate;
+    if(info.min_bitrate == 0) set_profile_range(info);
+    return true;
+}
+
+bool scan_mp3(const std::string& filename, mp3_scan_info& info, mp3_scan_mode mode) {
+    mapped_file map;
+    if(!map.open(filename)) return false;
+    if(mode == mp3_scan_mode::full) map.advise_sequential();
+    return scan_mp3(map.data(), map.size(), info, mode);
+}
@@ -0,0 +1,66 @@
+#ifndef ZAPAUDIO_MP3_SCANNER_HPP
+#define ZAPAUDIO_MP3_SCANNER_HPP
+
+/*
+ * Reads the stream parameters and exact length of an MP3 file from its frame headers and Xing/Info/VBRI tag, without
+ * invoking the decoder.  Sync candidates are found with the SIMD sync_scan kernels and a header is only accepted if the
+ * frames that follow it chain on with compatible headers, so a stray 0xFFE in a tag or in padding is not mistaken for
+ * the start of the audio.
+ *
+ * With a tag the scan reads only the first frames, which takes microseconds.  Without one, or in full mode, every
+ * frame header is walked; that touches each frame once but decodes nothing.
+ */
+
+#include <string>
+#include <vector>
+#include "mp3_frame.hpp"
+#include "audio_stream.hpp"
+
+enum class mp3_scan_mode {
+    tags,                   // Trust a Xing/Info/VBRI frame count if there is one, otherwise walk the frames
+    full                    // Always walk the frames
+};
+
+enum class mp3_tag_type {
+    none,
+    xing,                   // Xing or Info, optionally with the LAME extension
+    vbri
+};
+
+struct ZAPAUDIO_EXPORT mp3_scan_info {
+    mp3_frame_header header;        // Of the first audio frame
+    size_t stream_offset;           // First frame, the tag frame if there is one; decoding starts here
+    size_t audio_offset;            // First audio frame
+    size_t audio_bytes;             // From audio_offset to the end of the audio, excluding trailing tags
+    size_t frames;                  // Audio frames
+    size_t samples_per_frame;
+
+    mp3_tag_type tag;
+    bool vbr;                       // A Xing or VBRI tag, or a walk that saw more than one bitrate
+    bool has_gapless;               // The encoder delay is known (LAME extension or VBRI)
+    size_t encoder_delay;           // Samples per channel
+    size_t encoder_padding;
+
+    size_t stream_samples;          // Per channel, as the decoder outputs them: frames * samples_per_frame
+    size_t total_samples;           // Per channel, with the encoder delay and padding removed
+    double duration;                // Seconds of total_samples
+
+    int average_bitrate;            // kbps over the audio
+    int min_bitrate;
+    int max_bitrate;
+    std::vector<int> bitrate_profile;   // Average kbps over each hundredth of the stream, from the seek table or walk
+};
+
+// Offset of the first header at or after pos that is followed by chain-1 compatible frames (or the end of the data),
+// or len if there is none.  With ref, only headers compatible with it are accepted.
+ZAPAUDIO_EXPORT size_t find_frame_chain(const byte* data, size_t len, size_t pos, const mp3_frame_header* ref=nullptr,
+                                        size_t chain=3);
+
+// Scans the file image in [data, data + len).  Returns false if no MPEG audio stream is found.
+ZAPAUDIO_EXPORT bool scan_mp3(const byte* data, size_t len, mp3_scan_info& info,
+                              mp3_scan_mode mode=mp3_scan_mode::tags);
+// Maps the file and scans it
+ZAPAUDIO_EXPORT bool scan_mp3(const std::string& filename, mp3_scan_info& info,
+                              mp3_scan_mode mode=mp3_scan_mode::tags);
+
+#endif //ZAPAUDIO_MP3_SCANNER_HPP
@@ -0,0 +1,260 @@
+#include "mp3_seek_index.hpp"
+#include <fstream>
+#include <algorithm>
+#include <sys/stat.h>
+#include "log.hpp"
+
+namespace {
+
+const char sidecar_magic[4] = { 'Z', 'S', 'I', 'X' };
+const uint32_t sidecar_version = 2;
+const size_t window_size = 64*1024;
+
+// Serves byte ranges of a file through a sliding window so that large files are not loaded whole
+class file_window {
+public:
+    file_window(std::ifstream& file, size_t size) : file_(file), size_(size), base_(0) { }
+
+    const byte* get(size_t pos, size_t len) {
+        if(pos + len > size_) return nullptr;
+        if(pos < base_ || pos + len > base_ + buffer_.size()) {
+            base_ = pos;
+            buffer_.resize(std::min(size_ - pos, std::max(len, window_size)));
+            file_.clear();
+            file_.seekg(pos);
+            file_.read(reinterpret_cast<char*>(buffer_.data()), buffer_.size());
+            if(size_t(file_.gcount()) != buffer_.size()) { buffer_.clear(); return nullptr; }
+        }
+        return buffer_.data() + (pos - base_);
+    }
+
+private:
+    std::ifstream& file_;
+    size_t size_;
+    size_t base_;
+    std::vector<byte> buffer_;
+};
+
+class memory_window {
+public:
+    memory_window(const byte* data, size_t size) : data_(data), size_(size) { }
+    const byte* get(size_t pos, size_t len) const { return pos + len > size_ ? nullptr : data_ + pos; }
+
+private:
+    const byte* data_;
+    size_t size_;
+};
+
+// A header is accepted if the following frame also starts with a compatible header (or the stream ends there)
+template <typename WindowT>
+bool is_frame_at(WindowT& window, size_t pos, size_t size, const mp3_frame_header* ref, mp3_frame_header& hdr) {
+    const byte* ptr = window.get(pos, 4);
+    if(!ptr || !parse_frame_header(ptr, hdr)) return false;
+    if(ref && !hdr.is_compatible(*ref)) return false;
+
+    const size_t next = pos + hdr.frame_bytes;
+    if(next > size) return false;
+    if(next + 4 > size) return true;
+
+    mp3_frame_header next_hdr;
+    ptr = window.get(next, 4);
+    return ptr && parse_frame_header(ptr, next_hdr) && next_hdr.is_compatible(hdr);
+}
+
+template <typename WindowT>
+size_t find_frame(WindowT& window, size_t pos, size_t size, const mp3_frame_header* ref, mp3_frame_header& hdr) {
+    for(; pos + 4 <= size; ++pos) {
+        if(is_frame_at(window, pos, size, ref, hdr)) return pos;
+    }
+    return size;
+}
+
+template <typename WindowT>
+size_t skip_tags(WindowT& window, size_t size) {
+    size_t pos = 0;
+    const byte* ptr = window.get(0, 10);
+    if(ptr) pos += id3v2_length(ptr, 10);
+
+    ptr = window.get(pos, 6);
+    if(ptr && memcmp(ptr, "AiD\1", 4) == 0) {   // Album ID Header
+        pos += (size_t)ptr[4] + 256 * (size_t)ptr[5];
+    }
+    return std::min(pos, size);
+}
+
+template <typename WindowT>
+bool walk_frames(WindowT& window, size_t size, std::vector<uint64_t>& offsets, mp3_frame_header& first) {
+    offsets.clear();
+
+    size_t pos = find_frame(window, skip_tags(window, size), size, nullptr, first);
+    if(pos == size) return false;
+
+    // The Xing/Info frame carries no audio and hip does not output any samples for it
+    const byte* ptr = window.get(pos, first.frame_bytes);
+    if(ptr && is_xing_frame(ptr, first)) pos += first.frame_bytes;
+
+    mp3_frame_header hdr;
+    while(pos + 4 <= size) {
+        ptr = window.get(pos, 4);
+        if(ptr && parse_frame_header(ptr, hdr) && hdr.is_compatible(first) && pos + hdr.frame_bytes <= size) {
+            offsets.push_back(pos);
+            pos += hdr.frame_bytes;
+            continue;
+        }
+
+        if(ptr && memcmp(ptr, "TAG", 3) == 0) break;   // ID3v1 trailer
+        pos = find_frame(window, pos + 1, size, &first, hdr);
+    }
+
+    offsets.push_back(std::min(pos, size));
+    return offsets.size() > 1;
+}
+
+template <typename T>
+bool write_value(std::ofstream& file, const T& value) {
+    return bool(file.write(reinterpret_cast<const char*>(&value), sizeof(T)));
+}
+
+template <typename T>
+bool read_value(std::ifstream& file, T& value) {
+    return bool(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+}
+
+bool mp3_seek_index::build(const std::string& filename) {
+    std::ifstream file(filename, std::ios_base::binary | std::ios_base::in);
+    if(!file.is_open()) {
+        SM_LOG("Could not open file for indexing:", filename);
+        return false;
+    }
+
+    file.seekg(0, std::ios::end);
+    const size_t size = (size_t)file.tellg();
+
+    clear();
+    file_window window(file, size);
+    mp3_frame_header first;
+    if(!walk_frames(window, size, offsets_, first)) {
+        SM_LOG("No MPEG audio frames found in", filename);
+        clear();
+        return false;
+    }
+
+    file_size_ = size;
+    samplerate_ = first.samplerate;
+    samples_per_frame_ = first.samples;
+    max_reservoir_ = first.max_reservoir();
+    return true;
+}
+
+bool mp3_seek_index::build(const byte* data, size_t len) {
+    clear();
+    memory_window window(data, len);
+    mp3_frame_header first;
+    if(!walk_frames(window, len, offsets_, first)) {
+        clear();
+        return false;
+    }
+
+    file_size_ = len;
+    samplerate_ = first.samplerate;
+    samples_per_frame_ = first.samples;
+    max_reservoir_ = first.max_reservoir();
+    return true;
+}
+
+bool mp3_seek_index::load(const std::string& filename, size_t file_size, int64_t file_mtime) {
+    std::ifstream file(filename, std::ios_base::binary | std::ios_base::in);
+    if(!file.is_open()) return false;
+
+    file.seekg(0, std::ios::end);
+    const uint64_t sidecar_size = uint64_t(file.tellg());
+    file.seekg(0, std::ios::beg);
+
+    char magic[4];
+    uint32_t version, samplerate, samples_per_frame, max_reservoir;
+    uint64_t size, count;
+    int64_t mtime;
+    if(!file.read(magic, 4) || memcmp(magic, sidecar_magic, 4) != 0) return false;
+    if(!read_value(file, version) || version != sidecar_version) return false;
+    if(!read_value(file, size) || !read_value(file, mtime) || !read_value(file, samplerate) ||
+       !read_value(file, samples_per_frame) || !read_value(file, max_reservoir) || !read_value(file, count)) return false;
+
+    // A sidecar for a different version of the file is stale
+    if(size != file_size || mtime != file_mtime) return false;
+
+    // The offsets must fit in the sidecar and, being strictly increasing, number at most one per byte of the file
+    const uint64_t remaining = sidecar_size - uint64_t(file.tellg());
+    if(count < 2 || count > remaining / sizeof(uint64_t) || count > size + 1) return false;
+    if(samplerate == 0 || samples_per_frame == 0) return false;
+
+    std::vector<uint64_t> offsets(static_cast<size_t>(count));
+    if(!file.read(reinterpret_cast<char*>(offsets.data()), count*sizeof(uint64_t))) return false;
+    for(size_t i = 1; i != offsets.size(); ++i) {
+        if(offsets[i] <= offsets[i-1]) return false;
+    }
+    if(offsets.back() > size) return false;
+
+    file_size_ = size_t(size);
+    samplerate_ = int(samplerate);
+    samples_per_frame_ = samples_per_frame;
+    max_reservoir_ = max_reservoir;
+    offsets_ = std::move(offsets);
+    return true;
+}
+
+bool mp3_seek_index::save(const std::string& filename, int64_t file_mtime) const {
+    if(empty()) return false;
+
+    std::ofstream file(filename, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    if(!file.is_open()) {
+        SM_LOG("Could not write seek index:", filename);
+        return false;
+    }
+
+    file.write(sidecar_magic, 4);
+    return write_value(file, sidecar_version) &&
+           write_value(file, uint64_t(file_size_)) &&
+           write_value(file, file_mtime) &&
+           write_value(file, uint32_t(samplerate_)) &&
+           write_value(file, uint32_t(samples_per_frame_)) &&
+           write_value(file, uint32_t(max_reservoir_)) &&
+           write_value(file, uint64_t(offsets_.size())) &&
+           file.write(reinterpret_cast<const char*>(offsets_.data()), offsets_.size()*sizeof(uint64_t));
+}
+
+bool mp3_seek_index::stat_file(const std::string& filename, size_t& size, int64_t& mtime) {
+    struct stat st;
+    if(stat(filename.c_str(), &st) != 0) return false;
+    size = size_t(st.st_size);
+    mtime = int64_t(st.st_mtime);
+    return true;
+}
+
+void mp3_seek_index::clear() {
+    file_size_ = 0;
+    samplerate_ = 0;
+    samples_per_frame_ = 0;
+    max_reservoir_ = 0;
+    offsets_.clear();
+}
+
+bool mp3_seek_index::lookup(size_t sample, mp3_seek_point& point) const {
+    if(empty() || sample >= total_samples()) return false;
+
+    point.frame = sample / samples_per_frame_;
+    point.offset = frame_offset(point.frame);
+    point.discard = sample - point.frame * samples_per_frame_;
+
+    // The frame before the target must decode cleanly to supply the IMDCT overlap, and the frames before that must
+    // hold enough data to satisfy its reservoir.  One extra frame covers the header and side info of each frame.
+    size_t preroll = point.frame > 0 ? point.frame - 1 : 0;
+    size_t bytes = 0;
+    while(preroll > 0 && bytes < max_reservoir_) bytes += frame_bytes(--preroll);
+    if(preroll > 0 && max_reservoir_ > 0) --preroll;
+
+    point.preroll_frame = preroll;
+    point.preroll_offset = frame_offset(preroll);
+    return true;
+}
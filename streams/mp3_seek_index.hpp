@@ -0,0 +1,72 @@
+#ifndef ZAPAUDIO_MP3_SEEK_INDEX_HPP
+#define ZAPAUDIO_MP3_SEEK_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "audio_stream.hpp"
+#include "mp3_frame.hpp"
+
+/*
+ * mp3_seek_index maps sample positions to the byte offsets of the frames that contain them.  It is built by walking
+ * the frame headers of the file (no decoding) and may be persisted as a sidecar file next to the mp3.
+ *
+ * Layer III frames may borrow up to 511 bytes of main data from earlier frames (the bit reservoir) and the IMDCT
+ * overlaps consecutive frames, so a decoder must be started a few frames before the target.  lookup() returns the
+ * frame to start decoding from and the number of samples to discard once the target frame is reached.
+ *
+ * A sidecar records the size and modification time of the file it was built from and is ignored once either changes.
+ * Loading checks the offsets against the file, so a corrupt sidecar is rejected rather than trusted.
+ */
+
+struct mp3_seek_point {
+    size_t frame;           // The frame containing the requested sample
+    size_t offset;          // Byte offset of that frame in the file
+    size_t preroll_frame;   // The frame decoding should begin at to prime the decoder
+    size_t preroll_offset;  // Byte offset of the preroll frame
+    size_t discard;         // Samples (per channel) to discard from the start of the target frame
+};
+
+class ZAPAUDIO_EXPORT mp3_seek_index {
+public:
+    mp3_seek_index() : file_size_(0), samplerate_(0), samples_per_frame_(0), max_reservoir_(0) { }
+
+    bool build(const std::string& filename);
+    bool build(const byte* data, size_t len);
+
+    // file_size and file_mtime are those of the mp3 the sidecar belongs to, as returned by stat_file()
+    bool load(const std::string& filename, size_t file_size, int64_t file_mtime);
+    bool save(const std::string& filename, int64_t file_mtime) const;
+
+    void clear();
+
+    bool empty() const { return offsets_.size() < 2; }
+    size_t frame_count() const { return empty() ? 0 : offsets_.size() - 1; }
+    size_t frame_offset(size_t frame) const { return size_t(offsets_[frame]); }
+    size_t frame_bytes(size_t frame) const { return size_t(offsets_[frame+1] - offsets_[frame]); }
+    size_t end_offset() const { return empty() ? 0 : size_t(offsets_.back()); }
+
+    size_t file_size() const { return file_size_; }
+    int samplerate() const { return samplerate_; }
+    size_t samples_per_frame() const { return samples_per_frame_; }
+    size_t total_samples() const { return frame_count() * samples_per_frame_; }
+    double duration() const { return samplerate_ ? double(total_samples()) / samplerate_ : 0.; }
+
+    size_t time_to_sample(double seconds) const { return seconds > 0. ? size_t(seconds * samplerate_) : 0; }
+
+    bool lookup(size_t sample, mp3_seek_point& point) const;
+    bool lookup_time(double seconds, mp3_seek_point& point) const { return lookup(time_to_sample(seconds), point); }
+
+    // The sidecar filename used when none is given explicitly
+    static std::string sidecar_name(const std::string& filename) { return filename + ".zsi"; }
+    static bool stat_file(const std::string& filename, size_t& size, int64_t& mtime);
+
+private:
+    size_t file_size_;
+    int samplerate_;
+    size_t samples_per_frame_;
+    size_t max_reservoir_;
+    std::vector<uint64_t> offsets_;     // frame_count()+1 entries, the last marks the end of the final frame
+};
+
+#endif //ZAPAUDIO_MP3_SEEK_INDEX_HPP
@@ -0,0 +1,34 @@
+#include "mp3_segment.hpp"
+
+bool decode_segment(const byte* data, uint64_t base, const mp3_seek_index& index, size_t lead, size_t begin,
+                    size_t keep, size_t end, std::vector<short>& output, mp3_format& format) {
+    auto decoder = make_mp3_decoder();
+    if(!decoder) return false;
+
+    short left_pcm[mp3_frame_size], right_pcm[mp3_frame_size];
+    auto at = [data, base](uint64_t offset) { return data + (offset - base); };
+    output.reserve(output.size() + (end - keep) * index.samples_per_frame() * 2);
+
+    const size_t first = index.frame_offset(begin);
+    if(lead < first) {
+        int ret = decoder->decode(at(lead), first - lead, left_pcm, right_pcm);
+        while(ret > 0) ret = decoder->decode(at(lead), 0, left_pcm, right_pcm);
+    }
+
+    for(size_t frame = begin; frame != end; ++frame) {
+        const byte* ptr = at(index.frame_offset(frame));
+        int ret = decoder->decode(ptr, index.frame_bytes(frame), left_pcm, right_pcm);
+        while(ret > 0) {
+            if(frame >= keep) {
+                for(int i = 0; i != ret; ++i) {
+                    output.push_back(left_pcm[i]);
+                    output.push_back(right_pcm[i]);
+                }
+            }
+            ret = decoder->decode(ptr, 0, left_pcm, right_pcm);
+        }
+    }
+
+    decoder->get_format(format);
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef ZAPAUDIO_MP3_SEGMENT_HPP
+#define ZAPAUDIO_MP3_SEGMENT_HPP
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "mp3_stream.hpp"
+
+/*
+ * Decodes a frame range of an indexed stream on a private decoder, so ranges can be decoded independently (in
+ * parallel, or on demand for the PCM cache).
+ */
+
+// Decodes the frames [begin, end) of the index, keeping the interleaved stereo output from frame keep onwards.  data
+// holds the file from byte offset base up to at least the end of frame end-1.  If lead is before the first frame, the
+// bytes from lead (the Xing frame at the start of the stream) are fed first so that a range starting at the first
+// frame decodes exactly as a sequential decode does.  format is filled in if the decoder parsed a header.
+ZAPAUDIO_EXPORT bool decode_segment(const byte* data, uint64_t base, const mp3_seek_index& index, size_t lead,
+                                    size_t begin, size_t keep, size_t end, std::vector<short>& output,
+                                    mp3_format& format);
+
+#endif //ZAPAUDIO_MP3_SEGMENT_HPP
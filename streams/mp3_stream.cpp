@@ -1,207 +1,417 @@
 #include "mp3_stream.hpp"
 #include <algorithm>
-#ifdef _WIN32
-#include <lame.h>
-#else
-#include <lame/lame.h>
-#endif //_WIN32
+#include <cstring>
+#include <type_traits>
 #include "log.hpp"
+#include "mp3_segment.hpp"
+#include "pcm_cache.hpp"
+#include "dsp/sample_convert.hpp"
 
-mp3_format lame_2_header(const mp3data_struct& mp3data);
+namespace {
 
-mp3_stream::mp3_stream(const std::string& filename, size_t frame_size, audio_stream<short>* parent) :
-        filename_(filename), header_parsed_(false), file_size_(0), frame_size_(frame_size),
-        output_buffer_(128*mp3_frame_size), input_buffer_(128*frame_size), lame_(nullptr) {
+mp3_format scan_2_header(const mp3_scan_info& scan) {
+    mp3_format fmt;
+    fmt.bitrate = scan.average_bitrate;
+    fmt.channels = scan.header.channels;
+    fmt.samplerate = scan.header.samplerate;
+    fmt.duration = int(scan.duration);
+    fmt.total_frames = int(scan.frames);
+    return fmt;
+}
+
+inline void copy_samples(const short* src, short* dst, size_t len) { memcpy(dst, src, len*sizeof(short)); }
+inline void copy_samples(const short* src, float* dst, size_t len) { convert_s16_f32(src, dst, len); }
+
+}
+
+// The mapped reader asks the kernel to fetch this far ahead of the decoder and drops pages this far behind it
+constexpr size_t mp3_readahead = 512*1024;
+
+template <typename SampleT>
+mp3_stream<SampleT>::mp3_stream(const std::string& filename, size_t frame_size, audio_stream<SampleT>* parent,
+        mp3_input_mode input_mode) : filename_(filename), header_parsed_(false), file_size_(0),
+        frame_size_(frame_size), discard_(0), output_buffer_(128*mp3_frame_size),
+        input_buffer_(input_mode == mp3_input_mode::stream ? 128*frame_size : 0), input_mode_(input_mode),
+        map_pos_(0), prefetch_pos_(0), release_pos_(0), cached_(false), chunk_index_(0), chunk_pos_(0), stream_lead_(0),
+        metrics_("mp3_stream") {
     read_buf.resize(frame_size);
 }
 
-mp3_stream::~mp3_stream() {
-    if(file_.is_open()) file_.close();
-    if(lame_) shutdown();
+template <typename SampleT>
+mp3_stream<SampleT>::~mp3_stream() {
+    input_.close();
+    map_.close();
+    shutdown();
 }
 
-bool mp3_stream::start() {
-    if(!initialise()) return false;
-    file_ = std::ifstream(filename_, std::ios_base::binary | std::ios_base::in);
+template <typename SampleT>
+bool mp3_stream<SampleT>::is_open() const {
+    if(cached_) {
+        const size_t count = (index_.frame_count() + pcm_cache::chunk_frames - 1) / pcm_cache::chunk_frames;
+        if(!chunk_) return chunk_index_ < count;
+        return chunk_pos_ < chunk_->samples.size() || chunk_index_ + 1 < count;
+    }
+    return input_mode_ == mp3_input_mode::mapped ? map_pos_ < map_.size() : input_.is_open() && !input_.eof();
+}
 
-    if(file_.is_open()) {
-        file_.seekg(0, std::ios::end);
-        file_size_ = (size_t)file_.tellg();
-        file_.seekg(0, std::ios::beg);
+template <typename SampleT>
+bool mp3_stream<SampleT>::start() {
+    if(!initialise() || !scan()) return false;
+    if(start_cached()) return true;
 
-        fill_input_buffer();
+    // Decoding starts at the first frame so that the Xing frame reaches the decoder as it does in a full decode
+    if(input_mode_ == mp3_input_mode::mapped) {
+        map_.advise_sequential();
+        map_pos_ = prefetch_pos_ = scan_.stream_offset;
+        release_pos_ = 0;
+        read_ahead();
+        return true;
+    }
 
-        // Load some data into the input buffer and try to strip the ID3 header
-        if(!strip_header()) {
-            if(is_open()) file_.close();
-            SM_LOG("Could not strip header");
-            return false;
-        }
+    if(!input_.open(filename_, scan_.stream_offset)) return false;
+    fill_input_buffer();
+    return true;
+}
 
-        while(!header_parsed_ && is_open()) {
-            fill_output_buffer();
-        }
+// Reads the header from the frame headers and tag, the mapping is kept for a mapped stream and dropped otherwise
+template <typename SampleT>
+bool mp3_stream<SampleT>::scan() {
+    mapped_file probe;
+    mapped_file& map = input_mode_ == mp3_input_mode::mapped ? map_ : probe;
+    if(!map.open(filename_)) return false;
+    file_size_ = map.size();
+
+    if(!scan_mp3(map.data(), map.size(), scan_)) {
+        SM_LOG("No MPEG audio stream found in", filename_);
+        map.close();
+        return false;
     }
+
+    header_ = scan_2_header(scan_);
+    header_parsed_ = true;
     return true;
 }
 
 
-bool mp3_stream::start(const std::string& filename) {
-    if(file_.is_open()) file_.close();
+template <typename SampleT>
+bool mp3_stream<SampleT>::start(const std::string& filename) {
+    input_.close();
+    map_.close();
+    map_pos_ = 0;
     filename_ = filename;
     input_buffer_.clear();
     output_buffer_.clear();
+    index_.clear();
+    discard_ = 0;
+    cached_ = false;
+    chunk_.reset();
+    chunk_index_ = chunk_pos_ = 0;
     return start();
 }
 
-size_t mp3_stream::read(buffer_t& buffer, size_t len) {
-    if(output_buffer_.size() < len) fill_output_buffer();
-    auto l = output_buffer_.read(buffer.data(), len);
-    return l;
+template <typename SampleT>
+bool mp3_stream<SampleT>::start_cached() {
+    // The cache holds 16 bit PCM, a float stream decodes for itself so it keeps its headroom
+    if(!std::is_same<SampleT, short>::value) return false;
+    auto& cache = pcm_cache::instance();
+    if(!cache.enabled()) return false;
+    file_id_ = pcm_cache::file_identity(filename_);
+    if(file_id_.empty()) return false;
+
+    const bool mapped = input_mode_ == mp3_input_mode::mapped;
+    if(!mapped && !input_.open(filename_, scan_.stream_offset)) return false;
+    stream_lead_ = scan_.stream_offset;
+
+    auto index = cache.get_index(file_id_, [this, mapped](mp3_seek_index& index) {
+        return mapped ? index.build(map_.data(), map_.size()) : index.build(filename_);
+    });
+
+    if(index) {
+        index_ = *index;
+        cached_ = true;
+        discard_ = 0;
+        if(load_chunk(0)) {
+            fill_from_cache();
+            return true;
+        }
+    }
+
+    // Fall back to decoding as the stream is read
+    cached_ = false;
+    chunk_.reset();
+    index_.clear();
+    input_.close();
+    return false;
 }
 
-size_t mp3_stream::write(const buffer_t& buffer, size_t len) {
-    return 0;
+template <typename SampleT>
+bool mp3_stream<SampleT>::load_chunk(size_t chunk) {
+    chunk_ = pcm_cache::instance().get(file_id_, chunk, [this, chunk](pcm_chunk& output) {
+        return decode_chunk(chunk, output);
+    });
+    chunk_index_ = chunk;
+    chunk_pos_ = 0;
+    return chunk_ != nullptr;
 }
 
-bool mp3_stream::initialise() {
-    if(lame_) return true;
-    lame_ = lame_init();
-    if(!lame_) {
-        SM_LOG("LAME failed to initialise");
-        return false;
+template <typename SampleT>
+bool mp3_stream<SampleT>::decode_chunk(size_t chunk, pcm_chunk& output) {
+    const size_t keep = chunk * pcm_cache::chunk_frames;
+    const size_t end = std::min(index_.frame_count(), keep + pcm_cache::chunk_frames);
+    if(keep >= end) return false;
+
+    mp3_seek_point point;
+    if(!index_.lookup(keep * index_.samples_per_frame(), point)) return false;
+
+    // The first chunk starts at the stream start so that it decodes exactly as a sequential read does
+    const size_t lead = chunk == 0 ? stream_lead_ : file_size_;
+    if(input_mode_ == mp3_input_mode::mapped) {
+        return decode_segment(map_.data(), 0, index_, lead, point.preroll_frame, keep, end, output.samples,
+                              output.format);
+    }
+
+    const size_t from = std::min(lead, index_.frame_offset(point.preroll_frame)), to = index_.frame_offset(end);
+    // Chunks are decoded in order as the stream plays, so the read-ahead runs into the next one
+    chunk_input_.resize(to - from);
+    if(!input_.seek(from) || input_.read(chunk_input_.data(), chunk_input_.size()) != chunk_input_.size()) return false;
+    return decode_segment(chunk_input_.data(), from, index_, lead, point.preroll_frame, keep, end, output.samples,
+                          output.format);
+}
+
+template <typename SampleT>
+void mp3_stream<SampleT>::fill_from_cache() {
+    const size_t count = (index_.frame_count() + pcm_cache::chunk_frames - 1) / pcm_cache::chunk_frames;
+
+    while(output_buffer_.size() < output_buffer_.capacity()/2) {
+        if(!chunk_ || chunk_pos_ == chunk_->samples.size()) {
+            const size_t next = chunk_ ? chunk_index_ + 1 : chunk_index_;
+            if(next >= count || !load_chunk(next)) {
+                chunk_.reset();
+                chunk_index_ = count;
+                break;
+            }
+
+            // Drop the samples preceding a seek target
+            chunk_pos_ = std::min(2*discard_, chunk_->samples.size());
+            discard_ = 0;
+        }
+
+        auto span = output_buffer_.prepare_write(chunk_->samples.size() - chunk_pos_);
+        if(span.empty()) break;
+        const short* src = chunk_->samples.data() + chunk_pos_;
+        copy_samples(src, span.first, span.first_size);
+        copy_samples(src + span.first_size, span.second, span.second_size);
+        output_buffer_.commit_write(span.size());
+        chunk_pos_ += span.size();
     }
+}
+
+template <typename SampleT>
+bool mp3_stream<SampleT>::build_index(const std::string& sidecar) {
+    if(cached_) return true;        // The index came from the cache
+
+    // Stamped before the walk, so a file changed during it leaves a sidecar that no longer matches
+    size_t size = 0;
+    int64_t mtime = 0;
+    const bool stamped = !sidecar.empty() && mp3_seek_index::stat_file(filename_, size, mtime);
+    if(stamped && index_.load(sidecar, size, mtime)) return true;
 
-    lame_set_decode_only(lame_, 1);
-    lame_set_num_samples(lame_, std::numeric_limits<unsigned int>::max());
+    const bool built = map_.is_open() ? index_.build(map_.data(), map_.size()) : index_.build(filename_);
+    if(!built) return false;
+    if(stamped) index_.save(sidecar, mtime);
+    return true;
+}
 
-    hip_ = hip_decode_init();
-    if(!hip_) {
-        lame_close(lame_);
-        lame_ = nullptr;
-        SM_LOG("LAME HIP failed to initialise");
+template <typename SampleT>
+bool mp3_stream<SampleT>::seek(size_t sample) {
+    if(!decoder_ || !header_parsed_) {
+        SM_LOG("mp3_stream must be started before seeking");
         return false;
     }
+
+    if(cached_) {
+        const size_t chunk_samples = pcm_cache::chunk_frames * index_.samples_per_frame();
+        if(sample >= index_.total_samples()) return false;
+
+        output_buffer_.clear();
+        chunk_.reset();
+        chunk_index_ = sample / chunk_samples;
+        discard_ = sample - chunk_index_ * chunk_samples;
+        fill_from_cache();
+        return true;
+    }
+
+    if(index_.empty() && !build_index(index_sidecar_)) return false;
+
+    mp3_seek_point point;
+    if(!index_.lookup(sample, point)) return false;
+
+    const bool mapped = input_mode_ == mp3_input_mode::mapped;
+    if(mapped) {
+        if(!map_.is_open()) return false;
+    } else {
+        if(!input_.is_open() && !input_.open(filename_, point.preroll_offset)) return false;
+        input_.seek(point.preroll_offset);
+    }
+
+    if(!reset_decoder()) return false;
+    input_buffer_.clear();
+    output_buffer_.clear();
+
+    // Prime the new decoder one frame at a time from the preroll frame, dropping the output.  The number of preroll
+    // frames is bounded by the reservoir size so the cost is the same wherever the target is in the file.
+    for(size_t frame = point.preroll_frame; frame != point.frame; ++frame) {
+        const size_t len = index_.frame_bytes(frame);
+        const byte* ptr = nullptr;
+        if(mapped) {
+            ptr = map_.data() + index_.frame_offset(frame);
+        } else {
+            if(read_buf.size() < len) read_buf.resize(len);
+            if(input_.read(read_buf.data(), len) != len) return false;
+            ptr = read_buf.data();
+        }
+
+        int ret = decoder_->decode(ptr, len, left_pcm, right_pcm);
+        while(ret > 0) ret = decoder_->decode(ptr, 0, left_pcm, right_pcm);
+    }
+
+    if(mapped) {
+        map_pos_ = prefetch_pos_ = point.offset;
+        release_pos_ = 0;
+        read_ahead();
+    } else {
+        input_.seek(point.offset);
+    }
+
+    discard_ = point.discard;
+    fill_input_buffer();
+    fill_output_buffer();
     return true;
 }
 
-void mp3_stream::shutdown() {
-    hip_decode_exit(hip_);
-    hip_ = nullptr;
-    lame_close(lame_);
-    lame_ = nullptr;
+template <typename SampleT>
+size_t mp3_stream<SampleT>::read(SampleT* buffer, size_t len) {
+    if(output_buffer_.size() < len) fill_output_buffer();
+    metrics_.occupancy.record(size_t(output_buffer_.size()));
+    auto l = output_buffer_.read(buffer, len);
+    metrics_.record_read(len, l);
+    if(l == 0 && len != 0 && is_open()) metrics_.underflows.add();
+    return l;
+}
+
+template <typename SampleT>
+size_t mp3_stream<SampleT>::write(const SampleT* buffer, size_t len) {
+    return 0;
+}
+
+template <typename SampleT>
+bool mp3_stream<SampleT>::initialise() {
+    if(decoder_) return true;
+    decoder_ = make_mp3_decoder();
+    return decoder_ != nullptr;
+}
+
+template <typename SampleT>
+bool mp3_stream<SampleT>::reset_decoder() {
+    return decoder_ && decoder_->reset();
+}
+
+template <typename SampleT>
+void mp3_stream<SampleT>::shutdown() {
+    decoder_.reset();
 }
 
-void mp3_stream::fill_input_buffer() {
+template <typename SampleT>
+void mp3_stream<SampleT>::fill_input_buffer() {
+    if(input_mode_ == mp3_input_mode::mapped) return;
+    if(!is_open() || input_buffer_.size() >= input_buffer_.capacity()/2) return;
+
+    // Only completed reads are taken while the decoder has input left, it waits for the disk only when it has none
+    const auto start = metrics_clock::now();
     while(is_open() && (input_buffer_.size() < input_buffer_.capacity()/2)) {
-        auto rd = std::min(size_t(file_size_ - file_.tellg()), frame_size_);
-        file_.read(reinterpret_cast<char*>(read_buf.data()), frame_size_);
-        size_t off = (size_t)file_.tellg();
-        if(off == -1) file_.close();
-        else          input_buffer_.write(read_buf.data(), rd);
+        const bool wait = input_buffer_.size() == 0;
+        auto span = input_buffer_.prepare_write(input_buffer_.capacity()/2 - input_buffer_.size());
+        size_t count = input_.read(span.first, span.first_size, wait);
+        if(count == span.first_size) count += input_.read(span.second, span.second_size, wait);
+        input_buffer_.commit_write(count);
+        if(count == 0) break;
     }
+    metrics_.record_work(elapsed_ns(start));
+}
+
+template <typename SampleT>
+bool mp3_stream<SampleT>::has_input() const {
+    return input_mode_ == mp3_input_mode::mapped ? map_pos_ < map_.size() : input_buffer_.size() > 0;
 }
 
-int mp3_stream::zip(short* left_pcm, short* right_pcm, int len) {
-    for(int i = 0; i != len; ++i) {
-        output_buffer_.write(left_pcm+i, 1);
-        output_buffer_.write(right_pcm+i, 1);
+template <typename SampleT>
+size_t mp3_stream<SampleT>::next_input(const byte*& ptr) {
+    if(input_mode_ == mp3_input_mode::mapped) {
+        // The decoder copies its input, so it is fed straight from the mapping
+        const size_t len = std::min(frame_size_, map_.size() - map_pos_);
+        ptr = map_.data() + map_pos_;
+        map_pos_ += len;
+        read_ahead();
+        return len;
     }
-    return len;
+
+    ptr = read_buf.data();
+    return size_t(input_buffer_.read(read_buf.data(), frame_size_));
 }
 
-void mp3_stream::fill_output_buffer() {
-    static mp3data_struct mp3data;
+template <typename SampleT>
+void mp3_stream<SampleT>::read_ahead() {
+    if(map_pos_ + mp3_readahead/2 < prefetch_pos_) return;
 
-    int ret = 0, len = 0;
-    while(output_buffer_.size() < output_buffer_.capacity()/2 && input_buffer_.size() > 0) {
-        len = input_buffer_.read(read_buf.data(), frame_size_);
-        if(!header_parsed_) {
-            ret = hip_decode1_headers(hip_, read_buf.data(), len, left_pcm, right_pcm, &mp3data);
-            if(mp3data.header_parsed) {
-                header_ = lame_2_header(mp3data);
-                header_parsed_ = true;
-            }
-        } else {
-            ret = hip_decode1_headers(hip_, read_buf.data(), len, left_pcm, right_pcm, &mp3data);
-            while(ret != 0) {
-                zip(left_pcm, right_pcm, ret);
-                ret = hip_decode1_headers(hip_, read_buf.data(), 0, left_pcm, right_pcm, &mp3data);
-            }
-        }
-        fill_input_buffer();
+    map_.prefetch(prefetch_pos_, mp3_readahead);
+    prefetch_pos_ += mp3_readahead;
+
+    if(map_pos_ > release_pos_ + 2*mp3_readahead) {
+        const size_t behind = map_pos_ - mp3_readahead;
+        map_.release(release_pos_, behind - release_pos_);
+        release_pos_ = behind;
     }
 }
 
-bool mp3_stream::strip_header() {
-    assert(input_buffer_.read_cursor() == 0 && "buffer should be positioned at zero");
-    byte header[100];
-    if(input_buffer_.read(header, 4) != 4) return false;
+template <typename SampleT>
+int mp3_stream<SampleT>::zip(SampleT* left_pcm, SampleT* right_pcm, int len) {
+    // Drop the samples preceding a seek target
+    const int skip = int(std::min(discard_, size_t(len)));
+    discard_ -= size_t(skip);
 
-    if(memcmp(header, "ID3", 3) == 0) { // Check ID3 Header
-        SM_LOG("ID3 found");
-        // Read the length of the id3 header
-        if(input_buffer_.read(header, 6) != 6) return false;
-        header[2] &= 0x7f; header[3] &= 0x7f; header[4] &= 0x7f; header[5] &= 0x7f;
-        size_t skip = (((((header[2] << 7) + header[3]) << 7) + header[4] ) << 7) + header[5];
-        SM_LOG("skipping =", skip);
+    // Interleave straight into the output ring; samples that do not fit are dropped
+    auto span = output_buffer_.prepare_write(2*size_t(len - skip));
+    size_t idx = 0;
+    auto interleave = [&](SampleT* dst, size_t count) {
+        for(size_t i = 0; i != count; ++i, ++idx) {
+            dst[i] = (idx & 1) ? right_pcm[skip + idx/2] : left_pcm[skip + idx/2];
+        }
+    };
+    interleave(span.first, span.first_size);
+    interleave(span.second, span.second_size);
+    output_buffer_.commit_write(span.size());
+    return len;
+}
 
-        // The skip size sometimes includes the header
-        skip -= 4;
+template <typename SampleT>
+void mp3_stream<SampleT>::fill_output_buffer() {
+    if(cached_) {
+        fill_from_cache();
+        return;
+    }
 
-        size_t skipped;
-        do {
-            skipped = input_buffer_.skip(skip);
-            if(skipped < skip) {
-                fill_input_buffer();
-            }
-            skip -= skipped;
-        } while(skipped != 0 && skip != 0);
-
-        if(skip != 0)                            return false;
-        if(input_buffer_.read(header, 4) != 4)   return false;   // Reposition buffer
-    }
-
-    if(memcmp(header, "AiD\1", 4) == 0) { // Check for Album ID Header
-        SM_LOG("Album ID found");
-        if(input_buffer_.read(header, 2) != 2) return false;
-        size_t skip = (size_t)header[0] + 256 * (size_t)header[1];
-        if(input_buffer_.skip(skip - 6) != (skip - 6)) return false;
-        if(input_buffer_.read(header, 4) != 4) return false;   // Reposition buffer
-    }
-
-    // Now scan to find the mp3 sync word
-    size_t skipped = 0;
-    while(!is_syncword_mp123(input_buffer_.read_ptr())) {
-        byte dummy;
-        if(input_buffer_.read(&dummy, 1) != 1) return false;
-        skipped++;
-        if(skipped >= 2048) {
-            SM_LOG("Corrupted file, more than 2048 bytes skipped after headers and still no sync word");
-            return false;
+    int ret = 0;
+    const byte* ptr = nullptr;
+    while(output_buffer_.size() < output_buffer_.capacity()/2 && has_input()) {
+        const size_t len = next_input(ptr);
+        ret = decoder_->decode(ptr, len, left_pcm, right_pcm);
+        while(ret > 0) {
+            zip(left_pcm, right_pcm, ret);
+            ret = decoder_->decode(ptr, 0, left_pcm, right_pcm);
         }
+        fill_input_buffer();
     }
-    return true;
-}
-
-bool mp3_stream::is_syncword_mp123(const byte* ptr) {
-    static const char abl2[16] = { 0, 7, 7, 7, 0, 7, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8 };
-    if((ptr[0] & 0xFF) != 0xFF) return false;
-    if((ptr[1] & 0xE0) != 0xE0) return false;
-    if((ptr[1] & 0x18) == 0x08) return false;
-    if((ptr[1] & 0x06) == 0x00) return false;
-    if((ptr[2] & 0xF0) == 0xF0) return false;
-    if((ptr[2] & 0x0C) == 0x0C) return false;
-    if((ptr[1] & 0x18) == 0x18 && (ptr[1] & 0x06) == 0x04 && abl2[ptr[2] >> 4] & (1 << (ptr[3] >> 6))) return false;
-    return (ptr[3] & 3) != 2;
 }
 
-mp3_format lame_2_header(const mp3data_struct& mp3data) {
-    mp3_format fmt;
-    fmt.bitrate = mp3data.bitrate;
-    fmt.channels = mp3data.stereo;
-    fmt.samplerate = mp3data.samplerate;
-    fmt.duration = mp3data.totalframes / mp3data.samplerate;
-    fmt.total_frames = mp3data.totalframes;
-    return fmt;
-}
+template class ZAPAUDIO_EXPORT mp3_stream<short>;
+template class ZAPAUDIO_EXPORT mp3_stream<float>;
@@ -6,74 +6,121 @@
 #define SIMPLE_MP3_MP3_STREAM_HPP
 
 #include "audio_stream.hpp"
+#include "decoders/mp3_decoder.hpp"
 #include "buffers/ring_buffer.hpp"
-#include <fstream>
+#include "buffers/mapped_file.hpp"
+#include "buffers/read_ahead_file.hpp"
+#include "mp3_seek_index.hpp"
+#include "mp3_scanner.hpp"
+#include "metrics.hpp"
 #include <cassert>
 #include <limits>
+#include <memory>
 
-struct lame_global_struct;
-typedef struct lame_global_struct lame_global_flags;
-typedef lame_global_flags *lame_t;
+struct pcm_chunk;
 
-struct hip_global_struct;
-typedef struct hip_global_struct hip_global_flags;
-typedef hip_global_flags *hip_t;
-
-using byte = unsigned char;
-
-struct ZAPAUDIO_EXPORT mp3_format {
-    int samplerate;
-    int bitrate;
-    int channels;
-    int total_frames;
-    int duration;   // In seconds
+// stream reads the file ahead of the decoder through a read_ahead_file into the input ring buffer; mapped feeds the
+// decoder straight from a mapping
+enum class mp3_input_mode {
+    stream,
+    mapped
 };
 
-constexpr size_t mp3_frame_size = 1152;
-
-class ZAPAUDIO_EXPORT mp3_stream : public audio_stream<short> {
+// Decodes to 16 bit or float PCM.  mp3_stream<float> takes the decoder's unclipped output, it is never quantised to 16
+// bits.  Only mp3_stream<short> is served from the pcm_cache, which holds 16 bit PCM.
+template <typename SampleT>
+class ZAPAUDIO_EXPORT mp3_stream : public audio_stream<SampleT> {
 public:
-    mp3_stream(const std::string& filename, size_t frame_size, audio_stream<short>* parent);
+    using stream_t = audio_stream<SampleT>;
+    using stream_t::read;
+    using stream_t::write;
+
+    mp3_stream(const std::string& filename, size_t frame_size, stream_t* parent,
+               mp3_input_mode input_mode=mp3_input_mode::stream);
     virtual ~mp3_stream();
 
-    bool is_open() const { return file_.is_open(); }
+    bool is_open() const;
+    virtual bool is_finished() const override { return !is_open(); }
+    // True if the stream is being served from the process-wide pcm_cache
+    bool is_cached() const { return cached_; }
+    mp3_input_mode get_input_mode() const { return input_mode_; }
+    // Filled in by start() from the frame headers and Xing/Info/VBRI tag, before anything is decoded
     const mp3_format& get_header() const { return header_; }
+    const mp3_scan_info& get_scan_info() const { return scan_; }
 
     const std::string& get_filename() const { return filename_; }
 
     bool start();
     bool start(const std::string& filename);
 
-    virtual size_t read(buffer_t& buffer, size_t len);
-    virtual size_t write(const buffer_t& buffer, size_t len);
+    // Loads the seek index from the sidecar file if it is current, otherwise builds it and writes the sidecar.  Pass
+    // an empty sidecar name to build the index without persisting it.
+    bool build_index(const std::string& sidecar);
+    bool build_index() { return build_index(mp3_seek_index::sidecar_name(filename_)); }
+    // The sidecar seek() loads or writes when it has to build the index.  Empty by default, so seeking never writes
+    // next to the media file unless asked to.
+    void set_index_sidecar(const std::string& sidecar) { index_sidecar_ = sidecar; }
+    const mp3_seek_index& get_index() const { return index_; }
+    // Read counters and output ring occupancy; the work histogram times fill_input_buffer, including waits for the disk
+    const stage_metrics& get_metrics() const { return metrics_; }
+
+    // Repositions the stream at the sample (per channel), building the index first if required
+    bool seek(size_t sample);
+
+    virtual size_t read(SampleT* buffer, size_t len) override;
+    virtual size_t write(const SampleT* buffer, size_t len) override;
 
 protected:
     std::vector<byte> read_buf;
 
     bool initialise();
+    bool scan();
 
     void shutdown();
     void fill_input_buffer();
-    int zip(short* left_pcm, short* right_pcm, int len);
+    bool has_input() const;
+    size_t next_input(const byte*& ptr);
+    void read_ahead();
+    int zip(SampleT* left_pcm, SampleT* right_pcm, int len);
 
-    short left_pcm[mp3_frame_size];
-    short right_pcm[mp3_frame_size];
+    SampleT left_pcm[mp3_frame_size];
+    SampleT right_pcm[mp3_frame_size];
 
     void fill_output_buffer();
-    bool strip_header();
-    bool is_syncword_mp123(const byte* ptr);
+    bool reset_decoder();
+
+    bool start_cached();
+    bool load_chunk(size_t chunk);
+    bool decode_chunk(size_t chunk, pcm_chunk& output);
+    void fill_from_cache();
 
 private:
     std::string filename_;
     bool header_parsed_;
     size_t file_size_;
     size_t frame_size_;
-    ring_buffer<short, int, false> output_buffer_;
+    size_t discard_;
+    ring_buffer<SampleT, int, false> output_buffer_;
     ring_buffer<byte, int, false> input_buffer_;
     mp3_format header_;
-    std::ifstream file_;
-    lame_t lame_;
-    hip_t hip_;
+    mp3_scan_info scan_;
+    mp3_seek_index index_;
+    std::string index_sidecar_;
+    read_ahead_file input_;
+    std::unique_ptr<mp3_decoder> decoder_;
+    mp3_input_mode input_mode_;
+    mapped_file map_;
+    size_t map_pos_;
+    size_t prefetch_pos_;
+    size_t release_pos_;
+    bool cached_;
+    std::string file_id_;
+    std::shared_ptr<const pcm_chunk> chunk_;
+    size_t chunk_index_;
+    size_t chunk_pos_;
+    size_t stream_lead_;
+    std::vector<byte> chunk_input_;
+    stage_metrics metrics_;
 };
 
 #endif //SIMPLE_MP3_MP3_STREAM_HPP
@@ -0,0 +1,153 @@
+#include "pcm_cache.hpp"
+#include <sys/stat.h>
+
+constexpr size_t pcm_cache::chunk_frames;
+constexpr size_t pcm_cache::index_chunk;
+
+pcm_cache& pcm_cache::instance() {
+    static pcm_cache cache;
+    return cache;
+}
+
+std::string pcm_cache::file_identity(const std::string& filename) {
+    struct stat st;
+    if(stat(filename.c_str(), &st) != 0) return std::string();
+
+#ifdef _WIN32
+    // No stable inode through stat on Windows, the path stands in for it
+    return filename + ":" + std::to_string(uint64_t(st.st_size)) + ":" + std::to_string(int64_t(st.st_mtime));
+#else
+    return std::to_string(uint64_t(st.st_dev)) + ":" + std::to_string(uint64_t(st.st_ino)) + ":" +
+           std::to_string(uint64_t(st.st_size)) + ":" + std::to_string(int64_t(st.st_mtime));
+#endif
+}
+
+void pcm_cache::set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    budget_.store(bytes, std::memory_order_relaxed);
+    evict();
+}
+
+pcm_cache::chunk_ptr pcm_cache::get(const std::string& file_id, size_t chunk, const decode_fnc& decode) {
+    if(!enabled() || file_id.empty()) {
+        auto result = std::make_shared<pcm_chunk>();
+        return decode(*result) ? result : nullptr;
+    }
+
+    const key_t key = { file_id, chunk };
+    std::unique_lock<std::mutex> lock(mtx_);
+
+    auto it = entries_.find(key);
+    if(it != entries_.end()) {
+        if(it->second.chunk) {
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            return it->second.chunk;
+        }
+
+        // Another reader is decoding this chunk, wait for its result rather than decoding it again
+        ++shared_;
+        auto pending = it->second.pending;
+        lock.unlock();
+        return pending.get();
+    }
+
+    ++misses_;
+    std::promise<chunk_ptr> promise;
+    entry_t& entry = entries_[key];
+    entry.pending = promise.get_future().share();
+    entry.bytes = 0;
+    entry.lru = lru_.insert(lru_.begin(), key);
+    lock.unlock();
+
+    auto result = std::make_shared<pcm_chunk>();
+    const bool decoded = decode(*result);
+
+    lock.lock();
+    it = entries_.find(key);        // Pending entries are never evicted or cleared
+    if(it != entries_.end()) {
+        if(decoded) {
+            it->second.chunk = result;
+            it->second.pending = std::shared_future<chunk_ptr>();
+            insert(it->second, result->samples.size() * sizeof(short) + sizeof(pcm_chunk));
+        } else {
+            lru_.erase(it->second.lru);
+            entries_.erase(it);
+        }
+    }
+    lock.unlock();
+
+    chunk_ptr value = decoded ? chunk_ptr(result) : nullptr;
+    promise.set_value(value);
+    return value;
+}
+
+pcm_cache::index_ptr pcm_cache::get_index(const std::string& file_id, const build_fnc& build) {
+    const key_t key = { file_id, index_chunk };
+    if(enabled() && !file_id.empty()) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = entries_.find(key);
+        if(it != entries_.end()) {
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            return it->second.index;
+        }
+        ++misses_;
+    }
+
+    // Building an index is cheap next to decoding, two readers racing here both build it and one copy is kept
+    auto index = std::make_shared<mp3_seek_index>();
+    if(!build(*index) || index->empty()) return nullptr;
+    if(!enabled() || file_id.empty()) return index;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = entries_.find(key);
+    if(it != entries_.end()) return it->second.index;
+
+    entry_t& entry = entries_[key];
+    entry.index = index;
+    entry.bytes = 0;
+    entry.lru = lru_.insert(lru_.begin(), key);
+    insert(entry, index->frame_count() * sizeof(uint64_t) + sizeof(mp3_seek_index));
+    return index;
+}
+
+void pcm_cache::insert(entry_t& entry, size_t bytes) {
+    entry.bytes = bytes;
+    bytes_ += bytes;
+    evict();
+}
+
+void pcm_cache::evict() {
+    const size_t budget = budget_.load(std::memory_order_relaxed);
+    auto it = lru_.end();
+    while(bytes_ > budget && it != lru_.begin()) {
+        --it;
+        auto entry = entries_.find(*it);
+        if(entry->second.pending.valid()) continue;     // Still being decoded, a reader is waiting on it
+
+        bytes_ -= entry->second.bytes;
+        ++evictions_;
+        entries_.erase(entry);
+        it = lru_.erase(it);
+    }
+}
+
+void pcm_cache::clear() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for(auto it = lru_.begin(); it != lru_.end();) {
+        auto entry = entries_.find(*it);
+        if(entry->second.pending.valid()) {
+            ++it;
+            continue;
+        }
+        bytes_ -= entry->second.bytes;
+        entries_.erase(entry);
+        it = lru_.erase(it);
+    }
+}
+
+pcm_cache_stats pcm_cache::get_stats() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return { hits_, misses_, shared_, evictions_, bytes_, entries_.size() };
+}
@@ -0,0 +1,109 @@
+#ifndef ZAPAUDIO_PCM_CACHE_HPP
+#define ZAPAUDIO_PCM_CACHE_HPP
+
+/*
+ * A process-wide cache of decoded PCM, shared by every mp3_stream and file_decoder.
+ *
+ * Files are identified by device, inode, size and modification time (path, size and time on Windows) so a changed
+ * file is never served stale data and different paths to the same file share entries.  PCM is cached in chunks of
+ * chunk_frames MPEG frames and evicted least recently used first once the memory budget is exceeded.  The seek index
+ * of each file is cached alongside, so a hot file is neither decoded nor re-indexed.
+ *
+ * A chunk is decoded once however many readers ask for it: the first reader decodes it and the others wait for its
+ * result.  The cache is disabled (a budget of zero) until set_budget() is called.
+ */
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "mp3_stream.hpp"
+
+struct pcm_chunk {
+    std::vector<short> samples;     // Interleaved stereo, as mp3_stream produces
+    mp3_format format;
+};
+
+struct pcm_cache_stats {
+    size_t hits;
+    size_t misses;
+    size_t shared;                  // Requests that waited on another reader's decode
+    size_t evictions;
+    size_t bytes;
+    size_t entries;
+};
+
+class ZAPAUDIO_EXPORT pcm_cache {
+public:
+    using chunk_ptr = std::shared_ptr<const pcm_chunk>;
+    using index_ptr = std::shared_ptr<const mp3_seek_index>;
+    using decode_fnc = std::function<bool(pcm_chunk&)>;
+    using build_fnc = std::function<bool(mp3_seek_index&)>;
+
+    static constexpr size_t chunk_frames = 64;
+
+    static pcm_cache& instance();
+
+    // Returns an empty string if the file cannot be stat'ed
+    static std::string file_identity(const std::string& filename);
+
+    // Zero disables the cache and drops its contents
+    void set_budget(size_t bytes);
+    size_t get_budget() const { return budget_.load(std::memory_order_relaxed); }
+    bool enabled() const { return get_budget() != 0; }
+
+    // Returns the chunk, calling decode to produce it on a miss.  Returns null if the decode failed.
+    chunk_ptr get(const std::string& file_id, size_t chunk, const decode_fnc& decode);
+    index_ptr get_index(const std::string& file_id, const build_fnc& build);
+
+    void clear();
+    pcm_cache_stats get_stats() const;
+
+protected:
+    pcm_cache() : budget_(0), bytes_(0), hits_(0), misses_(0), shared_(0), evictions_(0) { }
+
+    struct key_t {
+        std::string file_id;
+        size_t chunk;               // index_chunk for the seek index
+
+        bool operator==(const key_t& rhs) const { return chunk == rhs.chunk && file_id == rhs.file_id; }
+    };
+
+    struct key_hash {
+        size_t operator()(const key_t& key) const {
+            return std::hash<std::string>()(key.file_id) ^ (std::hash<size_t>()(key.chunk) * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    struct entry_t {
+        std::shared_future<chunk_ptr> pending;      // Valid while the chunk is being decoded
+        chunk_ptr chunk;
+        index_ptr index;
+        size_t bytes;
+        std::list<key_t>::iterator lru;
+    };
+
+    static constexpr size_t index_chunk = ~size_t(0);
+
+    void insert(entry_t& entry, size_t bytes);
+    void evict();
+
+private:
+    mutable std::mutex mtx_;
+    std::atomic<size_t> budget_;
+    size_t bytes_;
+    std::unordered_map<key_t, entry_t, key_hash> entries_;
+    std::list<key_t> lru_;          // Most recently used at the front
+
+    size_t hits_;
+    size_t misses_;
+    size_t shared_;
+    size_t evictions_;
+};
+
+#endif //ZAPAUDIO_PCM_CACHE_HPP
@@ -0,0 +1,178 @@
+#ifndef ZAPAUDIO_PIPELINE_HPP
+#define ZAPAUDIO_PIPELINE_HPP
+
+/*
+ * A chain of element-wise stages composed at compile time, as an alternative to linking one audio_stream per stage.
+ *
+ * static_pipeline<Channels, BlockFrames, Source, Stages...> reads the source in blocks of BlockFrames frames and runs
+ * every stage over each sample in one loop.  The stages are plain function objects inlined into that loop, so a
+ * conversion, a gain and a conversion back cost one pass over the block and vectorise as a whole, where the virtual
+ * chain makes a call, a pass and a buffer per stage.  When the source and output sample types match the block is
+ * read straight into the caller's buffer and processed in place.  The loop is also compiled for AVX2 and picked at
+ * construction, like the dsp kernels.
+ *
+ * The source is called by its static type, without a virtual call, unless it is abstract, so Source should be the
+ * most derived type of the stream passed in.  The pipeline is an audio_stream of the last stage's output type, so it
+ * plugs into buffered_stream or audio_output like any other stream.  Reads are rounded down to whole frames.
+ *
+ * A stage defines in_t and out_t and out_t operator()(in_t) const.  Runtime parameters such as a gain are members of
+ * the stage, reached through stage<I>().
+ */
+
+#include <tuple>
+#include <array>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include "audio_stream.hpp"
+#include "dsp/cpu_features.hpp"
+
+struct s16_to_f32_stage {
+    using in_t = short;
+    using out_t = float;
+    float operator()(short sample) const { return sample * (1.f/32767.f); }
+};
+
+// Rounds to nearest even and saturates like convert_f32_s16, except that a NaN saturates by its sign
+struct f32_to_s16_stage {
+    using in_t = float;
+    using out_t = short;
+    short operator()(float sample) const {
+        // Adding 1.5 * 2^23 leaves the rounded sample in the low mantissa bits, above 0x4b400000.  Clamping the bit
+        // pattern as an integer saturates every other value by sign and, unlike a float clamp, vectorises without
+        // blends.  0x4b400000 has no low 16 bits set, so they are the sample.
+        const float v = sample * 32767.f + 12582912.f;
+        int32_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        bits = bits > 0x4b3f8000 ? bits : 0x4b3f8000;
+        bits = bits < 0x4b407fff ? bits : 0x4b407fff;
+        return short(bits);
+    }
+};
+
+struct gain_stage {
+    using in_t = float;
+    using out_t = float;
+    float gain;
+
+    explicit gain_stage(float g=1.f) : gain(g) { }
+    float operator()(float sample) const { return sample * gain; }
+};
+
+// Hard clips to [-1, 1]
+struct clip_stage {
+    using in_t = float;
+    using out_t = float;
+    float operator()(float sample) const { return std::min(std::max(sample, -1.f), 1.f); }
+};
+
+template <typename Source, typename... Stages>
+struct pipeline_types {
+    using in_t = typename Source::sample_t;
+    using out_t = in_t;
+};
+
+template <typename Source, typename Stage, typename... Stages>
+struct pipeline_types<Source, Stage, Stages...> {
+    static_assert(std::is_same<typename Source::sample_t, typename Stage::in_t>::value,
+                  "each stage must take the sample type its predecessor produces");
+    struct stage_source { using sample_t = typename Stage::out_t; };
+
+    using in_t = typename Source::sample_t;
+    using out_t = typename pipeline_types<stage_source, Stages...>::out_t;
+};
+
+template <size_t Channels, size_t BlockFrames, typename Source, typename... Stages>
+class static_pipeline : public audio_stream<typename pipeline_types<Source, Stages...>::out_t> {
+public:
+    using in_t = typename pipeline_types<Source, Stages...>::in_t;
+    using out_t = typename pipeline_types<Source, Stages...>::out_t;
+    using stream_t = audio_stream<out_t>;
+    using stream_t::read;
+    using stream_t::write;
+
+    static constexpr size_t channels() { return Channels; }
+    static constexpr size_t block_frames() { return BlockFrames; }
+    static constexpr size_t block_samples() { return Channels * BlockFrames; }
+    static_assert(Channels > 0 && BlockFrames > 0, "a pipeline needs at least one channel and one frame per block");
+
+    explicit static_pipeline(Source* source, Stages... stages) : source_(source), stages_(stages...),
+        process_block_(&static_pipeline::process_block) {
+#if defined(ZAPAUDIO_X86)
+        if(get_cpu_features().avx2) process_block_ = &static_pipeline::process_block_avx2;
+#endif
+    }
+
+    template <size_t I>
+    typename std::tuple_element<I, std::tuple<Stages...>>::type& stage() { return std::get<I>(stages_); }
+
+    virtual size_t read(out_t* buffer, size_t len) override {
+        len -= len % Channels;
+        size_t count = 0;
+        while(count < len) {
+            const size_t want = std::min(block_samples(), len - count);
+            in_t* block = input_block(buffer + count, std::is_same<in_t, out_t>());
+            const size_t got = read_source(block, want);
+            (this->*process_block_)(block, buffer + count, got);
+            count += got;
+            if(got < want) break;
+        }
+        return count;
+    }
+
+    virtual size_t write(const out_t* buffer, size_t len) override { return 0; }
+
+private:
+    using block_fnc = void (static_pipeline::*)(const in_t*, out_t*, size_t) const;
+
+    // Runs stage I onwards, the overload for one past the last stage ends the recursion
+    out_t apply(out_t sample, std::integral_constant<size_t, sizeof...(Stages)>) const { return sample; }
+
+    template <size_t I, typename T>
+    out_t apply(T sample, std::integral_constant<size_t, I>) const {
+        return apply(std::get<I>(stages_)(sample), std::integral_constant<size_t, I + 1>());
+    }
+
+    out_t process(in_t sample) const { return apply(sample, std::integral_constant<size_t, 0>()); }
+
+    // A full block has a trip count known at compile time.  in and out may be the same buffer.
+    void process_block(const in_t* in, out_t* out, size_t len) const {
+        if(len == block_samples()) {
+            for(size_t i = 0; i != block_samples(); ++i) out[i] = process(in[i]);
+        } else {
+            for(size_t i = 0; i != len; ++i) out[i] = process(in[i]);
+        }
+    }
+
+#if defined(ZAPAUDIO_X86)
+    // The same loop compiled for AVX2, as the stages are inlined into it
+    ZAPAUDIO_TARGET_AVX2 void process_block_avx2(const in_t* in, out_t* out, size_t len) const {
+        if(len == block_samples()) {
+            for(size_t i = 0; i != block_samples(); ++i) out[i] = process(in[i]);
+        } else {
+            for(size_t i = 0; i != len; ++i) out[i] = process(in[i]);
+        }
+    }
+#endif
+
+    // Same sample type: read into the caller's buffer and process it in place
+    in_t* input_block(out_t* buffer, std::true_type) { return buffer; }
+    in_t* input_block(out_t* buffer, std::false_type) { return block_.data(); }
+
+    size_t read_source(in_t* buffer, size_t len) { return read_source(buffer, len, std::is_abstract<Source>()); }
+    size_t read_source(in_t* buffer, size_t len, std::true_type) { return source_->read(buffer, len); }
+    size_t read_source(in_t* buffer, size_t len, std::false_type) { return source_->Source::read(buffer, len); }
+
+    Source* source_;
+    std::tuple<Stages...> stages_;
+    block_fnc process_block_;
+    std::array<in_t, block_samples()> block_;
+};
+
+// Stereo in blocks of 256 frames
+template <typename Source, typename... Stages>
+using pipeline = static_pipeline<2, 256, Source, Stages...>;
+
+#endif //ZAPAUDIO_PIPELINE_HPP
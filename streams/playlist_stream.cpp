@@ -0,0 +1,262 @@
+#include "playlist_stream.hpp"
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include "log.hpp"
+#include "mp3_frame.hpp"
+#include "mp3_segment.hpp"
+
+// The trimmed PCM of one file: the pre-decoded lead followed by the rest of the stream, up to the end of the audio
+template <typename SampleT>
+struct playlist_stream<SampleT>::track_t : public audio_stream<SampleT> {
+    using audio_stream<SampleT>::read;
+    using audio_stream<SampleT>::write;
+
+    std::string filename;
+    std::unique_ptr<mp3_stream<SampleT>> stream;
+    std::vector<SampleT> lead;
+    size_t lead_pos;
+    size_t remaining;                           // Samples left in the stream after the lead
+    size_t samplerate;
+
+    explicit track_t(const std::string& name) : filename(name), lead_pos(0),
+            remaining(std::numeric_limits<size_t>::max()), samplerate(0) { }
+
+    virtual size_t read(SampleT* buffer, size_t len) override {
+        size_t count = std::min(len, lead.size() - lead_pos);
+        memcpy(buffer, lead.data() + lead_pos, sizeof(SampleT)*count);
+        lead_pos += count;
+
+        if(count < len && remaining > 0) {
+            const size_t ret = stream->read(buffer + count, std::min(len - count, remaining));
+            remaining -= ret;
+            count += ret;
+        }
+        return count;
+    }
+
+    virtual size_t write(const SampleT* buffer, size_t len) override { return 0; }
+};
+
+// The tracks of one sample rate back to back, the source of the playlist's resampler.  The segment ends when the next
+// track is at another rate, which is left for the playlist to start once the resampler has flushed this segment.
+template <typename SampleT>
+struct playlist_stream<SampleT>::splice_t : public audio_stream<SampleT> {
+    using audio_stream<SampleT>::read;
+    using audio_stream<SampleT>::write;
+
+    playlist_stream& owner;
+    size_t rate;                                // Of the tracks in the segment, 0 before the first
+    size_t next_rate;                           // Of the prepared track that ends the segment, 0 if none
+
+    explicit splice_t(playlist_stream& playlist) : owner(playlist), rate(0), next_rate(0) { }
+
+    // A track returns short only at its end, the next one continues in the same buffer
+    virtual size_t read(SampleT* buffer, size_t len) override {
+        size_t count = 0;
+        while(count < len) {
+            if(!owner.current_ && !owner.next_track(rate, next_rate)) break;
+            const size_t ret = owner.current_->read(buffer + count, len - count);
+            count += ret;
+            if(ret == 0) owner.retire_track();
+        }
+        return count;
+    }
+
+    virtual size_t write(const SampleT* buffer, size_t len) override { return 0; }
+
+    // Until the next track is ready an empty read is an underrun, not the end of the segment
+    virtual bool is_finished() const override { return !owner.current_ && (next_rate != 0 || owner.is_exhausted()); }
+};
+
+template <typename SampleT>
+playlist_stream<SampleT>::playlist_stream(size_t sample_rate, size_t lead_samples, mp3_input_mode input_mode,
+                                 resample_quality quality) : stream_t(nullptr), sample_rate_(sample_rate),
+        lead_samples_(lead_samples), input_mode_(input_mode), quality_(quality), generation_(0), preparing_(false),
+        shutdown_(false), started_(0) {
+    splice_ = std::make_unique<splice_t>(*this);
+    output_ = std::make_unique<resampler_stream<SampleT>>(splice_.get(), channels(), sample_rate_, sample_rate_,
+                                                          quality_);
+    worker_ = std::thread(&playlist_stream::worker_fnc, this);
+}
+
+template <typename SampleT>
+playlist_stream<SampleT>::~playlist_stream() {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        shutdown_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+template <typename SampleT>
+void playlist_stream<SampleT>::enqueue(const std::string& filename) {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        queue_.push_back(filename);
+    }
+    cv_.notify_all();
+}
+
+template <typename SampleT>
+void playlist_stream<SampleT>::clear() {
+    std::unique_ptr<track_t> next;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        queue_.clear();
+        next = std::move(next_);
+        ++generation_;
+    }
+    cv_.notify_all();
+}
+
+template <typename SampleT>
+size_t playlist_stream<SampleT>::pending() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return queue_.size() + (next_ ? 1 : 0) + (preparing_ ? 1 : 0);
+}
+
+template <typename SampleT>
+std::string playlist_stream<SampleT>::current() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return current_name_;
+}
+
+template <typename SampleT>
+void playlist_stream<SampleT>::worker_fnc() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while(true) {
+        cv_.wait(lock, [this]() { return shutdown_ || !retired_.empty() || (!next_ && !queue_.empty()); });
+        if(shutdown_) break;
+
+        if(!retired_.empty()) {
+            auto retired = std::move(retired_);
+            retired_.clear();
+            lock.unlock();
+            retired.clear();
+            lock.lock();
+            continue;
+        }
+
+        const std::string filename = queue_.front();
+        const size_t generation = generation_;
+        queue_.pop_front();
+        preparing_ = true;
+
+        lock.unlock();
+        auto track = prepare(filename);
+        lock.lock();
+
+        preparing_ = false;
+        if(generation == generation_) next_ = std::move(track);
+        cv_.notify_all();
+    }
+}
+
+template <typename SampleT>
+auto playlist_stream<SampleT>::prepare(const std::string& filename) -> std::unique_ptr<track_t> {
+    std::unique_ptr<track_t> track(new track_t(filename));
+    track->stream = std::make_unique<mp3_stream<SampleT>>(filename, 1024, nullptr, input_mode_);
+    if(!track->stream->start() || track->stream->get_header().samplerate <= 0) {
+        SM_LOG("Failed to open", filename);
+        return nullptr;
+    }
+
+    const size_t chans = channels();
+
+    // The LAME or VBRI tag gives the length of the audio; the decoder delay is added to the encoder's as LAME's decoder
+    // does
+    size_t skip = 0;
+    const auto& info = track->stream->get_scan_info();
+    if(info.has_gapless && info.frames > 0) {
+        skip = (info.encoder_delay + mp3_decoder_delay) * chans;
+        track->remaining = info.total_samples * chans;
+    }
+
+    // Decode the delay and the lead now so the start of the track costs nothing at the boundary
+    auto& lead = track->lead;
+    lead.resize(skip + lead_samples_);
+    size_t count = 0;
+    while(count < lead.size()) {
+        const size_t ret = track->stream->read(lead.data() + count, lead.size() - count);
+        if(ret == 0) break;
+        count += ret;
+    }
+
+    skip = std::min(skip, count);
+    lead.erase(lead.begin(), lead.begin() + skip);
+    lead.resize(std::min(count - skip, track->remaining));
+    track->remaining -= lead.size();
+    track->samplerate = size_t(track->stream->get_header().samplerate);
+    return track;
+}
+
+// Starts the prepared track if it is at rate, otherwise leaves it prepared and returns its rate in next_rate.  Never
+// waits for the worker, a track that is not ready yet is picked up by a later read.
+template <typename SampleT>
+bool playlist_stream<SampleT>::next_track(size_t rate, size_t& next_rate) {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if(!next_) return false;
+        if(next_->samplerate != rate) {
+            next_rate = next_->samplerate;
+            return false;
+        }
+
+        current_ = std::move(next_);
+        current_name_ = current_->filename;
+        started_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Wake the worker to prepare the track after this one
+    cv_.notify_all();
+    return true;
+}
+
+template <typename SampleT>
+bool playlist_stream<SampleT>::is_exhausted() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return !next_ && !preparing_ && queue_.empty();
+}
+
+template <typename SampleT>
+void playlist_stream<SampleT>::retire_track() {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        retired_.push_back(std::move(current_));
+        current_name_.clear();
+    }
+    cv_.notify_all();
+}
+
+template <typename SampleT>
+size_t playlist_stream<SampleT>::read(SampleT* buffer, size_t len) {
+    len -= len % channels();
+    size_t count = 0;
+    while(count < len) {
+        const size_t ret = output_->read(buffer + count, len - count);
+        count += ret;
+        if(ret != 0) continue;
+
+        // Nothing left of this segment: wait for the next track, or start it at its own rate once the tail is out
+        if(splice_->next_rate == 0) break;
+        splice_->rate = splice_->next_rate;
+        splice_->next_rate = 0;
+        output_->set_rates(splice_->rate, sample_rate_);
+    }
+    return count;
+}
+
+template <typename SampleT>
+bool playlist_stream<SampleT>::is_finished() const {
+    return splice_->next_rate == 0 && is_exhausted() && output_->is_finished();
+}
+
+template <typename SampleT>
+size_t playlist_stream<SampleT>::write(const SampleT* buffer, size_t len) {
+    return 0;
+}
+
+template class ZAPAUDIO_EXPORT playlist_stream<short>;
+template class ZAPAUDIO_EXPORT playlist_stream<float>;
@@ -0,0 +1,103 @@
+#ifndef ZAPAUDIO_PLAYLIST_STREAM_HPP
+#define ZAPAUDIO_PLAYLIST_STREAM_HPP
+
+/*
+ * Plays a queue of MP3 files back to back as one continuous stream, so tracks change without stopping the output.
+ *
+ * A background thread opens the next track while the current one plays: it parses the header, reads the LAME tag and
+ * decodes the first lead_samples past the encoder delay.  At the boundary the reader moves straight on to the
+ * prepared track within the same read, so the splice is sample accurate and no decode happens on the critical path.
+ * The encoder delay and padding recorded in the LAME tag are trimmed so gapless albums play without gaps; files
+ * without a tag are played in full.
+ *
+ * Tracks at other sample rates are resampled to the playlist's rate by one resampler that reads the spliced tracks, so
+ * its filter history runs on from one track into the next and consecutive tracks at the same rate join without a
+ * fade.  When the rate changes between tracks the resampler flushes the old track's tail and starts again at the new
+ * rate.
+ *
+ * playlist_stream<float> decodes each track to float (see mp3_stream), so a float output chain needs no s16 to float
+ * adapter and the tracks keep their headroom above full scale through the resampler.
+ *
+ * Finished tracks are destroyed by the background thread.  The reader never waits on it: if the next track is not ready
+ * at the boundary (a very short track, or one enqueued late) read() returns short and the track starts on a later read.
+ * is_finished() tells that underrun apart from the end of the playlist, when the queue is exhausted.
+ */
+
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <condition_variable>
+#include "audio_stream.hpp"
+#include "mp3_stream.hpp"
+#include "resampler_stream.hpp"
+
+template <typename SampleT>
+class ZAPAUDIO_EXPORT playlist_stream : public audio_stream<SampleT> {
+public:
+    using stream_t = audio_stream<SampleT>;
+    using stream_t::read;
+    using stream_t::write;
+
+    // lead_samples is the number of interleaved samples decoded ahead of each track's start
+    playlist_stream(size_t sample_rate=44100, size_t lead_samples=64*1024,
+                    mp3_input_mode input_mode=mp3_input_mode::stream,
+                    resample_quality quality=resample_quality::RQ_MEDIUM);
+    virtual ~playlist_stream();
+
+    void enqueue(const std::string& filename);
+    // Drops the queued tracks and the prepared next track, the current track plays on
+    void clear();
+
+    // Tracks queued or prepared but not yet started
+    size_t pending() const;
+    // Tracks started so far
+    size_t tracks_started() const { return started_.load(std::memory_order_relaxed); }
+    std::string current() const;
+
+    size_t channels() const { return 2; }
+    size_t sample_rate() const { return sample_rate_; }
+
+    virtual size_t read(SampleT* buffer, size_t len) override;
+    virtual size_t write(const SampleT* buffer, size_t len) override;
+    virtual bool is_finished() const override;
+
+protected:
+    struct track_t;
+    struct splice_t;
+
+    void worker_fnc();
+    std::unique_ptr<track_t> prepare(const std::string& filename);
+    bool next_track(size_t rate, size_t& next_rate);
+    bool is_exhausted() const;
+    void retire_track();
+
+private:
+    size_t sample_rate_;
+    size_t lead_samples_;
+    mp3_input_mode input_mode_;
+    resample_quality quality_;
+
+    // Only touched by the reader
+    std::unique_ptr<track_t> current_;
+    std::unique_ptr<splice_t> splice_;          // The tracks back to back at their own rate
+    std::unique_ptr<resampler_stream<SampleT>> output_;
+
+    mutable std::mutex lock_;                   // Guards everything below
+    std::condition_variable cv_;
+    std::deque<std::string> queue_;
+    std::unique_ptr<track_t> next_;
+    std::vector<std::unique_ptr<track_t>> retired_;
+    std::string current_name_;
+    size_t generation_;                         // Bumped by clear() to discard a track prepared from the old queue
+    bool preparing_;
+    bool shutdown_;
+
+    std::atomic<size_t> started_;
+    std::thread worker_;
+};
+
+#endif //ZAPAUDIO_PLAYLIST_STREAM_HPP
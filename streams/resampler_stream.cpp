@@ -0,0 +1,268 @@
+#include "resampler_stream.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "log.hpp"
+#include "dsp/resample.hpp"
+#include "dsp/sample_convert.hpp"
+
+namespace {
+
+struct quality_tier {
+    size_t taps;
+    size_t phases;
+    bool interpolate;
+    double beta;                    // Kaiser window
+    double passband;                // Cutoff as a fraction of the Nyquist rate
+};
+
+const quality_tier quality_tiers[] = {
+    {  8,  64, false,  5.0, 0.80 },
+    { 32, 128, true,   8.0, 0.90 },
+    { 64, 256, true,  10.0, 0.94 }
+};
+
+const double pi = 3.14159265358979323846;
+
+size_t gcd(size_t a, size_t b) {
+    while(b != 0) {
+        const size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth-order modified Bessel function of the first kind, for the Kaiser window
+double bessel_i0(double x) {
+    double sum = 1., term = 1.;
+    for(int k = 1; k != 32; ++k) {
+        term *= (x / (2. * k)) * (x / (2. * k));
+        sum += term;
+        if(term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+double sinc(double x) {
+    return std::abs(x) < 1e-9 ? 1. : std::sin(pi * x) / (pi * x);
+}
+
+inline void to_float(const float* in, float* out, size_t len) { memcpy(out, in, sizeof(float)*len); }
+inline void to_float(const short* in, float* out, size_t len) { convert_s16_f32(in, out, len); }
+
+// Float output is filtered in place, s16 output through the scratch buffer
+inline float* output_target(float* out, float* scratch) { return out; }
+inline float* output_target(short* out, float* scratch) { return scratch; }
+
+inline void resolve(const float* in, float* out, size_t len) { }
+inline void resolve(const float* in, short* out, size_t len) { convert_f32_s16(in, out, len); }
+
+}
+
+template <typename SampleT>
+resampler_stream<SampleT>::resampler_stream(stream_t* source, size_t channels, size_t in_rate, size_t out_rate,
+                                            resample_quality quality, size_t block) : audio_stream<SampleT>(source),
+        channels_(std::max<size_t>(channels, 1)), in_rate_(0), out_rate_(0), quality_(quality),
+        block_(std::max<size_t>(block, 1)), taps_(0), phases_(0), interpolate_(false), step_(1), num_(0), den_(1),
+        pos_(0), frac_(0), capacity_(0), fill_(0), flushed_(false), partial_(0) {
+    if(!set_rates(in_rate, out_rate)) SM_LOG("Invalid resampler rates", in_rate, out_rate);
+}
+
+template <typename SampleT>
+bool resampler_stream<SampleT>::set_rates(size_t in_rate, size_t out_rate) {
+    if(in_rate == 0 || out_rate == 0) return false;
+
+    in_rate_ = in_rate;
+    out_rate_ = out_rate;
+    design_filter();
+    reset();
+    return true;
+}
+
+template <typename SampleT>
+void resampler_stream<SampleT>::design_filter() {
+    const quality_tier& tier = quality_tiers[size_t(quality_)];
+
+    const size_t divisor = gcd(in_rate_, out_rate_);
+    den_ = out_rate_ / divisor;
+    step_ = (in_rate_ / divisor) / den_;
+    num_ = (in_rate_ / divisor) % den_;
+
+    // Downsampling narrows the passband to the output Nyquist rate, the filter lengthens to keep the transition width
+    const double scale = in_rate_ > out_rate_ ? double(out_rate_) / in_rate_ : 1.;
+    taps_ = (size_t(std::ceil(tier.taps / scale)) + 7) & ~size_t(7);
+    phases_ = tier.phases;
+    interpolate_ = tier.interpolate;
+
+    const double cutoff = tier.passband * scale;
+    const double half = taps_ / 2.;
+    const double norm = bessel_i0(tier.beta);
+
+    filter_.resize((phases_ + 1) * taps_);
+    row_.resize(taps_);
+
+    // Row p evaluates the input at p/phases_ of a sample past the centre tap, taps_/2 - 1
+    for(size_t p = 0; p <= phases_; ++p) {
+        float* row = filter_.data() + p * taps_;
+        const double frac = double(p) / phases_;
+        double sum = 0.;
+        for(size_t k = 0; k != taps_; ++k) {
+            const double dist = double(k) - (half - 1.) - frac;
+            const double r = dist / half;
+            const double window = r * r < 1. ? bessel_i0(tier.beta * std::sqrt(1. - r * r)) / norm : 0.;
+            const double h = cutoff * sinc(cutoff * dist) * window;
+            row[k] = float(h);
+            sum += h;
+        }
+        // Unity gain at DC for every phase, otherwise the phases ripple against each other
+        for(size_t k = 0; k != taps_; ++k) row[k] = float(row[k] / sum);
+    }
+
+    // Each refill must be able to hold the filter tail and a whole step of the input
+    const size_t frames = std::max(block_, std::max(taps_, step_ + 2));
+    capacity_ = taps_ + frames;
+    history_.resize(capacity_ * channels_);
+    input_.resize(frames * channels_);
+    scratch_.resize(frames * channels_);
+}
+
+template <typename SampleT>
+void resampler_stream<SampleT>::reset() {
+    // Pre-roll half the filter with silence so the first output lands on the first input sample
+    std::fill(history_.begin(), history_.end(), 0.f);
+    fill_ = taps_ / 2 - 1;
+    pos_ = 0;
+    frac_ = 0;
+    flushed_ = false;
+    partial_ = 0;
+}
+
+template <typename SampleT>
+size_t resampler_stream<SampleT>::produce(float* output, size_t frames) {
+    const resample_kernels& kernels = get_resample_kernels();
+
+    // Work on locals, the output stores would otherwise force the state to be reloaded on every frame
+    const size_t taps = taps_, channels = channels_, capacity = capacity_, fill = fill_;
+    const size_t step = step_, num = num_, den = den_;
+    const float* filter = filter_.data();
+    const float* history = history_.data();
+    float* row = row_.data();
+    size_t pos = pos_, frac = frac_, count = 0;
+
+    // frac < den, so a double holds the phase position exactly enough and avoids two divisions per frame
+    const double phase_scale = double(phases_) / den;
+
+    for(; count != frames && pos + taps <= fill; ++count) {
+        const double phase_pos = frac * phase_scale;
+        const size_t phase = size_t(int64_t(phase_pos));
+        const float t = float(phase_pos - double(phase));
+
+        const float* coeffs = filter + phase * taps;
+        if(interpolate_) {
+            kernels.blend(row, coeffs, coeffs + taps, t, taps);
+            coeffs = row;
+        } else if(t >= .5f) {
+            coeffs += taps;
+        }
+
+        for(size_t c = 0; c != channels; ++c) *output++ = kernels.dot(history + c * capacity + pos, coeffs, taps);
+
+        pos += step;
+        frac += num;
+        if(frac >= den) {
+            frac -= den;
+            ++pos;
+        }
+    }
+
+    pos_ = pos;
+    frac_ = frac;
+    return count;
+}
+
+template <typename SampleT>
+bool resampler_stream<SampleT>::refill() {
+    // Drop the history the filter has moved past, a large step may move past all of it
+    const size_t drop = std::min(pos_, fill_);
+    if(drop != 0) {
+        for(size_t c = 0; c != channels_; ++c) {
+            float* channel = history_.data() + c * capacity_;
+            memmove(channel, channel + drop, sizeof(float) * (fill_ - drop));
+        }
+        fill_ -= drop;
+        pos_ -= drop;
+    }
+
+    const size_t space = std::min(capacity_ - fill_, input_.size() / channels_);
+    const size_t got = this->parent()->read(input_.data() + partial_, space * channels_ - partial_);
+    const size_t samples = partial_ + got;
+    const size_t frames = samples / channels_;
+
+    if(got == 0) {
+        // An empty read from a source that has not finished is an underrun, try again on the next read
+        if(flushed_ || !this->parent()->is_finished()) return false;
+
+        // End of the source: run the filter off the last sample with silence
+        const size_t tail = std::min(taps_ / 2, capacity_ - fill_);
+        for(size_t c = 0; c != channels_; ++c) {
+            std::fill_n(history_.data() + c * capacity_ + fill_, tail, 0.f);
+        }
+        fill_ += tail;
+        flushed_ = true;
+        return true;
+    }
+
+    flushed_ = false;
+    to_float(input_.data(), scratch_.data(), frames * channels_);
+
+    for(size_t c = 0; c != channels_; ++c) {
+        float* channel = history_.data() + c * capacity_ + fill_;
+        const float* in = scratch_.data() + c;
+        for(size_t i = 0; i != frames; ++i, in += channels_) channel[i] = *in;
+    }
+    fill_ += frames;
+
+    // Keep the samples of a split frame so the channels stay aligned
+    partial_ = samples - frames * channels_;
+    if(partial_ != 0) std::copy_n(input_.data() + frames * channels_, partial_, input_.data());
+    return true;
+}
+
+template <typename SampleT>
+size_t resampler_stream<SampleT>::read(SampleT* buffer, size_t len) {
+    if(!this->parent()) return 0;
+    if(is_passthrough()) return this->parent()->read(buffer, len);
+
+    const size_t frames = len / channels_;
+    const size_t block = scratch_.size() / channels_;
+    size_t done = 0;
+
+    while(done != frames) {
+        const size_t chunk = std::min(frames - done, block);
+        SampleT* out = buffer + done * channels_;
+        float* target = output_target(out, scratch_.data());
+
+        const size_t count = produce(target, chunk);
+        resolve(target, out, count * channels_);
+        done += count;
+
+        if(count != chunk && !refill()) break;
+    }
+
+    return done * channels_;
+}
+
+template <typename SampleT>
+bool resampler_stream<SampleT>::is_finished() const {
+    if(!this->parent()) return true;
+    return is_passthrough() ? this->parent()->is_finished() : flushed_;
+}
+
+template <typename SampleT>
+size_t resampler_stream<SampleT>::write(const SampleT* buffer, size_t len) {
+    return 0;
+}
+
+template class ZAPAUDIO_EXPORT resampler_stream<short>;
+template class ZAPAUDIO_EXPORT resampler_stream<float>;
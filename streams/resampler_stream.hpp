@@ -0,0 +1,94 @@
+#ifndef ZAPAUDIO_RESAMPLER_STREAM_HPP
+#define ZAPAUDIO_RESAMPLER_STREAM_HPP
+
+/*
+ * Converts an interleaved stream between sample rates with a windowed-sinc polyphase filter, so files at 32 or 48 kHz
+ * can play on a device running at any other rate.  Any pair of integer rates is supported; the position is tracked
+ * exactly as a fraction of the reduced ratio, so there is no drift over long streams.
+ *
+ * The quality tier trades CPU for stopband attenuation and passband width:
+ *  RQ_LOW     8 taps, nearest of 64 phases                 cheap enough for large fan-out
+ *  RQ_MEDIUM  32 taps, 128 phases linearly interpolated    the default for playback
+ *  RQ_HIGH    64 taps, 256 phases linearly interpolated
+ * When downsampling, the cutoff moves down to the output Nyquist rate and the filter lengthens to match.
+ *
+ * Reads never allocate.  When a source read returns nothing and the source reports is_finished() the filter tail is
+ * flushed; otherwise the source has only run dry and the resampler returns what it has, carrying on with the next read.
+ * A source may return any number of samples, a trailing partial frame is kept for the next read.  Equal rates pass
+ * straight through.  set_rates() redesigns the filter and must not race with read().
+ */
+
+#include <vector>
+#include "audio_stream.hpp"
+
+enum class resample_quality {
+    RQ_LOW,
+    RQ_MEDIUM,
+    RQ_HIGH
+};
+
+template <typename SampleT>
+class ZAPAUDIO_EXPORT resampler_stream : public audio_stream<SampleT> {
+public:
+    using stream_t = audio_stream<SampleT>;
+    using stream_t::read;
+    using stream_t::write;
+
+    // block is the largest number of frames read from the source at a time
+    resampler_stream(stream_t* source, size_t channels, size_t in_rate, size_t out_rate,
+                     resample_quality quality=resample_quality::RQ_MEDIUM, size_t block=1024);
+    virtual ~resampler_stream() = default;
+
+    bool set_rates(size_t in_rate, size_t out_rate);
+    // Drops the filter history, call after seeking the source
+    void reset();
+
+    size_t channels() const { return channels_; }
+    size_t in_rate() const { return in_rate_; }
+    size_t out_rate() const { return out_rate_; }
+    resample_quality quality() const { return quality_; }
+    size_t taps() const { return taps_; }
+    bool is_passthrough() const { return in_rate_ == out_rate_; }
+
+    virtual size_t read(SampleT* buffer, size_t len) override final;
+    virtual size_t write(const SampleT* buffer, size_t len) override final;
+    // True once the filter tail has been flushed after the end of the source
+    virtual bool is_finished() const override;
+
+protected:
+    void design_filter();
+    size_t produce(float* output, size_t frames);
+    bool refill();
+
+private:
+    size_t channels_;
+    size_t in_rate_;
+    size_t out_rate_;
+    resample_quality quality_;
+    size_t block_;                  // Frames
+
+    // Filter: phases_ + 1 rows of taps_ coefficients, the last row is the first shifted by one input sample
+    size_t taps_;
+    size_t phases_;
+    bool interpolate_;
+    std::vector<float> filter_;
+    std::vector<float> row_;        // Blended coefficients of the current output
+
+    // Position in the input as pos_ + frac_/den_, advancing by step_ + num_/den_ per output frame
+    size_t step_;
+    size_t num_;
+    size_t den_;
+    size_t pos_;
+    size_t frac_;
+
+    // Deinterleaved input history, channel c starts at c*capacity_ and holds fill_ frames
+    size_t capacity_;
+    size_t fill_;
+    bool flushed_;
+    std::vector<float> history_;
+    std::vector<SampleT> input_;
+    size_t partial_;                // Samples of an incomplete frame held at the start of input_
+    std::vector<float> scratch_;
+};
+
+#endif //ZAPAUDIO_RESAMPLER_STREAM_HPP
@@ -7,6 +7,8 @@
 
 #include <cmath>
 #include <cassert>
+#include <limits>
+#include <algorithm>
 #include "audio_stream.hpp"
 
 /*
@@ -16,6 +18,9 @@
 template <typename SampleT>
 class sine_wave : public audio_stream<SampleT> {
 public:
+    using audio_stream<SampleT>::read;
+    using audio_stream<SampleT>::write;
+
     sine_wave(size_t hertz, size_t sample_rate=44100, size_t channels=2, audio_stream<SampleT>* parent=nullptr)
             : audio_stream<SampleT>(parent), hertz_(hertz), sample_rate_(44100), channels_(channels), curr_sample_(0) {
         period_ = std::max(sample_rate / hertz, size_t(1));
@@ -29,7 +34,7 @@ public:
 
     size_t get_hertz() const { return hertz_; }
 
-    virtual size_t read(typename audio_stream<SampleT>::buffer_t& buffer, size_t len) {
+    virtual size_t read(SampleT* buffer, size_t len) override {
         constexpr double PI = 3.14159265358979323846;
         constexpr double TWO_PI = 2.0 * PI;
 
@@ -46,7 +51,7 @@ public:
         return len;
     }
 
-    virtual size_t write(const typename audio_stream<SampleT>::buffer_t& buffer, size_t len) {
+    virtual size_t write(const SampleT* buffer, size_t len) override {
         return 0;
     }
 
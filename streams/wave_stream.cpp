@@ -0,0 +1,264 @@
+#include "wave_stream.hpp"
+#include <algorithm>
+#include <cstring>
+#include "log.hpp"
+#include "dsp/sample_convert.hpp"
+
+namespace {
+
+// The reader asks the kernel to fetch this far ahead of the read position and drops pages this far behind it
+constexpr size_t wave_readahead = 1024*1024;
+// A streamed reader converts out of the read-ahead through this much staging
+constexpr size_t wave_staging = 64*1024;
+
+constexpr uint16_t wave_format_pcm = 0x0001;
+constexpr uint16_t wave_format_float = 0x0003;
+constexpr uint16_t wave_format_extensible = 0xFFFE;
+
+uint16_t read_le16(const unsigned char* ptr) { return uint16_t(ptr[0] | (ptr[1] << 8)); }
+uint32_t read_le32(const unsigned char* ptr) { return uint32_t(read_le16(ptr)) | (uint32_t(read_le16(ptr + 2)) << 16); }
+uint64_t read_le64(const unsigned char* ptr) { return uint64_t(read_le32(ptr)) | (uint64_t(read_le32(ptr + 4)) << 32); }
+
+}
+
+bool parse_wave_header(const unsigned char* data, size_t size, wave_format& format) {
+    if(!data || size < 12 || std::memcmp(data + 8, "WAVE", 4) != 0) return false;
+
+    // RF64 is RIFF with 64 bit sizes in a ds64 chunk, for files beyond 4GB
+    const bool rf64 = std::memcmp(data, "RF64", 4) == 0;
+    if(!rf64 && std::memcmp(data, "RIFF", 4) != 0) return false;
+
+    bool have_fmt = false;
+    uint16_t tag = 0;
+    uint64_t ds64_data = 0;
+    size_t pos = 12;
+
+    while(size - pos >= 8) {
+        const unsigned char* chunk = data + pos;
+        const uint64_t chunk_size = read_le32(chunk + 4);
+        const size_t body = pos + 8;
+        const size_t avail = size - body;
+
+        if(std::memcmp(chunk, "fmt ", 4) == 0) {
+            if(chunk_size < 16 || avail < 16) return false;
+            tag = read_le16(chunk + 8);
+            format.channels = read_le16(chunk + 10);
+            format.sample_rate = read_le32(chunk + 12);
+            format.block_align = read_le16(chunk + 20);
+            format.bits_per_sample = read_le16(chunk + 22);
+            // The sub-format GUID starts with the format tag it extends
+            if(tag == wave_format_extensible && chunk_size >= 40 && avail >= 40) tag = read_le16(chunk + 32);
+            have_fmt = true;
+        } else if(rf64 && std::memcmp(chunk, "ds64", 4) == 0) {
+            if(chunk_size < 24 || avail < 24) return false;
+            ds64_data = read_le64(chunk + 16);
+        } else if(std::memcmp(chunk, "data", 4) == 0) {
+            if(!have_fmt) return false;     // fmt must precede data
+
+            if(tag == wave_format_pcm && format.bits_per_sample == 16) format.encoding = wave_encoding::pcm_s16;
+            else if(tag == wave_format_pcm && format.bits_per_sample == 24) format.encoding = wave_encoding::pcm_s24;
+            else if(tag == wave_format_pcm && format.bits_per_sample == 32) format.encoding = wave_encoding::pcm_s32;
+            else if(tag == wave_format_float && format.bits_per_sample == 32) format.encoding = wave_encoding::pcm_f32;
+            else return false;
+
+            if(format.channels == 0 || format.block_align != format.channels*format.bits_per_sample/8) return false;
+
+            uint64_t data_size = rf64 && chunk_size == 0xFFFFFFFF ? ds64_data : chunk_size;
+            data_size = std::min(data_size, uint64_t(avail));
+            format.data_offset = body;
+            format.frames = size_t(data_size) / format.block_align;
+            format.data_size = format.frames * format.block_align;
+            return true;
+        }
+
+        // Chunks are padded to an even length
+        const uint64_t next = uint64_t(body) + chunk_size + (chunk_size & 1);
+        if(next > size) break;
+        pos = size_t(next);
+    }
+    return false;
+}
+
+namespace {
+
+// Hands fnc(in, offset, count) the samples at src as an aligned T*, staging them through the stack if the data chunk
+// is not aligned for T
+template <typename T, typename Fnc>
+void with_aligned(const unsigned char* src, size_t count, Fnc fnc) {
+    if(reinterpret_cast<uintptr_t>(src) % alignof(T) == 0) {
+        fnc(reinterpret_cast<const T*>(src), size_t(0), count);
+        return;
+    }
+
+    const size_t block = 256;
+    T scratch[block];
+    for(size_t i = 0; i < count; i += block) {
+        const size_t n = std::min(block, count - i);
+        std::memcpy(scratch, src + i*sizeof(T), n*sizeof(T));
+        fnc(scratch, i, n);
+    }
+}
+
+void decode_samples(const unsigned char* src, wave_encoding encoding, short* dst, size_t count) {
+    switch(encoding) {
+        case wave_encoding::pcm_s16:
+            std::memcpy(dst, src, count*sizeof(short));
+            break;
+        case wave_encoding::pcm_s24:
+            // Keep the top 16 bits of each sample
+            for(size_t i = 0; i != count; ++i) dst[i] = short(read_le16(src + 3*i + 1));
+            break;
+        case wave_encoding::pcm_s32:
+            for(size_t i = 0; i != count; ++i) dst[i] = short(read_le16(src + 4*i + 2));
+            break;
+        case wave_encoding::pcm_f32:
+            with_aligned<float>(src, count, [dst](const float* in, size_t offset, size_t n) {
+                convert_f32_s16(in, reinterpret_cast<int16_t*>(dst) + offset, n);
+            });
+            break;
+    }
+}
+
+void decode_samples(const unsigned char* src, wave_encoding encoding, float* dst, size_t count) {
+    switch(encoding) {
+        case wave_encoding::pcm_s16:
+            with_aligned<int16_t>(src, count, [dst](const int16_t* in, size_t offset, size_t n) {
+                convert_s16_f32(in, dst + offset, n);
+            });
+            break;
+        case wave_encoding::pcm_s24:
+            convert_s24_f32(src, dst, count);
+            break;
+        case wave_encoding::pcm_s32:
+            with_aligned<int32_t>(src, count, [dst](const int32_t* in, size_t offset, size_t n) {
+                convert_s32_f32(in, dst + offset, n);
+            });
+            break;
+        case wave_encoding::pcm_f32:
+            std::memcpy(dst, src, count*sizeof(float));
+            break;
+    }
+}
+
+}
+
+template <typename SampleT>
+wave_stream<SampleT>::wave_stream(const std::string& filename, stream_t* parent, wave_input_mode input_mode) :
+        stream_t(parent), filename_(filename), input_mode_(input_mode), format_(), position_(0), prefetch_pos_(0),
+        release_pos_(0), metrics_("wave_stream") {
+}
+
+template <typename SampleT>
+bool wave_stream<SampleT>::start(const std::string& filename) {
+    filename_ = filename;
+    return start();
+}
+
+template <typename SampleT>
+bool wave_stream<SampleT>::start() {
+    map_.close();
+    input_.close();
+    format_ = wave_format();
+    position_ = 0;
+
+    if(!map_.open(filename_)) return false;
+
+    if(!parse_wave_header(map_.data(), map_.size(), format_)) {
+        SM_LOG("Not a supported WAVE file:", filename_);
+        map_.close();
+        format_ = wave_format();
+        return false;
+    }
+
+    // A streamed reader only maps the file for the header
+    if(input_mode_ == wave_input_mode::stream) {
+        map_.close();
+        if(!input_.open(filename_, format_.data_offset)) {
+            format_ = wave_format();
+            return false;
+        }
+        staging_.resize(std::max(wave_staging / format_.block_align, size_t(1)) * format_.block_align);
+        return true;
+    }
+
+    map_.advise_sequential();
+    prefetch_pos_ = release_pos_ = format_.data_offset;
+    read_ahead();
+    return true;
+}
+
+template <typename SampleT>
+bool wave_stream<SampleT>::seek(size_t frame) {
+    if((!map_.is_open() && !input_.is_open()) || frame > format_.frames) return false;
+    position_ = frame;
+    if(input_mode_ == wave_input_mode::stream) return input_.seek(format_.data_offset + frame*format_.block_align);
+
+    prefetch_pos_ = release_pos_ = format_.data_offset + frame*format_.block_align;
+    read_ahead();
+    return true;
+}
+
+template <typename SampleT>
+size_t wave_stream<SampleT>::read(SampleT* buffer, size_t len) {
+    if(!map_.is_open() && !input_.is_open()) return 0;
+
+    const size_t frames = std::min(len / format_.channels, format_.frames - position_);
+    size_t count = 0;
+    if(input_mode_ == wave_input_mode::stream) {
+        count = read_streamed(buffer, frames);
+    } else {
+        count = frames*format_.channels;
+        decode_samples(map_.data() + format_.data_offset + position_*format_.block_align, format_.encoding, buffer,
+                       count);
+        position_ += frames;
+        read_ahead();
+    }
+
+    metrics_.record_read(len, count);
+    return count;
+}
+
+template <typename SampleT>
+size_t wave_stream<SampleT>::read_streamed(SampleT* buffer, size_t frames) {
+    const size_t pass = staging_.size() / format_.block_align;
+    size_t count = 0;
+    while(count < frames) {
+        const size_t want = std::min(frames - count, pass);
+        const size_t got = input_.read(staging_.data(), want*format_.block_align) / format_.block_align;
+        decode_samples(staging_.data(), format_.encoding, buffer + count*format_.channels, got*format_.channels);
+        count += got;
+        position_ += got;
+
+        // The file could not be read to the end of the data chunk, end the stream here
+        if(got < want) {
+            format_.frames = position_;
+            break;
+        }
+    }
+    return count*format_.channels;
+}
+
+template <typename SampleT>
+size_t wave_stream<SampleT>::write(const SampleT* buffer, size_t len) {
+    return 0;
+}
+
+template <typename SampleT>
+void wave_stream<SampleT>::read_ahead() {
+    const size_t pos = format_.data_offset + position_*format_.block_align;
+    if(pos + wave_readahead/2 < prefetch_pos_) return;
+
+    // A read longer than the window leaves it behind the read position, advising pages already consumed
+    prefetch_pos_ = std::max(prefetch_pos_, pos);
+    map_.prefetch(prefetch_pos_, wave_readahead);
+    prefetch_pos_ += wave_readahead;
+
+    if(pos > release_pos_ + 2*wave_readahead) {
+        const size_t behind = pos - wave_readahead;
+        map_.release(release_pos_, behind - release_pos_);
+        release_pos_ = behind;
+    }
+}
+
+template class ZAPAUDIO_EXPORT wave_stream<short>;
+template class ZAPAUDIO_EXPORT wave_stream<float>;
@@ -5,105 +5,103 @@
 #ifndef SIMPLE_MP3_WAVE_STREAM_HPP
 #define SIMPLE_MP3_WAVE_STREAM_HPP
 
-#include <cassert>
+/*
+ * Streams a WAVE file from a read-only mapping or through a read_ahead_file.  start() walks the RIFF chunks, so LIST,
+ * fact, cue and other chunks before or after the audio are skipped rather than rejected.  16, 24 and 32 bit integer
+ * and 32 bit float PCM are supported, including WAVE_FORMAT_EXTENSIBLE.  Mapped, read() converts straight from the
+ * mapping into the caller's buffer, and a page that is not resident faults on the reading thread.  Streamed, the
+ * audio is read ahead asynchronously and read() converts out of completed reads through a small staging buffer.
+ * Either way there is no intermediate ring and nothing is allocated after start().  Samples are interleaved in the
+ * file's channel order.
+ *
+ * A data chunk that claims more than the file holds, as written by recorders that never patched the header, is
+ * clamped to the end of the file.
+ */
+
 #include <string>
-#include <fstream>
+#include <vector>
+#include <cstdint>
 #include "audio_stream.hpp"
-#include "buffers/ring_buffer.hpp"
-
-struct WAVE {
-    char chunk_id[4];
-    uint32_t chunk_size;
-    char format_id[4];
-    char chunk1_id[4];
-    uint32_t chunk1_size;
-    uint16_t audio_format;
-    uint16_t num_channels;
-    uint32_t sample_rate;
-    uint32_t byte_rate;
-    uint16_t block_align;
-    uint16_t bits_per_sample;
-    char chunk2_id[4];
-    uint32_t chunk2_size;
-
-    bool is_valid() const {
-        return ((strncmp(chunk_id, "RIFF", 4) == 0) &&
-                (strncmp(format_id, "WAVE", 4) == 0) &&
-                (strncmp(chunk1_id, "fmt ", 4) == 0) &&
-                (strncmp(chunk2_id, "data", 4) == 0));
-    }
+#include "buffers/mapped_file.hpp"
+#include "buffers/read_ahead_file.hpp"
+#include "metrics.hpp"
+
+enum class wave_encoding {
+    pcm_s16,
+    pcm_s24,
+    pcm_s32,
+    pcm_f32
+};
+
+enum class wave_input_mode {
+    mapped,
+    stream
 };
 
-constexpr size_t buffer_scale = 100;
-constexpr size_t buffer_fetch = 50;
-constexpr size_t buffer_update = 50;
+struct ZAPAUDIO_EXPORT wave_format {
+    wave_encoding encoding;
+    size_t channels;
+    size_t sample_rate;
+    size_t bits_per_sample;     // Container bits, as stored
+    size_t block_align;         // Bytes per frame
+    size_t frames;              // Per channel
+    size_t data_offset;         // Of the first sample in the file
+    size_t data_size;           // Bytes of audio
+};
+
+// Walks the RIFF chunks of the image in [data, data + size) and fills format.  Returns false if it is not a
+// supported WAVE file.
+ZAPAUDIO_EXPORT bool parse_wave_header(const unsigned char* data, size_t size, wave_format& format);
 
-class wave_stream : public audio_stream<short> {
+template <typename SampleT>
+class ZAPAUDIO_EXPORT wave_stream : public audio_stream<SampleT> {
 public:
-    wave_stream(const std::string& filename, size_t frame_size, audio_stream<short>* parent) : audio_stream<short>(parent),
-        filename_(filename), frame_size_(frame_size), buffer_(buffer_scale*frame_size_) { }
-    virtual ~wave_stream() { if(file_.is_open()) file_.close(); }
-
-    bool is_open() const { return file_.is_open(); }
-
-    const WAVE& get_header() const { return header_; }
-
-    bool start() {
-        file_ = std::ifstream(filename_, std::ios_base::binary | std::ios_base::in);
-
-        if(file_.is_open()) {
-            file_.seekg(0, std::ios::end);
-            file_length_ = file_.tellg();
-            file_.seekg(0, std::ios::beg);
-            if(!read_header(header_) || !header_.is_valid()) {
-                file_.close();
-                return false;
-            }
-            return fill_buffer();
-        }
-        return false;
-    }
-
-    virtual size_t read(buffer_t& buffer, size_t len) {
-        auto l = buffer_.read(buffer.data(), len);
-        if(buffer_.size() < buffer_update*frame_size_) fill_buffer();
-        return l;
-    }
-
-    virtual size_t write(const buffer_t& buffer, size_t len) {
-        return 0;
-    }
+    using stream_t = audio_stream<SampleT>;
+    using stream_t::read;
+    using stream_t::write;
+
+    explicit wave_stream(const std::string& filename, stream_t* parent=nullptr,
+                         wave_input_mode input_mode=wave_input_mode::mapped);
+    virtual ~wave_stream() = default;
+
+    bool start();
+    bool start(const std::string& filename);
+
+    bool is_open() const { return (map_.is_open() || input_.is_open()) && position_ < format_.frames; }
+    virtual bool is_finished() const override { return !is_open(); }
+    wave_input_mode get_input_mode() const { return input_mode_; }
+    const std::string& get_filename() const { return filename_; }
+    const wave_format& get_header() const { return format_; }
+    const stage_metrics& get_metrics() const { return metrics_; }
+
+    size_t channels() const { return format_.channels; }
+    size_t sample_rate() const { return format_.sample_rate; }
+    // Current position in frames
+    size_t tell() const { return position_; }
+    bool seek(size_t frame);
+
+    // Reads whole frames only, len is rounded down to a multiple of the channel count
+    virtual size_t read(SampleT* buffer, size_t len) override;
+    virtual size_t write(const SampleT* buffer, size_t len) override;
 
 protected:
-    bool read_header(WAVE& header) {
-        if(file_.is_open() && file_.tellg() == 0) {
-            file_.read(reinterpret_cast<char*>(&header), sizeof(WAVE));
-            return file_.tellg() == sizeof(WAVE);
-        }
-        return false;
-    }
-
-    bool fill_buffer() {
-        if(file_.is_open() && !file_.eof()) {
-            if(buffer_.capacity() < buffer_update*frame_size_) return false;
-            auto rd = std::min(size_t(file_length_ - file_.tellg()), buffer_fetch*frame_size_);
-            std::vector<short> arr(rd);
-            file_.read(reinterpret_cast<char*>(arr.data()), rd*sizeof(short));
-            buffer_.write(arr.data(), rd);
-            auto e = file_.tellg();
-            if(e == -1) file_.close();
-            return true;
-        }
-        return false;
-    }
+    void read_ahead();
+    size_t read_streamed(SampleT* buffer, size_t frames);
 
 private:
     std::string filename_;
-    size_t file_length_;
-    size_t frame_size_;
-    ring_buffer<short,int,false> buffer_;
-    WAVE header_;
-    std::ifstream file_;
+    wave_input_mode input_mode_;
+    mapped_file map_;
+    read_ahead_file input_;
+    std::vector<unsigned char> staging_;
+    wave_format format_;
+    size_t position_;
+    size_t prefetch_pos_;
+    size_t release_pos_;
+    stage_metrics metrics_;
 };
 
+using wave_stream_s16 = wave_stream<short>;
+using wave_stream_f32 = wave_stream<float>;
+
 #endif //SIMPLE_MP3_WAVE_STREAM_HPP
@@ -0,0 +1,397 @@
+/*
+ * zapaudio_transcode: decodes MP3 files to WAV or raw PCM, or re-encodes them, on a pool of workers.
+ *
+ * zapaudio_transcode [-o outdir] [--raw | --mp3 kbps | --vbr quality] [-j workers] [--io n] [--memory MB]
+ *                    file_or_dir...
+ *
+ * Directories are searched recursively for .mp3 files.  Each worker owns a file_decoder (its own decoder context) and
+ * decodes one file at a time.  Reading and writing files is limited to --io concurrent operations so a spinning disk
+ * or network share is not thrashed by every worker at once, and the decoded PCM in flight is held under --memory; a
+ * worker waits for budget before it loads its next file.  Without -o the output is written next to each input.
+ *
+ * --mp3 re-encodes at a constant bitrate and --vbr at a variable bitrate quality (0 best to 9).  Re-encoded files keep
+ * the .mp3 extension, so they need -o.
+ */
+
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <limits>
+#include <cstring>
+#include <cstdlib>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#endif
+#include "file_decoder.hpp"
+#include "wave_writer.hpp"
+#include "streams/mp3_frame.hpp"
+#include "streams/mp3_encoder_stream.hpp"
+
+namespace {
+
+// A counting semaphore over an arbitrary resource.  A request larger than the whole capacity is granted once nothing
+// else holds the resource, so a single oversized file cannot deadlock the pool.
+class resource_gate {
+public:
+    explicit resource_gate(size_t capacity) : capacity_(capacity), in_use_(0) { }
+
+    void acquire(size_t amount) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this, amount]() { return in_use_ == 0 || in_use_ + amount <= capacity_; });
+        in_use_ += amount;
+    }
+
+    void release(size_t amount) {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            in_use_ -= amount;
+        }
+        cv_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    size_t in_use_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+struct gate_guard {
+    gate_guard(resource_gate& gate, size_t amount) : gate_(gate), amount_(amount) { gate_.acquire(amount_); }
+    ~gate_guard() { gate_.release(amount_); }
+
+    resource_gate& gate_;
+    size_t amount_;
+};
+
+struct job {
+    std::string input;
+    std::string output;
+};
+
+struct job_result {
+    bool ok;
+    uint64_t input_bytes;
+    double audio_seconds;
+    double wall_seconds;
+};
+
+struct options {
+    std::string out_dir;
+    file_format format = file_format::wav;
+    bool encode = false;
+    mp3_encoder_settings encoder;
+    size_t workers = 0;
+    size_t io = 2;
+    size_t memory_mb = 1024;
+};
+
+bool is_directory(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+uint64_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? uint64_t(st.st_size) : 0;
+}
+
+bool has_mp3_extension(const std::string& name) {
+    if(name.size() < 4) return false;
+    std::string ext = name.substr(name.size() - 4);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(std::tolower(c)); });
+    return ext == ".mp3";
+}
+
+typedef std::set<std::pair<uint64_t, uint64_t>> directory_set;
+
+// Collects the .mp3 files under dir, rel is the path relative to the root given on the command line.  Directories are
+// remembered by device and inode in visited, so a symlink back up the tree is not walked again.
+void walk_directory(const std::string& dir, const std::string& rel,
+                    std::vector<std::pair<std::string, std::string>>& files, directory_set& visited) {
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA((dir + "\\*").c_str(), &data);
+    if(handle == INVALID_HANDLE_VALUE) return;
+    do {
+        const std::string name = data.cFileName;
+        if(name == "." || name == "..") continue;
+        // stat has no inode to recognise a directory by on Windows, so junctions and links are not followed
+        if(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) continue;
+        const std::string path = dir + "\\" + name, child = rel.empty() ? name : rel + "/" + name;
+        if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) walk_directory(path, child, files, visited);
+        else if(has_mp3_extension(name)) files.emplace_back(path, child);
+    } while(FindNextFileA(handle, &data));
+    FindClose(handle);
+#else
+    struct stat st;
+    if(stat(dir.c_str(), &st) != 0) return;
+    if(!visited.insert(std::make_pair(uint64_t(st.st_dev), uint64_t(st.st_ino))).second) return;
+
+    DIR* handle = opendir(dir.c_str());
+    if(!handle) return;
+    while(struct dirent* entry = readdir(handle)) {
+        const std::string name = entry->d_name;
+        if(name == "." || name == "..") continue;
+        const std::string path = dir + "/" + name, child = rel.empty() ? name : rel + "/" + name;
+        if(is_directory(path)) walk_directory(path, child, files, visited);
+        else if(has_mp3_extension(name)) files.emplace_back(path, child);
+    }
+    closedir(handle);
+#endif
+}
+
+bool make_directory(const std::string& path) {
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+// Creates every directory leading up to the file at path
+bool make_parent_directories(const std::string& path) {
+    for(size_t pos = path.find_first_of("/\\", 1); pos != std::string::npos; pos = path.find_first_of("/\\", pos + 1)) {
+        if(!make_directory(path.substr(0, pos))) return false;
+    }
+    return true;
+}
+
+std::string output_name(const std::string& rel, const options& opts) {
+    const std::string stem = has_mp3_extension(rel) ? rel.substr(0, rel.size() - 4) : rel;
+    if(opts.encode) return stem + ".mp3";
+    return stem + (opts.format == file_format::wav ? ".wav" : ".raw");
+}
+
+// Estimates the decoded size from the first frame: exact when there is a Xing/Info frame count, otherwise assumes a
+// constant bitrate.  Used only to budget memory, so an error costs concurrency rather than correctness.
+uint64_t estimate_pcm_bytes(const std::string& filename, uint64_t size) {
+    std::ifstream file(filename, std::ios_base::binary | std::ios_base::in);
+    std::vector<byte> probe(64*1024);
+    file.read(reinterpret_cast<char*>(probe.data()), std::streamsize(probe.size()));
+    const size_t len = size_t(file.gcount());
+
+    size_t offset = id3v2_length(probe.data(), len);
+    mp3_frame_header hdr;
+    while(offset + 4 <= len && !parse_frame_header(probe.data() + offset, hdr)) ++offset;
+    if(offset + 4 > len) return size * 12;      // No header in the probe window, assume 128kbps stereo
+
+    // The decoder always interleaves two channels, a mono file decodes to as many bytes as a stereo one
+    const uint64_t bytes_per_frame = uint64_t(hdr.samples) * 2 * sizeof(short);
+    if(offset + hdr.frame_bytes <= len && is_xing_frame(probe.data() + offset, hdr)) {
+        const byte* tag = probe.data() + offset + 4 + hdr.side_info_bytes();
+        if(offset + 4 + hdr.side_info_bytes() + 12 <= len && (tag[7] & 0x01)) {
+            const uint64_t frames = (uint64_t(tag[8]) << 24) | (uint64_t(tag[9]) << 16) | (uint64_t(tag[10]) << 8) | tag[11];
+            return frames * bytes_per_frame;
+        }
+    }
+    return hdr.frame_bytes ? (size - offset) / hdr.frame_bytes * bytes_per_frame : size * 12;
+}
+
+bool read_file(const std::string& filename, std::vector<byte>& contents) {
+    std::ifstream file(filename, std::ios_base::binary | std::ios_base::in);
+    if(!file.is_open()) return false;
+    file.seekg(0, std::ios_base::end);
+    contents.resize(size_t(file.tellg()));
+    file.seekg(0, std::ios_base::beg);
+    file.read(reinterpret_cast<char*>(contents.data()), std::streamsize(contents.size()));
+    return bool(file);
+}
+
+job_result transcode(file_decoder& decoder, const job& task, const options& opts, resource_gate& io_gate,
+                     resource_gate& memory_gate) {
+    job_result result = { false, file_size(task.input), 0., 0. };
+    const auto start = std::chrono::steady_clock::now();
+
+    // The decoded buffer can reach twice its final size while it grows
+    const uint64_t budget = result.input_bytes + 2 * estimate_pcm_bytes(task.input, result.input_bytes);
+    gate_guard memory(memory_gate, size_t(std::min<uint64_t>(budget, std::numeric_limits<size_t>::max())));
+
+    std::vector<byte> contents;
+    {
+        gate_guard io(io_gate, 1);
+        if(!read_file(task.input, contents)) {
+            std::cerr << "Failed to read " << task.input << std::endl;
+            return result;
+        }
+    }
+
+    auto samples = decoder.decode_buffer(contents);
+    std::vector<byte>().swap(contents);
+    const mp3_format& format = decoder.get_format();
+    if(samples.size() == 0 || format.channels <= 0 || format.samplerate <= 0) {
+        std::cerr << "Failed to decode " << task.input << std::endl;
+        return result;
+    }
+
+    if(opts.encode) {
+        // Encode in memory, the encoder is busy for much longer than the write takes and should not hold the gate
+        mp3_encoder_settings settings = opts.encoder;
+        settings.sample_rate = size_t(format.samplerate);
+        settings.channels = 2;          // The decoder always interleaves two channels
+
+        std::vector<byte> encoded;
+        mp3_encoder_stream encoder(settings);
+        encoder.open([&encoded](const byte* data, size_t len) {
+            encoded.insert(encoded.end(), data, data + len);
+            return true;
+        });
+        encoder.write(samples.read_ptr(), samples.size());
+        if(!encoder.close()) {
+            std::cerr << "Failed to encode " << task.input << std::endl;
+            return result;
+        }
+
+        const auto& tag = encoder.get_tag_frame();
+        std::copy(tag.begin(), tag.end(), encoded.begin());
+
+        gate_guard io(io_gate, 1);
+        std::ofstream file;
+        if(make_parent_directories(task.output)) file.open(task.output, std::ios_base::binary | std::ios_base::out);
+        if(!file.write(reinterpret_cast<const char*>(encoded.data()), std::streamsize(encoded.size()))) {
+            std::cerr << "Failed to write " << task.output << std::endl;
+            return result;
+        }
+    } else {
+        gate_guard io(io_gate, 1);
+        wave_writer writer;
+        if(!make_parent_directories(task.output) ||
+           !writer.open(task.output, 2, size_t(format.samplerate), sample_format::s16, opts.format) ||
+           !writer.write(samples.read_ptr(), samples.size() * sizeof(short))) {
+            std::cerr << "Failed to write " << task.output << std::endl;
+            return result;
+        }
+    }
+
+    result.ok = true;
+    result.audio_seconds = double(samples.size()) / (2 * format.samplerate);
+    result.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+int usage(const char* name) {
+    std::cerr << "usage: " << name << " [-o outdir] [--raw | --mp3 kbps | --vbr quality] [-j workers] [--io n]"
+              << " [--memory MB] file_or_dir..." << std::endl;
+    return 1;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    options opts;
+    std::vector<std::string> inputs;
+
+    for(int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "-o" && has_value) opts.out_dir = argv[++i];
+        else if(arg == "--raw") opts.format = file_format::raw;
+        else if(arg == "--mp3" && has_value) {
+            opts.encode = true;
+            opts.encoder.mode = mp3_bitrate_mode::cbr;
+            opts.encoder.bitrate = std::atoi(argv[++i]);
+        } else if(arg == "--vbr" && has_value) {
+            opts.encode = true;
+            opts.encoder.mode = mp3_bitrate_mode::vbr;
+            opts.encoder.vbr_quality = std::min(std::max(std::atoi(argv[++i]), 0), 9);
+        }
+        else if(arg == "-j" && has_value) opts.workers = size_t(std::atoi(argv[++i]));
+        else if(arg == "--io" && has_value) opts.io = std::max(size_t(std::atoi(argv[++i])), size_t(1));
+        else if(arg == "--memory" && has_value) opts.memory_mb = std::max(size_t(std::atoi(argv[++i])), size_t(1));
+        else if(!arg.empty() && arg[0] == '-') return usage(argv[0]);
+        else inputs.push_back(arg);
+    }
+
+    if(inputs.empty()) return usage(argv[0]);
+    if(opts.encode && opts.out_dir.empty()) {
+        std::cerr << "Re-encoding needs -o, the output would replace the input" << std::endl;
+        return 1;
+    }
+
+    // Each input maps to an output path: beside the input, or under outdir mirroring the input's directory layout
+    std::vector<job> jobs;
+    for(const auto& input : inputs) {
+        std::vector<std::pair<std::string, std::string>> files;
+        if(is_directory(input)) {
+            directory_set visited;
+            walk_directory(input, "", files, visited);
+        } else {
+            const size_t slash = input.find_last_of("/\\");
+            files.emplace_back(input, slash == std::string::npos ? input : input.substr(slash + 1));
+        }
+
+        for(const auto& file : files) {
+            const std::string out = opts.out_dir.empty() ? output_name(file.first, opts)
+                                                         : opts.out_dir + "/" + output_name(file.second, opts);
+            jobs.push_back({ file.first, out });
+        }
+    }
+
+    if(jobs.empty()) {
+        std::cerr << "No MP3 files found" << std::endl;
+        return 1;
+    }
+
+    if(opts.workers == 0) opts.workers = std::max(std::thread::hardware_concurrency(), 1u);
+    opts.workers = std::min(opts.workers, jobs.size());
+
+    resource_gate io_gate(opts.io);
+    resource_gate memory_gate(opts.memory_mb * 1024 * 1024);
+    std::vector<job_result> results(jobs.size());
+    std::atomic<size_t> next(0);
+    std::mutex report_mtx;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for(size_t w = 0; w != opts.workers; ++w) {
+        workers.emplace_back([&]() {
+            file_decoder decoder;
+            if(!decoder.initialise()) return;
+
+            for(size_t i = next.fetch_add(1); i < jobs.size(); i = next.fetch_add(1)) {
+                results[i] = transcode(decoder, jobs[i], opts, io_gate, memory_gate);
+
+                const auto& r = results[i];
+                if(!r.ok) continue;
+                std::lock_guard<std::mutex> lock(report_mtx);
+                std::printf("%s -> %s: %.1f MB, %.1f s audio in %.2f s (%.0fx realtime)\n", jobs[i].input.c_str(),
+                            jobs[i].output.c_str(), r.input_bytes / 1e6, r.audio_seconds, r.wall_seconds,
+                            r.wall_seconds > 0. ? r.audio_seconds / r.wall_seconds : 0.);
+            }
+
+            decoder.shutdown();
+        });
+    }
+
+    for(auto& worker : workers) worker.join();
+
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t ok = 0;
+    double audio = 0., bytes = 0.;
+    for(const auto& r : results) {
+        if(!r.ok) continue;
+        ++ok;
+        audio += r.audio_seconds;
+        bytes += r.input_bytes;
+    }
+
+    std::printf("%zu of %zu files decoded with %zu workers in %.2f s: %.1f s audio (%.0fx realtime), %.1f MB/s input\n",
+                ok, jobs.size(), opts.workers, wall, audio, wall > 0. ? audio / wall : 0., wall > 0. ? bytes / 1e6 / wall : 0.);
+    return ok == jobs.size() ? 0 : 1;
+}
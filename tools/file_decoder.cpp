@@ -6,41 +6,31 @@
 #include "../log.hpp"
 #include "file_decoder.hpp"
 #include <cassert>
-#ifdef _WIN32
-#include <lame.h>
-#else
-#include <lame/lame.h>
-#endif //_WIN32
 #include <cstring>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include "streams/mp3_seek_index.hpp"
+#include "streams/mp3_segment.hpp"
+#include "streams/pcm_cache.hpp"
+#include "dsp/sync_scan.hpp"
 
 using byte = unsigned char;
 
+// Segments shorter than this spend too much of their time in the preroll frames
+constexpr size_t min_segment_frames = 256;
+
 bool strip_header(block_buffer<byte>& buffer);
 bool is_syncword_mp123(const byte* ptr);
+bool load_file(const std::string& filename, std::vector<byte>& contents);
 
 bool file_decoder::initialise() {
-    lame_ = lame_init();
-    if(!lame_) {
-        SM_LOG("LAME failed to initialise");
-        return false;
-    }
-
-    lame_set_decode_only(lame_, 1);
-    lame_set_num_samples(lame_, std::numeric_limits<unsigned int>::max());
-
-    hip_ = hip_decode_init();
-    if(!hip_) {
-        SM_LOG("LAME HIP failed to initialise");
-        return false;
-    }
-    return true;
+    if(!decoder_) decoder_ = make_mp3_decoder();
+    return decoder_ != nullptr;
 }
 
 void file_decoder::shutdown() {
-    hip_decode_exit(hip_);
-    hip_ = nullptr;
-    lame_close(lame_);
-    lame_ = nullptr;
+    decoder_.reset();
 }
 
 int zip(block_buffer<short>& buffer, short* left_pcm, short* right_pcm, int len) {
@@ -52,22 +42,25 @@ int zip(block_buffer<short>& buffer, short* left_pcm, short* right_pcm, int len)
 }
 
 block_buffer<short> file_decoder::decode_file(const std::string& filename) {
+    if(pcm_cache::instance().enabled()) return decode_cached(filename, 1);
+
+    std::vector<byte> buffer;
+    if(!load_file(filename, buffer)) return block_buffer<short>();
+    SM_LOG("File Loaded, size =", buffer.size() / (1000000.f), "MB");
+    return decode_buffer(buffer);
+}
+
+block_buffer<short> file_decoder::decode_buffer(const std::vector<byte>& contents) {
     block_buffer<byte> file_contents;
     block_buffer<short> sample_buffer;
 
-    std::ifstream file;
-    file.open(filename, std::ios_base::binary | std::ios_base::in);
-    if(!file.is_open()) { SM_LOG("Error opening file"); return sample_buffer; }
-    file.seekg(0, std::ios_base::end);
-    auto file_len = file.tellg();
-    file.seekg(0, std::ios_base::beg);
-    assert(file.tellg() == std::streamoff(0));
-	std::vector<byte> buffer((size_t)file_len);
-    file.read((char*)(buffer.data()), file_len);
-    file.close();
+    // Start each file from a clean decoder, it keeps the reservoir and overlap of the last file otherwise
+    if(!decoder_ || !decoder_->reset()) {
+        SM_LOG("file_decoder must be initialised before decoding");
+        return sample_buffer;
+    }
 
-    file_contents.write(buffer.data(), (size_t)file_len);
-    SM_LOG("File Loaded, size =", file_contents.size() / (1000000.f), "MB");
+    file_contents.write(contents.data(), contents.size());
 
     // First, we need to skip the id3 header and position the file on the start of the mp3 header stream.  We therefore
     // need to scan the file for the sync word.
@@ -75,38 +68,176 @@ block_buffer<short> file_decoder::decode_file(const std::string& filename) {
     SM_LOG("STRIPPING HEADER: ", strip_header(file_contents));
 
     byte file_block[1024];
-    short left_pcm[1152], right_pcm[1152];
-    mp3data_struct mp3data;
-    memset(&mp3data, 0x00, sizeof(mp3data_struct));
+    short left_pcm[mp3_frame_size], right_pcm[mp3_frame_size];
     bool header_parsed = false;
 
     int ret = 0, len = 0;
     while((len = file_contents.read(file_block, 1024)) > 0) {
-        if(!header_parsed) {
-            ret = hip_decode1_headers(hip_, file_block, len, left_pcm, right_pcm, &mp3data);
-            if(mp3data.header_parsed == 1) {
-                SM_LOG("Header Parsed", ret);
-                SM_LOG("bitrate =", mp3data.bitrate);
-                SM_LOG("channels =", mp3data.stereo);
-                SM_LOG("samplerate =", mp3data.samplerate);
-                format_.samplerate = mp3data.samplerate;
-                format_.bitrate = mp3data.bitrate;
-                format_.channels = mp3data.stereo;
-                format_.total_frames = mp3data.totalframes;
-                format_.duration = mp3data.totalframes / format_.samplerate;
-                SM_LOG("duration =", format_.duration);
-                header_parsed = true;
-            }
-        } else {
-            ret = hip_decode1_headers(hip_, file_block, len, left_pcm, right_pcm, &mp3data);
+        ret = decoder_->decode(file_block, len, left_pcm, right_pcm);
+        if(!header_parsed && decoder_->get_format(format_)) {
+            SM_LOG("Header Parsed", ret);
+            SM_LOG("bitrate =", format_.bitrate);
+            SM_LOG("channels =", format_.channels);
+            SM_LOG("samplerate =", format_.samplerate);
+            SM_LOG("duration =", format_.duration);
+            header_parsed = true;
+        }
+
+        // The decoder returns one frame per call, the rest of the block stays queued inside it until drained
+        while(ret > 0) {
             zip(sample_buffer, left_pcm, right_pcm, ret);
-            //sample_buffer.write(left_pcm, ret);
+            ret = decoder_->decode(file_block, 0, left_pcm, right_pcm);
         }
     }
 
     return sample_buffer;
 }
 
+// Finds the start of the stream the same way decode_file() does
+size_t stream_lead(const std::vector<byte>& contents, const mp3_seek_index& index) {
+    size_t lead = id3v2_length(contents.data(), contents.size());
+    if(lead + 6 <= contents.size() && memcmp(contents.data() + lead, "AiD\1", 4) == 0)
+        lead += (size_t)contents[lead+4] + 256 * (size_t)contents[lead+5];
+    // The first frame is followed by at least its header, so a candidate at the byte before it is in range
+    const size_t end = index.frame_offset(0);
+    while(lead < end) {
+        lead += find_sync(contents.data() + lead, end + 1 - lead);
+        if(lead >= end || is_syncword_mp123(contents.data() + lead)) break;
+        ++lead;
+    }
+    return std::min(lead, end);
+}
+
+block_buffer<short> file_decoder::decode_file(const std::string& filename, size_t threads) {
+    if(threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+    if(pcm_cache::instance().enabled()) return decode_cached(filename, threads);
+
+    block_buffer<short> sample_buffer;
+
+    std::vector<byte> contents;
+    if(!load_file(filename, contents)) return sample_buffer;
+
+    mp3_seek_index index;
+    if(!index.build(contents.data(), contents.size())) {
+        SM_LOG("No MPEG audio frames found in", filename);
+        return sample_buffer;
+    }
+
+    const size_t lead = stream_lead(contents, index);
+    const size_t frames = index.frame_count();
+    threads = std::max<size_t>(std::min(threads, frames / min_segment_frames), 1);
+
+    std::vector<std::vector<short>> outputs(threads);
+    std::vector<mp3_format> formats(threads);
+    std::vector<char> results(threads, 0);
+    std::vector<std::thread> workers;
+
+    for(size_t i = 0; i != threads; ++i) {
+        const size_t keep = frames * i / threads, end = frames * (i + 1) / threads;
+        mp3_seek_point point;
+        index.lookup(keep * index.samples_per_frame(), point);
+
+        memset(&formats[i], 0x00, sizeof(mp3_format));
+        workers.emplace_back([&, i, keep, end, point]() {
+            results[i] = decode_segment(contents.data(), 0, index, i == 0 ? lead : contents.size(),
+                                        point.preroll_frame, keep, end, outputs[i], formats[i]);
+        });
+    }
+
+    size_t total = 0;
+    for(size_t i = 0; i != threads; ++i) {
+        workers[i].join();
+        total += outputs[i].size();
+    }
+
+    if(std::find(results.begin(), results.end(), 0) != results.end()) return sample_buffer;
+
+    if(formats[0].samplerate > 0) format_ = formats[0];
+
+    sample_buffer.reserve(total);
+    for(auto& output : outputs) {
+        sample_buffer.write(output.data(), output.size());
+        std::vector<short>().swap(output);
+    }
+
+    return sample_buffer;
+}
+
+// Assembles the file from pcm_cache chunks, the workers decode only the chunks that miss.  The file is read on the
+// first miss, a fully cached file is served without any I/O.
+block_buffer<short> file_decoder::decode_cached(const std::string& filename, size_t threads) {
+    block_buffer<short> sample_buffer;
+    auto& cache = pcm_cache::instance();
+    const std::string file_id = pcm_cache::file_identity(filename);
+
+    std::vector<byte> contents;
+    std::once_flag loaded;
+    bool load_ok = false;
+    auto load = [&]() {
+        std::call_once(loaded, [&]() { load_ok = load_file(filename, contents); });
+        return load_ok;
+    };
+
+    auto index = cache.get_index(file_id, [&](mp3_seek_index& index) {
+        return load() && index.build(contents.data(), contents.size());
+    });
+    if(!index) {
+        SM_LOG("No MPEG audio frames found in", filename);
+        return sample_buffer;
+    }
+
+    const size_t frames = index->frame_count();
+    const size_t chunks = (frames + pcm_cache::chunk_frames - 1) / pcm_cache::chunk_frames;
+    std::vector<pcm_cache::chunk_ptr> results(chunks);
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for(size_t chunk = next.fetch_add(1); chunk < chunks; chunk = next.fetch_add(1)) {
+            results[chunk] = cache.get(file_id, chunk, [&, chunk](pcm_chunk& output) {
+                if(!load()) return false;
+                const size_t keep = chunk * pcm_cache::chunk_frames;
+                const size_t end = std::min(frames, keep + pcm_cache::chunk_frames);
+                mp3_seek_point point;
+                index->lookup(keep * index->samples_per_frame(), point);
+                const size_t lead = chunk == 0 ? stream_lead(contents, *index) : contents.size();
+                return decode_segment(contents.data(), 0, *index, lead, point.preroll_frame, keep, end,
+                                      output.samples, output.format);
+            });
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(size_t i = 1; i < std::min(threads, chunks); ++i) workers.emplace_back(worker);
+    worker();
+    for(auto& thread : workers) thread.join();
+
+    size_t total = 0;
+    for(const auto& chunk : results) {
+        if(!chunk) return sample_buffer;
+        total += chunk->samples.size();
+    }
+
+    if(results[0]->format.samplerate > 0) format_ = results[0]->format;
+
+    sample_buffer.reserve(total);
+    for(const auto& chunk : results) sample_buffer.write(chunk->samples.data(), chunk->samples.size());
+    return sample_buffer;
+}
+
+bool load_file(const std::string& filename, std::vector<byte>& contents) {
+    std::ifstream file;
+    file.open(filename, std::ios_base::binary | std::ios_base::in);
+    if(!file.is_open()) { SM_LOG("Error opening file"); return false; }
+    file.seekg(0, std::ios_base::end);
+    auto file_len = file.tellg();
+    file.seekg(0, std::ios_base::beg);
+    assert(file.tellg() == std::streamoff(0));
+    contents.resize((size_t)file_len);
+    file.read((char*)(contents.data()), file_len);
+    file.close();
+    return true;
+}
+
 bool strip_header(block_buffer<byte>& buffer) {
     assert(buffer.get_cursor() == 0 && "buffer should be positioned at zero");
     byte header[100];
@@ -130,18 +261,23 @@ bool strip_header(block_buffer<byte>& buffer) {
         if(buffer.read(header, 4) != 4) return false;   // Reposition buffer
     }
 
-    // Now scan to find the mp3 sync word
-    size_t skipped = 0;
-    while(!is_syncword_mp123(buffer.read_ptr())) {
-        byte dummy;
-        if(buffer.read(&dummy, 1) != 1) return false;
-        skipped++;
-        if(skipped >= 2048) {
-            SM_LOG("Corrupted file, more than 2048 bytes skipped after headers and still no sync word");
-            return false;
-        }
+    // Step back over the last 4 bytes read, they may be the header of the first frame
+    buffer.reset(buffer.get_cursor() - 4);
+
+    // Now scan up to 2048 bytes for the mp3 sync word, jumping between the candidates the vector scan finds
+    const byte* data = buffer.read_ptr();
+    const size_t remaining = buffer.size() - buffer.get_cursor();
+    const size_t len = std::min(remaining, size_t(2048 + 3));
+    size_t pos = 0;
+    while(pos + 4 <= len) {
+        pos += find_sync(data + pos, len - pos);
+        if(pos + 4 > len) break;
+        if(is_syncword_mp123(data + pos)) return buffer.skip(pos) == pos;
+        ++pos;
     }
-    return true;
+
+    if(len < remaining) SM_LOG("Corrupted file, more than 2048 bytes skipped after headers and still no sync word");
+    return false;
 }
 
 bool is_syncword_mp123(const byte* ptr) {
@@ -8,24 +8,33 @@
 #include <vector>
 #include <algorithm>
 #include <iterator>
-#ifdef _WIN32
-#include <lame.h>
-#else
-#include <lame/lame.h>
-#endif //_WIN32
 #include "streams/mp3_stream.hpp"
 #include "buffers/block_buffer.hpp"
 
-class file_decoder {
+class ZAPAUDIO_EXPORT file_decoder {
 public:
     bool initialise();
     void shutdown();
 
     block_buffer<short> decode_file(const std::string& filename);
+    // Decodes a file already in memory, for callers that schedule their own I/O
+    block_buffer<short> decode_buffer(const std::vector<unsigned char>& contents);
+
+    // Both decode_file overloads use the pcm_cache when it is enabled.
+
+    // Splits the file at frame boundaries and decodes the segments concurrently, each on its own decoder.  Each
+    // segment starts a few frames early to warm up the bit reservoir so the output matches decode_file().  A thread
+    // count of zero uses all hardware threads.
+    block_buffer<short> decode_file(const std::string& filename, size_t threads);
+
+    const mp3_format& get_format() const { return format_; }
+
+protected:
+    // Serves the file from the pcm_cache, used by both decode_file overloads while the cache is enabled
+    block_buffer<short> decode_cached(const std::string& filename, size_t threads);
 
 private:
-    lame_t lame_;
-    hip_t hip_;
+    std::unique_ptr<mp3_decoder> decoder_;
     mp3_format format_;
 };
 
@@ -0,0 +1,146 @@
+#include "library_catalog.hpp"
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include "log.hpp"
+
+namespace {
+
+const char catalog_magic[4] = { 'Z', 'C', 'A', 'T' };
+
+// Interns strings into the table, so the repeated artist, album and genre names of a library are stored once
+class string_table {
+public:
+    string_table() : data_(1, '\0') { }
+
+    uint32_t add(const std::string& str) {
+        if(str.empty()) return 0;
+        auto it = offsets_.find(str);
+        if(it != offsets_.end()) return it->second;
+
+        const auto offset = uint32_t(data_.size());
+        data_.insert(data_.end(), str.begin(), str.end());
+        data_.push_back('\0');
+        offsets_.emplace(str, offset);
+        return offset;
+    }
+
+    const std::vector<char>& data() const { return data_; }
+
+private:
+    std::vector<char> data_;
+    std::unordered_map<std::string, uint32_t> offsets_;
+};
+
+}
+
+library_catalog::library_catalog() : records_(nullptr), strings_(nullptr), strings_size_(0) {
+}
+
+bool library_catalog::open(const std::string& filename) {
+    close();
+    if(!map_.open(filename)) return false;
+
+    const size_t size = map_.size();
+    const auto& hdr = header();
+    const bool valid = size >= sizeof(library_catalog_header) &&
+            memcmp(hdr.magic, catalog_magic, 4) == 0 &&
+            hdr.version == library_catalog_version &&
+            hdr.header_bytes == sizeof(library_catalog_header) &&
+            hdr.record_bytes == sizeof(library_record) &&
+            hdr.records_offset % alignof(library_record) == 0 &&
+            hdr.records_offset <= size && hdr.records <= (size - hdr.records_offset) / sizeof(library_record) &&
+            hdr.strings_offset <= size && hdr.strings_bytes != 0 && hdr.strings_bytes <= size - hdr.strings_offset &&
+            map_.data()[hdr.strings_offset + hdr.strings_bytes - 1] == '\0';     // No string can run off the end
+    if(!valid) {
+        SM_LOG("Not a supported library catalog:", filename);
+        close();
+        return false;
+    }
+
+    records_ = reinterpret_cast<const library_record*>(map_.data() + hdr.records_offset);
+    strings_ = reinterpret_cast<const char*>(map_.data() + hdr.strings_offset);
+    strings_size_ = size_t(hdr.strings_bytes);
+    return true;
+}
+
+void library_catalog::close() {
+    map_.close();
+    records_ = nullptr;
+    strings_ = nullptr;
+    strings_size_ = 0;
+}
+
+const library_record* library_catalog::find(const std::string& path) const {
+    auto it = std::lower_bound(begin(), end(), path, [this](const library_record& record, const std::string& key) {
+        return key.compare(string(record.path)) > 0;
+    });
+    return it != end() && path == string(it->path) ? it : nullptr;
+}
+
+bool library_catalog::write(const std::string& filename, const std::vector<library_entry>& entries) {
+    std::vector<const library_entry*> sorted(entries.size());
+    for(size_t i = 0; i != entries.size(); ++i) sorted[i] = &entries[i];
+    std::sort(sorted.begin(), sorted.end(), [](const library_entry* lhs, const library_entry* rhs) {
+        return lhs->path < rhs->path;
+    });
+
+    string_table strings;
+    std::vector<library_record> records;
+    records.reserve(sorted.size());
+    for(const auto* entry : sorted) {
+        library_record record = entry->record;
+        record.path = strings.add(entry->path);
+        record.title = strings.add(entry->title);
+        record.artist = strings.add(entry->artist);
+        record.album = strings.add(entry->album);
+        record.album_artist = strings.add(entry->album_artist);
+        record.genre = strings.add(entry->genre);
+        record.art_mime = strings.add(entry->art_mime);
+        record.reserved = 0;
+        records.push_back(record);
+    }
+
+    library_catalog_header hdr;
+    memset(&hdr, 0x00, sizeof(hdr));
+    memcpy(hdr.magic, catalog_magic, 4);
+    hdr.version = library_catalog_version;
+    hdr.header_bytes = sizeof(library_catalog_header);
+    hdr.record_bytes = sizeof(library_record);
+    hdr.records = records.size();
+    hdr.records_offset = sizeof(library_catalog_header);
+    hdr.strings_offset = hdr.records_offset + records.size()*sizeof(library_record);
+    hdr.strings_bytes = strings.data().size();
+    hdr.created = int64_t(std::time(nullptr));
+
+    const std::string temp = filename + ".tmp";
+    {
+        std::ofstream file(temp, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+        if(!file.is_open()) {
+            SM_LOG("Could not write library catalog:", temp);
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        file.write(reinterpret_cast<const char*>(records.data()), records.size()*sizeof(library_record));
+        file.write(strings.data().data(), strings.data().size());
+        if(!file) {
+            SM_LOG("Could not write library catalog:", temp);
+            file.close();
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+
+#ifdef _WIN32
+    std::remove(filename.c_str());      // rename does not replace an existing file on Windows
+#endif
+    if(std::rename(temp.c_str(), filename.c_str()) != 0) {
+        SM_LOG("Could not replace library catalog:", filename);
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+#ifndef ZAPAUDIO_LIBRARY_CATALOG_HPP
+#define ZAPAUDIO_LIBRARY_CATALOG_HPP
+
+/*
+ * A binary catalog of a music library, laid out to be used straight from a read-only mapping.  Opening a catalog maps
+ * it and validates the header, which costs the same for ten tracks as for a million: records are fixed size and sorted
+ * by path, so they are indexed directly or found by binary search, and strings are offsets into a table of
+ * NUL-terminated UTF-8.  Only the pages a query touches are read from disk.
+ *
+ * The layout is the in-memory layout of the structs below in little endian byte order.  A catalog with a different
+ * version, or written on a big endian machine, fails to open and should be rebuilt.
+ */
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "buffers/mapped_file.hpp"
+
+constexpr uint32_t library_catalog_version = 1;
+
+enum library_track_flags : uint16_t {
+    library_track_vbr = 0x01,
+    library_track_gapless = 0x02,               // encoder_delay and encoder_padding are from the LAME/VBRI tag
+    library_track_art_unsynchronised = 0x04     // The picture bytes need ID3 unsynchronisation undone
+};
+
+struct library_catalog_header {
+    char magic[4];                  // "ZCAT"
+    uint32_t version;
+    uint32_t header_bytes;
+    uint32_t record_bytes;
+    uint64_t records;
+    uint64_t records_offset;
+    uint64_t strings_offset;
+    uint64_t strings_bytes;
+    int64_t created;                // Seconds since the epoch
+    uint64_t reserved;
+};
+
+// One track.  The string fields are offsets into the string table, 0 is the empty string.
+struct library_record {
+    uint64_t file_size;
+    int64_t mtime;                  // Seconds since the epoch, with file_size used to tell if the file has changed
+    uint64_t total_samples;         // Per channel, with the encoder delay and padding removed
+    uint64_t audio_offset;          // Of the first audio frame
+    uint64_t art_offset;            // Of the embedded picture's data in the file
+    uint32_t art_size;              // 0 if there is no picture
+    uint32_t art_mime;
+    uint32_t path;
+    uint32_t title;
+    uint32_t artist;
+    uint32_t album;
+    uint32_t album_artist;
+    uint32_t genre;
+    uint32_t duration_ms;
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint16_t average_bitrate;       // kbps
+    uint16_t min_bitrate;
+    uint16_t max_bitrate;
+    uint16_t year;
+    uint16_t track;
+    uint16_t track_count;
+    uint16_t disc;
+    uint16_t flags;                 // library_track_flags
+    uint16_t encoder_delay;
+    uint16_t encoder_padding;
+    uint16_t reserved;
+};
+
+static_assert(sizeof(library_catalog_header) == 64, "the catalog header is part of the file format");
+static_assert(sizeof(library_record) == 104, "the catalog record is part of the file format");
+
+// A track as the indexer produces it, before it is written to a catalog
+struct ZAPAUDIO_EXPORT library_entry {
+    library_record record;          // The string fields are ignored, the strings below are written instead
+    std::string path;
+    std::string title;
+    std::string artist;
+    std::string album;
+    std::string album_artist;
+    std::string genre;
+    std::string art_mime;
+};
+
+class ZAPAUDIO_EXPORT library_catalog {
+public:
+    library_catalog();
+
+    bool open(const std::string& filename);
+    void close();
+    bool is_open() const { return map_.is_open(); }
+
+    size_t size() const { return records_ ? size_t(header().records) : 0; }
+    const library_record& operator[](size_t idx) const { return records_[idx]; }
+    const library_record* begin() const { return records_; }
+    const library_record* end() const { return records_ + size(); }
+
+    // A string field of a record, never null
+    const char* string(uint32_t offset) const { return offset < strings_size_ ? strings_ + offset : ""; }
+
+    // Binary search by path, nullptr if the path is not in the catalog
+    const library_record* find(const std::string& path) const;
+
+    const library_catalog_header& header() const {
+        return *reinterpret_cast<const library_catalog_header*>(map_.data());
+    }
+
+    // Writes the entries sorted by path.  The catalog is written to a temporary file and renamed over filename, so a
+    // process that has the old catalog mapped keeps a consistent view.
+    static bool write(const std::string& filename, const std::vector<library_entry>& entries);
+
+private:
+    mapped_file map_;
+    const library_record* records_;
+    const char* strings_;
+    size_t strings_size_;
+};
+
+#endif //ZAPAUDIO_LIBRARY_CATALOG_HPP
@@ -0,0 +1,267 @@
+#include "library_indexer.hpp"
+#include <set>
+#include <mutex>
+#include <deque>
+#include <limits>
+#include <thread>
+#include <iterator>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+#include "log.hpp"
+#include "streams/id3_tag.hpp"
+#include "streams/mp3_scanner.hpp"
+
+namespace {
+
+struct file_status {
+    bool directory;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t device;
+    uint64_t inode;
+};
+
+bool stat_path(const std::string& path, file_status& status) {
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) return false;
+    status.directory = (st.st_mode & S_IFMT) == S_IFDIR;
+    status.size = uint64_t(st.st_size);
+    status.mtime = int64_t(st.st_mtime);
+    status.device = uint64_t(st.st_dev);
+    status.inode = uint64_t(st.st_ino);
+    return true;
+}
+
+bool has_mp3_extension(const std::string& name) {
+    if(name.size() < 4) return false;
+    std::string ext = name.substr(name.size() - 4);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(std::tolower(c)); });
+    return ext == ".mp3";
+}
+
+// Calls fnc(path) for the subdirectories and .mp3 files in dir
+template <typename Fnc>
+void list_directory(const std::string& dir, Fnc fnc) {
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA((dir + "\\*").c_str(), &data);
+    if(handle == INVALID_HANDLE_VALUE) return;
+    do {
+        const std::string name = data.cFileName;
+        if(name == "." || name == "..") continue;
+        // stat has no inode to recognise a directory by on Windows, so junctions and links are not followed
+        if(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) continue;
+        const bool directory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        if(directory || has_mp3_extension(name)) fnc(dir + "\\" + name);
+    } while(FindNextFileA(handle, &data));
+    FindClose(handle);
+#else
+    DIR* handle = opendir(dir.c_str());
+    if(!handle) return;
+    while(struct dirent* entry = readdir(handle)) {
+        const std::string name = entry->d_name;
+        if(name == "." || name == "..") continue;
+        // d_type saves a stat per entry where the file system fills it in
+        bool directory = entry->d_type == DT_DIR;
+        if(entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            file_status status;
+            directory = stat_path(dir + "/" + name, status) && status.directory;
+        }
+        if(directory || has_mp3_extension(name)) fnc(dir + "/" + name);
+    }
+    closedir(handle);
+#endif
+}
+
+// Paths waiting to be listed or indexed.  pending counts the queued paths and those being worked on, the queue is
+// finished when it reaches zero since only a path being worked on can add more.  The directories listed are recorded
+// by device and inode, so a symlink back up the tree is not walked again.
+class index_queue {
+public:
+    index_queue() : pending_(0) { }
+
+    void push(std::string path) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        paths_.push_back(std::move(path));
+        ++pending_;
+        cv_.notify_one();
+    }
+
+    // Blocks until there is a path or every path has been processed
+    bool pop(std::string& path) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this]() { return !paths_.empty() || pending_ == 0; });
+        if(paths_.empty()) return false;
+        path = std::move(paths_.back());
+        paths_.pop_back();
+        return true;
+    }
+
+    // True the first time a directory is seen
+    bool visit(const file_status& status) {
+#ifdef _WIN32
+        return true;
+#else
+        std::lock_guard<std::mutex> lock(mtx_);
+        return visited_.insert(std::make_pair(status.device, status.inode)).second;
+#endif
+    }
+
+    // Called when a popped path is processed, after any paths it produced have been pushed
+    void done() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if(--pending_ == 0) cv_.notify_all();
+    }
+
+private:
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<std::string> paths_;
+    std::set<std::pair<uint64_t, uint64_t>> visited_;
+    size_t pending_;
+};
+
+uint16_t clamp16(int64_t value) {
+    return uint16_t(std::min<int64_t>(std::max<int64_t>(value, 0), std::numeric_limits<uint16_t>::max()));
+}
+
+bool index_mapped(const std::string& path, const file_status& status, library_entry& entry) {
+    mapped_file map;
+    if(!map.open(path)) return false;
+
+    mp3_scan_info scan;
+    if(!scan_mp3(map.data(), map.size(), scan)) {
+        SM_DEBUG("No MPEG audio stream in", path);
+        return false;
+    }
+
+    id3_tags tags;
+    parse_id3(map.data(), map.size(), tags);
+
+    auto& record = entry.record;
+    memset(&record, 0x00, sizeof(library_record));
+    record.file_size = status.size;
+    record.mtime = status.mtime;
+    record.total_samples = scan.total_samples;
+    record.audio_offset = scan.audio_offset;
+    record.duration_ms = uint32_t(scan.duration * 1000. + .5);
+    record.sample_rate = uint32_t(scan.header.samplerate);
+    record.channels = uint16_t(scan.header.channels);
+    record.average_bitrate = clamp16(scan.average_bitrate);
+    record.min_bitrate = clamp16(scan.min_bitrate);
+    record.max_bitrate = clamp16(scan.max_bitrate);
+    record.encoder_delay = clamp16(int64_t(scan.encoder_delay));
+    record.encoder_padding = clamp16(int64_t(scan.encoder_padding));
+    if(scan.vbr) record.flags |= library_track_vbr;
+    if(scan.has_gapless) record.flags |= library_track_gapless;
+
+    int total = 0;
+    record.year = clamp16(id3_number(tags.year));
+    record.track = clamp16(tags.track.empty() ? tags.v1_track : id3_number(tags.track, &total));
+    record.track_count = clamp16(total);
+    record.disc = clamp16(id3_number(tags.disc));
+
+    const auto& picture = tags.picture;
+    if(!picture.empty() && picture.size <= std::numeric_limits<uint32_t>::max()) {
+        record.art_offset = picture.offset;
+        record.art_size = uint32_t(picture.size);
+        if(picture.unsynchronised) record.flags |= library_track_art_unsynchronised;
+        entry.art_mime = id3_picture_mime(picture);
+    }
+
+    entry.path = path;
+    entry.title = id3_to_utf8(tags.title);
+    entry.artist = id3_to_utf8(tags.artist);
+    entry.album = id3_to_utf8(tags.album);
+    entry.album_artist = id3_to_utf8(tags.album_artist);
+    entry.genre = id3_genre(tags);
+    return true;
+}
+
+void entry_from_record(const library_catalog& catalog, const library_record& record, library_entry& entry) {
+    entry.record = record;
+    entry.path = catalog.string(record.path);
+    entry.title = catalog.string(record.title);
+    entry.artist = catalog.string(record.artist);
+    entry.album = catalog.string(record.album);
+    entry.album_artist = catalog.string(record.album_artist);
+    entry.genre = catalog.string(record.genre);
+    entry.art_mime = catalog.string(record.art_mime);
+}
+
+}
+
+library_indexer::library_indexer(size_t threads) : threads_(threads), previous_(nullptr), stats_() {
+    if(threads_ == 0) threads_ = std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+std::vector<library_entry> library_indexer::index(const std::vector<std::string>& roots) {
+    memset(&stats_, 0x00, sizeof(library_index_stats));
+    index_queue queue;
+    for(const auto& root : roots) queue.push(root);
+
+    std::vector<std::vector<library_entry>> results(threads_);
+    std::vector<library_index_stats> stats(threads_);
+    auto worker = [&](size_t id) {
+        auto& entries = results[id];
+        auto& counts = stats[id];
+        memset(&counts, 0x00, sizeof(library_index_stats));
+
+        std::string path;
+        while(queue.pop(path)) {
+            file_status status;
+            if(!stat_path(path, status)) {
+                ++counts.failed;
+            } else if(status.directory) {
+                if(queue.visit(status)) {
+                    ++counts.directories;
+                    list_directory(path, [&queue](std::string child) { queue.push(std::move(child)); });
+                }
+            } else {
+                ++counts.files;
+                library_entry entry;
+                const library_record* record = previous_ ? previous_->find(path) : nullptr;
+                if(record && record->file_size == status.size && record->mtime == status.mtime) {
+                    entry_from_record(*previous_, *record, entry);
+                    entries.push_back(std::move(entry));
+                    ++counts.reused;
+                } else if(index_mapped(path, status, entry)) {
+                    entries.push_back(std::move(entry));
+                    ++counts.indexed;
+                } else {
+                    ++counts.failed;
+                }
+            }
+            queue.done();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(size_t i = 1; i < threads_; ++i) workers.emplace_back(worker, i);
+    worker(0);
+    for(auto& thread : workers) thread.join();
+
+    std::vector<library_entry> entries;
+    for(size_t i = 0; i != threads_; ++i) {
+        stats_.directories += stats[i].directories;
+        stats_.files += stats[i].files;
+        stats_.indexed += stats[i].indexed;
+        stats_.reused += stats[i].reused;
+        stats_.failed += stats[i].failed;
+        std::move(results[i].begin(), results[i].end(), std::back_inserter(entries));
+    }
+    return entries;
+}
+
+bool library_indexer::index_file(const std::string& path, library_entry& entry) {
+    file_status status;
+    return stat_path(path, status) && !status.directory && index_mapped(path, status, entry);
+}
@@ -0,0 +1,47 @@
+#ifndef ZAPAUDIO_LIBRARY_INDEXER_HPP
+#define ZAPAUDIO_LIBRARY_INDEXER_HPP
+
+/*
+ * Builds library_entry records for every .mp3 file under a set of directories on a pool of workers.  Directories and
+ * files go through one queue, so listing a large directory tree is spread over the pool as well as reading the files.
+ * Each file is mapped and read only as far as scan_mp3() and parse_id3() need, which for a file with a Xing or VBRI
+ * tag is the ID3 tags and the first frames: the album art and the audio are never paged in.
+ *
+ * With a previous catalog, files whose size and modification time match their record are taken from the catalog
+ * without being opened.
+ */
+
+#include <string>
+#include <vector>
+#include "library_catalog.hpp"
+
+struct library_index_stats {
+    size_t directories;
+    size_t files;               // .mp3 files found
+    size_t indexed;             // Read from the file
+    size_t reused;              // Taken unchanged from the previous catalog
+    size_t failed;              // Not readable or no MPEG audio stream
+};
+
+class ZAPAUDIO_EXPORT library_indexer {
+public:
+    // A thread count of zero uses all hardware threads
+    explicit library_indexer(size_t threads=0);
+
+    void set_previous(const library_catalog* previous) { previous_ = previous; }
+
+    // Roots may be directories, searched recursively, or files
+    std::vector<library_entry> index(const std::vector<std::string>& roots);
+
+    const library_index_stats& get_stats() const { return stats_; }
+
+    // Reads the tags and stream parameters of one file
+    static bool index_file(const std::string& path, library_entry& entry);
+
+private:
+    size_t threads_;
+    const library_catalog* previous_;
+    library_index_stats stats_;
+};
+
+#endif //ZAPAUDIO_LIBRARY_INDEXER_HPP
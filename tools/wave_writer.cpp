@@ -0,0 +1,75 @@
+#include "wave_writer.hpp"
+#include "log.hpp"
+
+namespace {
+
+void put_u16(std::ofstream& file, uint16_t v) {
+    const char b[2] = { char(v & 0xFF), char(v >> 8) };
+    file.write(b, 2);
+}
+
+void put_u32(std::ofstream& file, uint32_t v) {
+    const char b[4] = { char(v & 0xFF), char((v >> 8) & 0xFF), char((v >> 16) & 0xFF), char(v >> 24) };
+    file.write(b, 4);
+}
+
+}
+
+bool wave_writer::open(const std::string& filename, size_t channels, size_t sample_rate, sample_format format,
+                       file_format type) {
+    close();
+
+    file_.open(filename, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    if(!file_.is_open()) {
+        SM_LOG("Failed to open output file:", filename);
+        return false;
+    }
+
+    channels_ = channels;
+    sample_rate_ = sample_rate;
+    format_ = format;
+    file_format_ = type;
+    data_bytes_ = 0;
+
+    if(file_format_ == file_format::wav) write_header(0);
+    return bool(file_);
+}
+
+bool wave_writer::write(const void* data, size_t bytes) {
+    if(!file_.is_open()) return false;
+    file_.write(static_cast<const char*>(data), std::streamsize(bytes));
+    data_bytes_ += bytes;
+    return bool(file_);
+}
+
+void wave_writer::close() {
+    if(!file_.is_open()) return;
+
+    if(file_format_ == file_format::wav) {
+        // RIFF sizes are 32 bit, anything longer is left at the maximum
+        const uint64_t limit = 0xFFFFFFFFu - 36;
+        file_.seekp(0, std::ios::beg);
+        write_header(uint32_t(data_bytes_ < limit ? data_bytes_ : limit));
+    }
+
+    file_.close();
+}
+
+void wave_writer::write_header(uint32_t data_bytes) {
+    const uint16_t bits = uint16_t(8*bytes_per_sample(format_));
+    const uint16_t block_align = uint16_t(channels_*bits/8);
+
+    file_.write("RIFF", 4);
+    put_u32(file_, 36 + data_bytes);
+    file_.write("WAVE", 4);
+    file_.write("fmt ", 4);
+    put_u32(file_, 16);
+    put_u16(file_, format_ == sample_format::s16 ? 1 : 3);
+    put_u16(file_, uint16_t(channels_));
+    put_u32(file_, uint32_t(sample_rate_));
+    put_u32(file_, uint32_t(sample_rate_*block_align));
+    put_u16(file_, block_align);
+    put_u16(file_, bits);
+    file_.write("data", 4);
+    put_u32(file_, data_bytes);
+}
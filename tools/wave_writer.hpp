@@ -0,0 +1,46 @@
+#ifndef ZAPAUDIO_WAVE_WRITER_HPP
+#define ZAPAUDIO_WAVE_WRITER_HPP
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include "backends/output_backend.hpp"
+
+/*
+ * Writes interleaved PCM to a canonical 44 byte header WAV file (format 1 for s16, 3 for f32) or as headerless raw
+ * samples.  The RIFF and data sizes are patched when the file is closed.
+ */
+
+enum class file_format {
+    wav,
+    raw
+};
+
+class ZAPAUDIO_EXPORT wave_writer {
+public:
+    wave_writer() : channels_(0), sample_rate_(0), format_(sample_format::s16), file_format_(file_format::wav),
+                    data_bytes_(0) { }
+    ~wave_writer() { close(); }
+
+    bool open(const std::string& filename, size_t channels, size_t sample_rate, sample_format format,
+              file_format type=file_format::wav);
+    bool is_open() const { return file_.is_open(); }
+
+    bool write(const void* data, size_t bytes);
+    void close();
+
+    uint64_t data_bytes() const { return data_bytes_; }
+
+protected:
+    void write_header(uint32_t data_bytes);
+
+private:
+    std::ofstream file_;
+    size_t channels_;
+    size_t sample_rate_;
+    sample_format format_;
+    file_format file_format_;
+    uint64_t data_bytes_;
+};
+
+#endif //ZAPAUDIO_WAVE_WRITER_HPP